@@ -12,6 +12,8 @@ typedef struct buffer_t {
   bool dev_dirty;
   size_t dims[4];
   size_t elem_size;
+  int32_t stride[4];
+  int32_t min[4];
 } buffer_t;
 #endif
 
@@ -35,14 +37,21 @@ class Image {
         buf.dims[1] = h;
         buf.dims[2] = c;
         buf.dims[3] = 1;
+        buf.stride[0] = 1;
+        buf.stride[1] = w;
+        buf.stride[2] = w*h;
+        buf.stride[3] = w*h*c;
+        buf.min[0] = buf.min[1] = buf.min[2] = buf.min[3] = 0;
         buf.elem_size = sizeof(T);
 
-        uint8_t *ptr = new uint8_t[sizeof(T)*w*h*c+16];
+        // Align to 64 bytes, like the images the JIT allocates, since
+        // code compiled for AVX targets assumes it
+        uint8_t *ptr = new uint8_t[sizeof(T)*w*h*c+64];
         buf.host = ptr;
         buf.host_dirty = false;
         buf.dev_dirty = false;
         buf.dev = 0;
-        while ((size_t)buf.host & 0xf) buf.host++; 
+        while ((size_t)buf.host & 0x3f) buf.host++;
         contents.reset(new Contents {buf, ptr});
     }
 
@@ -1,4 +1,5 @@
 #include <Halide.h>
+#include <stdlib.h>
 using namespace Halide;
 
 int main(int argc, char **argv) {
@@ -12,6 +13,13 @@ int main(int argc, char **argv) {
   blur_y(x, y) = (blur_x(x, y-1) + blur_x(x, y) + blur_x(x, y+1))/3;
   
   // How to schedule it
+  if (getenv("HL_AUTO_SCHEDULE")) {
+    // Compare the auto-scheduler against the hand schedules below
+    blur_y.autoSchedule(6400, 4864);
+    blur_y.compileToFile("halide_blur");
+    return 0;
+  }
+
   #if 0
   blur_y.tile(x, y, xi, yi, 64, 64);
   blur_y.vectorize(xi, 8);
@@ -181,7 +181,8 @@ extern "C" {
 
 // Convert a CIMG image to a buffer_t for halide
 buffer_t halideBufferOfImage(Image &im) {
-  buffer_t buf = {(uint8_t *)im.data(), 0, false, false, {im.width(), im.height(), 1, 1}, sizeof(int16_t)};
+  buffer_t buf = {(uint8_t *)im.data(), 0, false, false, {im.width(), im.height(), 1, 1}, sizeof(int16_t),
+                  {1, im.width(), im.width()*im.height(), im.width()*im.height()}, {0, 0, 0, 0}};
   return buf;
 }
 
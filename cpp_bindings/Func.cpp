@@ -11,6 +11,11 @@
 #include <llvm/Assembly/PrintModulePass.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/IPO.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/system_error.h>
+#include <llvm/LLVMContext.h>
 #include <sys/time.h>
 
 #include "../src/buffer.h"
@@ -20,9 +25,18 @@
 #include "Image.h"
 #include "Uniform.h"
 #include <sstream>
+#include <set>
+#include <map>
 
 #include <dlfcn.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <algorithm>
 
 namespace Halide {
     
@@ -37,22 +51,26 @@ namespace Halide {
     ML_FUNC2(makeVectorizeTransform);
     ML_FUNC2(makeUnrollTransform);
     ML_FUNC4(makeBoundTransform);
-    ML_FUNC5(makeSplitTransform);
+    ML_FUNC6(makeSplitTransform);
     ML_FUNC3(makeTransposeTransform);
     ML_FUNC2(makeChunkTransform);
+    ML_FUNC2(makeSlideTransform);
     ML_FUNC1(makeRootTransform);
     ML_FUNC2(makeParallelTransform);
     ML_FUNC2(makeRandomTransform);
+    ML_FUNC2(makeAutoScheduleTransform);
     
     ML_FUNC1(doConstantFold);
     
     ML_FUNC3(makeDefinition);
     ML_FUNC6(addScatterToDefinition);
+    ML_FUNC6(addRFactorToDefinition);
+    ML_FUNC6(addVectorizedReductionToDefinition);
     ML_FUNC0(makeEnv);
     ML_FUNC2(addDefinitionToEnv);
     
     ML_FUNC4(makeSchedule);
-    ML_FUNC3(doLower);
+    ML_FUNC4(doLower); // name, env, schedule, any layout
 
     ML_FUNC0(makeNoviceGuru);
     ML_FUNC1(loadGuruFromFile);
@@ -63,7 +81,8 @@ namespace Halide {
     ML_FUNC1(makeBufferArg); // name
     ML_FUNC2(makeScalarArg); // name, type
     ML_FUNC3(doCompile); // name, args, stmt
-    ML_FUNC3(doCompileToFile); // name, args, stmt
+    ML_FUNC3(doCacheKey); // name, args, stmt
+    ML_FUNC4(doCompileToFile); // name, args, stmt, target
     ML_FUNC2(makePair);
     ML_FUNC3(makeTriple);
 
@@ -100,25 +119,32 @@ namespace Halide {
 
     struct Func::Contents {
         Contents() :
-            name(uniqueName('f')), functionPtr(NULL) {}
+            name(uniqueName('f')), anyLayout(false), functionPtr(NULL) {}
         Contents(Type returnType) : 
-            name(uniqueName('f')), returnType(returnType), functionPtr(NULL) {}
+            name(uniqueName('f')), returnType(returnType), anyLayout(false), functionPtr(NULL) {}
       
         Contents(std::string name) : 
-            name(name), functionPtr(NULL) {}
+            name(name), anyLayout(false), functionPtr(NULL) {}
         Contents(std::string name, Type returnType) : 
-            name(name), returnType(returnType), functionPtr(NULL) {}
+            name(name), returnType(returnType), anyLayout(false), functionPtr(NULL) {}
       
         Contents(const char * name) : 
-            name(name), functionPtr(NULL) {}
+            name(name), anyLayout(false), functionPtr(NULL) {}
         Contents(const char * name, Type returnType) : 
-            name(name), returnType(returnType), functionPtr(NULL) {}
+            name(name), returnType(returnType), anyLayout(false), functionPtr(NULL) {}
         
         const std::string name;
         
         static llvm::ExecutionEngine *ee;
         static llvm::FunctionPassManager *fPassMgr;
         static llvm::PassManager *mPassMgr;
+
+        // Modules already added to the execution engine. Structurally
+        // identical pipelines share a module.
+        static std::set<llvm::Module *> jitModules;
+
+        // Modules loaded from the on-disk JIT cache, by path
+        static std::map<std::string, llvm::Module *> diskModules;
         
         // The scalar value returned by the function
         Expr rhs;
@@ -140,18 +166,36 @@ namespace Halide {
         std::vector<MLVal> scheduleTransforms;        
         MLVal applyScheduleTransforms(MLVal);
 
+        // If set, a saved guru to schedule the pipeline with instead
+        std::string guruFile;
+
+        // Whether the compiled code should accept inputs and outputs
+        // that aren't dense and aligned (see allowAnyLayout)
+        bool anyLayout;
+
         // The compiled form of this function
         mutable void (*functionPtr)(void *);
+        std::unique_ptr<Callable> callable;
 
         // Functions to assist realizing this function
         mutable void (*copyToHost)(buffer_t *);
         mutable void (*freeBuffer)(buffer_t *);
         mutable void (*errorHandler)(char *);
+        // The profiler in the compiled module's runtime
+        mutable void (*profileReport)();
+        mutable void (*profileReset)();
+        // The thread pool in the compiled module's runtime
+        mutable void (*setNumThreads)(int);
+        mutable void (*threadPoolStats)(int *, int *, int *);
+        // The scratch allocator in the compiled module's runtime
+        mutable void (*scratchStats)(size_t *, size_t *);
     };
 
     llvm::ExecutionEngine *Func::Contents::ee = NULL;
     llvm::FunctionPassManager *Func::Contents::fPassMgr = NULL;
     llvm::PassManager *Func::Contents::mPassMgr = NULL;
+    std::set<llvm::Module *> Func::Contents::jitModules;
+    std::map<std::string, llvm::Module *> Func::Contents::diskModules;
     
     FuncRef::FuncRef(const Func &f) :
         contents(new FuncRef::Contents(f)) {
@@ -353,6 +397,48 @@ namespace Halide {
         return *contents->update;
     }
 
+    Func &Func::rfactor(const RVar &r, int slices) {
+        assert(contents->update && "Can only rfactor a reduction");
+        assert(slices > 0);
+        std::string partial = uniqueName('f'), partialUpdate = uniqueName('p');
+        std::string slice = uniqueName('v'), inner = uniqueName('r');
+        *environment = addRFactorToDefinition(*environment, name(), r.name(), slices,
+                                              makePair(partial, partialUpdate),
+                                              makePair(slice, inner));
+
+        // Each slice of the partial result is initialized and updated
+        // by a different thread
+        contents->scheduleTransforms.push_back(makeParallelTransform(partial, slice));
+        contents->scheduleTransforms.push_back(makeParallelTransform(partialUpdate, slice));
+
+        contents->functionPtr = NULL;
+        contents->callable.reset();
+        return *this;
+    }
+
+    Func &Func::vectorize(const RVar &r, int width) {
+        assert(contents->update && "Can only vectorize a reduction over its reduction domain");
+        assert(width > 0);
+        std::string main = uniqueName('f'), mainUpdate = uniqueName('p');
+        std::string tail = uniqueName('f'), tailUpdate = uniqueName('p');
+        std::string lane = uniqueName('v'), inner = uniqueName('r');
+        *environment = addVectorizedReductionToDefinition(*environment, name(), r.name(), width,
+                                                          makePair(makePair(main, mainUpdate),
+                                                                   makePair(tail, tailUpdate)),
+                                                          makePair(lane, inner));
+
+        // The lanes of the main partial result are computed as one vector
+        MLVal min = Expr(0).node(), size = Expr(width).node();
+        contents->scheduleTransforms.push_back(makeBoundTransform(main, lane, min, size));
+        contents->scheduleTransforms.push_back(makeVectorizeTransform(main, lane));
+        contents->scheduleTransforms.push_back(makeBoundTransform(mainUpdate, lane, min, size));
+        contents->scheduleTransforms.push_back(makeVectorizeTransform(mainUpdate, lane));
+
+        contents->functionPtr = NULL;
+        contents->callable.reset();
+        return *this;
+    }
+
     void *watchdog(void *arg) {
         useconds_t t = ((useconds_t *)arg)[0];
         printf("Watchdog sleeping for %d microseconds\n", t);
@@ -410,11 +496,275 @@ namespace Halide {
         return 0;
     }
 
+    // Replay a list of seeds as random schedule transforms over the
+    // whole pipeline, the same way the subprocess-based autotune does
+    static void applySeeds(Func f, const std::vector<int> &seeds) {
+        for (size_t i = 0; i < seeds.size(); i++) {
+            srand(seeds[i]);
+            for (const Func &_g : f.rhs().funcs()) {
+                Func g = _g;
+                g.random(rand());
+            }
+            f.random(rand());
+        }
+    }
+
+    static double currentTime() {
+        timeval t;
+        gettimeofday(&t, NULL);
+        return t.tv_sec + t.tv_usec / 1000000.0;
+    }
+
+    static volatile bool tuneRunFailed = false;
+    static void tuneErrorHandler(char *msg) {
+        tuneRunFailed = true;
+    }
+
+    // Time a compiled candidate. After a warmup run, we take samples
+    // of at least a millisecond each until the 95% confidence
+    // interval of the mean is within 2% of it, or until we've spent
+    // two seconds. Samples more than three (robust) standard
+    // deviations from the median are dropped as outliers before
+    // computing the mean. Returns the time per run in microseconds,
+    // or a negative number if a run failed.
+    static double benchmark(const Func::Callable &c, const DynImage &im) {
+        const int minSamples = 5, maxSamples = 100;
+        const double budget = 2.0, precision = 0.02;
+
+        double start = currentTime();
+        c(im);
+        c(im);
+        double warmup = (currentTime() - start) / 2;
+        if (tuneRunFailed) return -1;
+        int runs = warmup > 0.001 ? 1 : (int)(0.001 / std::max(warmup, 1e-7)) + 1;
+
+        std::vector<double> samples;
+        double mean = 0;
+        while ((int)samples.size() < maxSamples) {
+            double before = currentTime();
+            for (int i = 0; i < runs; i++) c(im);
+            double after = currentTime();
+            if (tuneRunFailed) return -1;
+            samples.push_back((after - before) / runs);
+            if ((int)samples.size() < minSamples) continue;
+
+            std::vector<double> sorted(samples);
+            std::sort(sorted.begin(), sorted.end());
+            double median = sorted[sorted.size()/2];
+            std::vector<double> deviations;
+            for (size_t i = 0; i < sorted.size(); i++) {
+                deviations.push_back(fabs(sorted[i] - median));
+            }
+            std::sort(deviations.begin(), deviations.end());
+            double sigma = 1.4826 * deviations[deviations.size()/2];
+
+            double sum = 0, sumSq = 0;
+            int n = 0;
+            for (size_t i = 0; i < sorted.size(); i++) {
+                if (sigma > 0 && fabs(sorted[i] - median) > 3 * sigma) continue;
+                sum += sorted[i];
+                sumSq += sorted[i] * sorted[i];
+                n++;
+            }
+            mean = sum / n;
+            double variance = std::max(0.0, sumSq / n - mean * mean) * n / std::max(n - 1, 1);
+            double halfWidth = 1.96 * ::sqrt(variance / n);
+            if (halfWidth < precision * mean || after - start > budget) break;
+        }
+        return mean * 1000000;
+    }
+
+    // What a forked child does with a candidate: schedule it, compile
+    // it, tell the parent it's ready, wait to be told to go, then
+    // benchmark it and send back the time. Compilation happens in
+    // parallel across children, but only one is benchmarked at a
+    // time. A candidate that fails to compile or crashes only takes
+    // down its child. The runtime's thread pool restarts itself in
+    // the child, since the parent's pool threads don't come along.
+    static void tuneCandidate(Func f, const std::vector<int> &sizes, const std::vector<int> &seeds,
+                              int fromParent, int toParent) {
+        applySeeds(f, seeds);
+        f.setErrorHandler(tuneErrorHandler);
+        f.compileJIT();
+        Func::Callable c = f.callable();
+        DynImage im(f.returnType(), sizes);
+
+        char msg = 'R';
+        if (write(toParent, &msg, 1) != 1 || read(fromParent, &msg, 1) != 1) _exit(1);
+        double t = benchmark(c, im);
+        if (write(toParent, &t, sizeof(t)) != sizeof(t)) _exit(1);
+        _exit(0);
+    }
+
+    // Wait up to a deadline to read n bytes from a pipe. Returns false
+    // on timeout or if the other end went away.
+    static bool readWithDeadline(int fd, void *buf, size_t n, double deadline) {
+        size_t got = 0;
+        while (got < n) {
+            double remaining = deadline - currentTime();
+            if (remaining <= 0) return false;
+            pollfd p = {fd, POLLIN, 0};
+            int r = poll(&p, 1, (int)(remaining * 1000) + 1);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            ssize_t k = read(fd, (char *)buf + got, n - got);
+            if (k <= 0) return false;
+            got += k;
+        }
+        return true;
+    }
+
+    // Time each candidate, as many at once as we have cores. Failed
+    // candidates get an infinite time.
+    static std::vector<double> tuneCandidates(Func f, const std::vector<int> &sizes,
+                                              const std::vector<std::vector<int> > &candidates) {
+        const double compileLimit = 120, runLimit = 30;
+        int jobs = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+        std::vector<double> times(candidates.size(), HUGE_VAL);
+
+        // Children that die would otherwise take us with them when we
+        // write to them
+        void (*oldHandler)(int) = signal(SIGPIPE, SIG_IGN);
+
+        for (size_t start = 0; start < candidates.size(); start += jobs) {
+            size_t end = std::min(candidates.size(), start + jobs);
+            std::vector<pid_t> pids;
+            std::vector<int> toChild, fromChild;
+
+            fflush(stdout);
+            for (size_t i = start; i < end; i++) {
+                int down[2], up[2];
+                if (pipe(down) || pipe(up)) {
+                    perror("pipe");
+                    exit(1);
+                }
+                pid_t pid = fork();
+                if (pid == 0) {
+                    close(down[1]);
+                    close(up[0]);
+                    tuneCandidate(f, sizes, candidates[i], down[0], up[1]);
+                }
+                close(down[0]);
+                close(up[1]);
+                pids.push_back(pid);
+                toChild.push_back(down[1]);
+                fromChild.push_back(up[0]);
+            }
+
+            // Wait for them all to finish compiling, so that nothing
+            // else is using the machine while we time them
+            std::vector<bool> ready(pids.size(), false);
+            double deadline = currentTime() + compileLimit;
+            for (size_t i = 0; i < pids.size(); i++) {
+                char msg;
+                ready[i] = pids[i] > 0 && readWithDeadline(fromChild[i], &msg, 1, deadline) && msg == 'R';
+            }
+
+            for (size_t i = 0; i < pids.size(); i++) {
+                double t;
+                char msg = 'G';
+                if (ready[i] && write(toChild[i], &msg, 1) == 1 &&
+                    readWithDeadline(fromChild[i], &t, sizeof(t), currentTime() + runLimit) && t >= 0) {
+                    times[start + i] = t;
+                }
+                if (pids[i] > 0) {
+                    kill(pids[i], SIGKILL);
+                    waitpid(pids[i], NULL, 0);
+                }
+                close(toChild[i]);
+                close(fromChild[i]);
+            }
+        }
+
+        signal(SIGPIPE, oldHandler);
+        return times;
+    }
+
+    static std::string seedsToString(const std::vector<int> &seeds) {
+        std::ostringstream ss;
+        for (size_t i = 0; i < seeds.size(); i++) {
+            ss << (i ? " " : "") << seeds[i];
+        }
+        return ss.str();
+    }
+
+    double Func::autotune(std::vector<int> sizes, int generations, const std::string &guruFile) {
+        const int populationSize = 16;
+
+        // We're searching over schedule transforms, so a saved guru
+        // would make them all the same
+        contents->guruFile.clear();
+
+        // Each candidate is a list of seeds for random schedule
+        // transforms, evolved the same way as in apps/autotune.py
+        std::vector<std::vector<int> > population(populationSize);
+        std::map<std::vector<int>, double> times;
+
+        for (int generation = 0; generation < generations; generation++) {
+            std::vector<std::vector<int> > untimed;
+            for (size_t i = 0; i < population.size(); i++) {
+                if (!times.count(population[i]) &&
+                    std::find(untimed.begin(), untimed.end(), population[i]) == untimed.end()) {
+                    untimed.push_back(population[i]);
+                }
+            }
+            std::vector<double> t = tuneCandidates(*this, sizes, untimed);
+            for (size_t i = 0; i < untimed.size(); i++) {
+                times[untimed[i]] = t[i];
+            }
+
+            // Keep the best quarter, and add three mutations of each
+            std::vector<std::pair<double, std::vector<int> > > ranked;
+            for (size_t i = 0; i < population.size(); i++) {
+                ranked.push_back(std::make_pair(times[population[i]], population[i]));
+            }
+            std::sort(ranked.begin(), ranked.end());
+            printf("Generation %d: best %f us with seeds [%s]\n", generation,
+                   ranked[0].first, seedsToString(ranked[0].second).c_str());
+
+            population.clear();
+            for (int i = 0; i < populationSize / 4; i++) {
+                population.push_back(ranked[i].second);
+            }
+            for (int copy = 0; copy < 3; copy++) {
+                for (int i = 0; i < populationSize / 4; i++) {
+                    std::vector<int> dna = ranked[i].second;
+                    int choice = rand() % 10;
+                    if (dna.empty()) dna.push_back(rand() % 10000);
+                    else if (choice == 0) dna[rand() % dna.size()] = rand() % 10000;
+                    else if (choice == 1) for (size_t j = 0; j < dna.size(); j++) dna[j] = rand() % 10000;
+                    else if (choice == 2) dna.erase(dna.begin() + rand() % dna.size());
+                    else dna.push_back(rand() % 10000);
+                    population.push_back(dna);
+                }
+            }
+        }
+
+        std::vector<int> best;
+        double bestTime = HUGE_VAL;
+        for (std::map<std::vector<int>, double>::iterator i = times.begin(); i != times.end(); i++) {
+            if (i->second < bestTime) {
+                bestTime = i->second;
+                best = i->first;
+            }
+        }
+
+        // Adopt the best schedule found
+        applySeeds(*this, best);
+        contents->functionPtr = NULL;
+        contents->callable.reset();
+        if (!guruFile.empty()) {
+            saveGuruToFile(guru(), guruFile);
+        }
+
+        return bestTime;
+    }
+
     Func &Func::tile(const Var &x, const Var &y, 
                      const Var &xi, const Var &yi, 
-                     const Expr &f1, const Expr &f2) {
-        split(x, x, xi, f1);
-        split(y, y, yi, f2);
+                     const Expr &f1, const Expr &f2, TailStrategy tail) {
+        split(x, x, xi, f1, tail);
+        split(y, y, yi, f2, tail);
         transpose(x, yi);
         return *this;
     }
@@ -422,9 +772,9 @@ namespace Halide {
     Func &Func::tile(const Var &x, const Var &y, 
                      const Var &xo, const Var &yo,
                      const Var &xi, const Var &yi, 
-                     const Expr &f1, const Expr &f2) {
-        split(x, xo, xi, f1);
-        split(y, yo, yi, f2);
+                     const Expr &f1, const Expr &f2, TailStrategy tail) {
+        split(x, xo, xi, f1, tail);
+        split(y, yo, yi, f2, tail);
         transpose(xo, yi);
         return *this;
     }
@@ -436,10 +786,10 @@ namespace Halide {
         return *this;
     }
 
-    Func &Func::vectorize(const Var &v, int factor) {
+    Func &Func::vectorize(const Var &v, int factor, TailStrategy tail) {
         if (factor == 1) return *this;
         Var vi;
-        split(v, v, vi, factor);
+        split(v, v, vi, factor, tail);
         vectorize(vi);        
         return *this;
     }
@@ -451,24 +801,52 @@ namespace Halide {
         return *this;
     }
 
-    Func &Func::unroll(const Var &v, int factor) {
+    Func &Func::unroll(const Var &v, int factor, TailStrategy tail) {
         if (factor == 1) return *this;
         Var vi;
-        split(v, v, vi, factor);
+        split(v, v, vi, factor, tail);
         unroll(vi);
         return *this;
     }
 
-    Func &Func::split(const Var &old, const Var &newout, const Var &newin, const Expr &factor) {
+    Func &Func::split(const Var &old, const Var &newout, const Var &newin, const Expr &factor, TailStrategy tail) {
+        const char *tail_names[] = {"round_up", "shift_inward", "epilogue"};
         MLVal t = makeSplitTransform(name(),
                                      old.name(),
                                      newout.name(),
                                      newin.name(),
-                                     factor.node());
+                                     factor.node(),
+                                     tail_names[tail]);
         contents->scheduleTransforms.push_back(t);
         return *this;
     }
 
+    Func &Func::autoSchedule(std::vector<int> sizes) {
+        MLVal list = makeList();
+        for (size_t i = sizes.size(); i > 0; i--) {
+            list = addToList(list, sizes[i-1]);
+        }
+        MLVal t = makeAutoScheduleTransform(name(), list);
+        contents->scheduleTransforms.push_back(t);
+        return *this;
+    }
+
+    Func &Func::autoSchedule(int a) {
+        return autoSchedule(std::vector<int>(1, a));
+    }
+
+    Func &Func::autoSchedule(int a, int b) {
+        std::vector<int> sizes(2);
+        sizes[0] = a; sizes[1] = b;
+        return autoSchedule(sizes);
+    }
+
+    Func &Func::autoSchedule(int a, int b, int c) {
+        std::vector<int> sizes(3);
+        sizes[0] = a; sizes[1] = b; sizes[2] = c;
+        return autoSchedule(sizes);
+    }
+
     Func &Func::transpose(const Var &outer, const Var &inner) {
         MLVal t = makeTransposeTransform((name()),
                                          (outer.name()),
@@ -483,6 +861,12 @@ namespace Halide {
         return *this;
     }
 
+    Func &Func::slide(const Var &caller_var) {
+        MLVal t = makeSlideTransform(name(), caller_var.name());
+        contents->scheduleTransforms.push_back(t);
+        return *this;
+    }
+
     Func &Func::root() {
         MLVal t = makeRootTransform(name());
         contents->scheduleTransforms.push_back(t);
@@ -640,14 +1024,9 @@ namespace Halide {
         return guru;
     }
 
-    // Returns a stmt, args pair
-    MLVal Func::lower() {
-        // Make a region to evaluate this over
-        MLVal sizes = makeList();        
-        for (size_t i = args().size(); i > 0; i--) {                
-            char buf[256];
-            snprintf(buf, 256, ".result.dim.%d", ((int)i)-1);
-            sizes = addToList(sizes, Expr(Var(buf)).node());
+    MLVal Func::guru() {
+        if (!contents->guruFile.empty()) {
+            return loadGuruFromFile(contents->guruFile);
         }
 
         MLVal guru = makeNoviceGuru();
@@ -666,19 +1045,45 @@ namespace Halide {
             guru = f.contents->applyScheduleTransforms(guru);
         }
 
-        //saveGuruToFile(guru, name() + ".guru");
-        
+        return guru;
+    }
+
+    Func &Func::allowAnyLayout(bool allow) {
+        contents->anyLayout = allow;
+        contents->functionPtr = NULL;
+        contents->callable.reset();
+        return *this;
+    }
+
+    Func &Func::loadSchedule(const std::string &filename) {
+        contents->guruFile = filename;
+        contents->functionPtr = NULL;
+        contents->callable.reset();
+        return *this;
+    }
+
+    // Returns a stmt, args pair
+    MLVal Func::lower() {
+        // Make a region to evaluate this over
+        MLVal sizes = makeList();        
+        for (size_t i = args().size(); i > 0; i--) {                
+            char buf[256];
+            snprintf(buf, 256, ".result.dim.%d", ((int)i)-1);
+            sizes = addToList(sizes, Expr(Var(buf)).node());
+        }
+
         MLVal sched = makeSchedule((name()),
                                    sizes,
                                    *Func::environment,
-                                   guru);
+                                   guru());
         
         //printf("Done transforming schedule\n");
         //printSchedule(sched);
         
         return doLower((name()), 
                        *Func::environment,
-                       sched);        
+                       sched,
+                       contents->anyLayout ? 1 : 0);
     }
 
     MLVal Func::inferArguments() {        
@@ -710,13 +1115,14 @@ namespace Halide {
         return std::string(serializeEntry(name(), args, stmt));
     }
 
-    void Func::compileToFile(const std::string &moduleName) { 
+    void Func::compileToFile(const std::string &moduleName, const std::string &target) { 
         MLVal stmt = lower();
         MLVal args = inferArguments();
-        doCompileToFile(moduleName, args, stmt);
+        doCompileToFile(moduleName, args, stmt, target);
     }
 
-    void Func::compileToFile(const std::string &moduleName, std::vector<Func::Arg> uniforms) { 
+    void Func::compileToFile(const std::string &moduleName, std::vector<Func::Arg> uniforms,
+                             const std::string &target) { 
         MLVal stmt = lower();
 
         MLVal args = makeList();
@@ -725,14 +1131,72 @@ namespace Halide {
             args = addToList(args, uniforms[i-1].arg);
         }
 
-        doCompileToFile(moduleName, args, stmt);
+        doCompileToFile(moduleName, args, stmt, target);
     }
 
     void Func::setErrorHandler(void (*handler)(char *)) {
         contents->errorHandler = handler;
     }
 
+    // Load a previously optimized module from the JIT cache. Returns
+    // NULL on a miss.
+    static llvm::Module *loadCachedModule(const std::string &path) {
+        if (path.empty()) return NULL;
+
+        llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+        if (llvm::MemoryBuffer::getFile(path, buffer)) return NULL;
+
+        // Like the modules built by the compiler, this context lives
+        // as long as the execution engine does.
+        llvm::LLVMContext *context = new llvm::LLVMContext();
+        std::string errStr;
+        llvm::Module *m = llvm::ParseBitcodeFile(buffer.get(), *context, &errStr);
+        if (!m) {
+            fprintf(stderr, "Ignoring bad JIT cache entry %s: %s\n", path.c_str(), errStr.c_str());
+            delete context;
+        }
+        return m;
+    }
+
+    // Write an optimized module to the JIT cache. Writes go to a
+    // temporary file which is then renamed into place, so concurrent
+    // processes never see a partial entry.
+    static void saveCachedModule(llvm::Module *m, const std::string &path) {
+        if (path.empty()) return;
+
+        std::string tmpPath = path + ".tmp." + int_to_str(getpid());
+        std::string errStr;
+        {
+            llvm::raw_fd_ostream out(tmpPath.c_str(), errStr, llvm::raw_fd_ostream::F_Binary);
+            if (!errStr.empty()) {
+                fprintf(stderr, "Could not write JIT cache entry %s: %s\n", tmpPath.c_str(), errStr.c_str());
+                return;
+            }
+            llvm::WriteBitcodeToFile(m, out);
+        }
+        if (rename(tmpPath.c_str(), path.c_str())) {
+            unlink(tmpPath.c_str());
+        }
+    }
+
+    // Find the buffer_t wrapper in a module loaded from the JIT
+    // cache. It may have been compiled for a Func with another name.
+    static llvm::Function *findWrapper(llvm::Module *m) {
+        const std::string suffix = "_c_wrapper";
+        for (llvm::Module::iterator i = m->begin(); i != m->end(); i++) {
+            std::string n = i->getName().str();
+            if (!i->isDeclaration() && n.size() > suffix.size() &&
+                n.compare(n.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                return &*i;
+            }
+        }
+        return NULL;
+    }
+
     void Func::compileJIT() {
+        // Any Callable we handed out keeps the old code
+        contents->callable.reset();
+
         if (getenv("HL_PSEUDOJIT") && getenv("HL_PSEUDOJIT") == std::string("1")) {
             // llvm's ARM jit path has many issues currently. Instead
             // we'll do static compilation to a shared object, then
@@ -774,6 +1238,12 @@ namespace Halide {
                 void (*setErrorHandlerFn)(void (*)(char *)) = (void (*)(void (*)(char *)))ptr;
                 setErrorHandlerFn(contents->errorHandler);
             }
+
+            contents->profileReport = (void (*)())dlsym(handle, "halide_profile_report");
+            contents->profileReset = (void (*)())dlsym(handle, "halide_profile_reset");
+            contents->setNumThreads = (void (*)(int))dlsym(handle, "halide_set_num_threads");
+            contents->threadPoolStats = (void (*)(int *, int *, int *))dlsym(handle, "halide_thread_pool_stats");
+            contents->scratchStats = (void (*)(size_t *, size_t *))dlsym(handle, "halide_scratch_stats");
             
             return;
         }
@@ -785,69 +1255,111 @@ namespace Halide {
         MLVal stmt = lower();
         MLVal args = inferArguments();
 
-        //printf("compiling IR -> ll\n");
-        MLVal tuple;
-        tuple = doCompile(name(), args, stmt);
-
-        //printf("Extracting the resulting module and function\n");
-        MLVal first, second;
-        MLVal::unpackPair(tuple, first, second);
-        LLVMModuleRef module = (LLVMModuleRef)(first.asVoidPtr());
-        LLVMValueRef func = (LLVMValueRef)(second.asVoidPtr());
-        llvm::Function *f = llvm::unwrap<llvm::Function>(func);
-        llvm::Module *m = llvm::unwrap(module);
+        // If HL_JIT_CACHE_DIR is set, optimized modules are kept there,
+        // keyed on the lowered entrypoint, the target, the runtime and
+        // the host cpu.
+        std::string cachePath;
+        if (getenv("HL_JIT_CACHE_DIR")) {
+            std::string key = doCacheKey(name(), args, stmt);
+            cachePath = (std::string(getenv("HL_JIT_CACHE_DIR")) + "/" + 
+                         key + "_" + llvm::sys::getHostCPUName().str() + ".bc");
+        }
 
-        if (!Contents::ee) {
-            std::string errStr;
-            Contents::ee = llvm::EngineBuilder(m).setErrorStr(&errStr).setOptLevel(llvm::CodeGenOpt::Aggressive).create();
-            if (!contents->ee) {
-                printf("Couldn't create execution engine: %s\n", errStr.c_str()); 
-                exit(1);
+        llvm::Module *m = NULL;
+        llvm::Function *inner = NULL;
+        bool fromDisk = false;
+
+        if (!cachePath.empty()) {
+            m = Contents::diskModules[cachePath];
+            if (!m) m = loadCachedModule(cachePath);
+            if (m) {
+                Contents::diskModules[cachePath] = m;
+                inner = findWrapper(m);
+                fromDisk = true;
             }
+        }
 
-            // Set up the pass manager
-            Contents::fPassMgr = new llvm::FunctionPassManager(m);
-            Contents::mPassMgr = new llvm::PassManager();
-
-            llvm::PassManagerBuilder builder;
-            builder.OptLevel = 3;
-            builder.populateFunctionPassManager(*contents->fPassMgr);
-            builder.populateModulePassManager(*contents->mPassMgr);
-
-        } else { 
-            Contents::ee->addModule(m);
-        }            
-        
-        std::string functionName = name() + "_c_wrapper";
-        llvm::Function *inner = m->getFunction(functionName.c_str());
-        
-        // Remap the cuda_ctx of PTX host modules to a shared location for all instances.
-        // CUDA behaves much better when you don't initialize >2 contexts.
-        llvm::GlobalVariable* ctx = m->getNamedGlobal("cuda_ctx");
-        if (ctx) {
-            Contents::ee->addGlobalMapping(ctx, (void*)&cuda_ctx);
+        if (!m) {
+            //printf("compiling IR -> ll\n");
+            MLVal tuple;
+            tuple = doCompile(name(), args, stmt);
+
+            //printf("Extracting the resulting module and function\n");
+            MLVal first, second;
+            MLVal::unpackPair(tuple, first, second);
+            LLVMModuleRef module = (LLVMModuleRef)(first.asVoidPtr());
+            LLVMValueRef func = (LLVMValueRef)(second.asVoidPtr());
+            // The module may have been compiled for a different (but
+            // structurally identical) Func, so use the wrapper we were
+            // handed rather than looking it up by name.
+            inner = llvm::unwrap<llvm::Function>(func);
+            m = llvm::unwrap(module);
+            if (!cachePath.empty()) Contents::diskModules[cachePath] = m;
         }
-        
+
         if (!inner) {
-            printf("Could not find function %s", functionName.c_str());
+            printf("Could not find the wrapper function for %s", name().c_str());
             exit(1);
         }
+
+        // Only new modules need adding to the execution engine and optimizing
+        if (!Contents::jitModules.count(m)) {
+            Contents::jitModules.insert(m);
+
+            if (!Contents::ee) {
+                std::string errStr;
+                // Generate code for the cpu we're running on, rather
+                // than generic x86-64, so that wider vectors are used
+                Contents::ee = llvm::EngineBuilder(m)
+                    .setErrorStr(&errStr)
+                    .setOptLevel(llvm::CodeGenOpt::Aggressive)
+                    .setMCPU(llvm::sys::getHostCPUName())
+                    .create();
+                if (!contents->ee) {
+                    printf("Couldn't create execution engine: %s\n", errStr.c_str()); 
+                    exit(1);
+                }
+
+                // Set up the pass manager
+                Contents::fPassMgr = new llvm::FunctionPassManager(m);
+                Contents::mPassMgr = new llvm::PassManager();
+
+                llvm::PassManagerBuilder builder;
+                builder.OptLevel = 3;
+                builder.populateFunctionPassManager(*contents->fPassMgr);
+                builder.populateModulePassManager(*contents->mPassMgr);
+
+            } else { 
+                Contents::ee->addModule(m);
+            }            
         
-        //printf("optimizing ll...\n");
+            // Remap the cuda_ctx of PTX host modules to a shared location for all instances.
+            // CUDA behaves much better when you don't initialize >2 contexts.
+            llvm::GlobalVariable* ctx = m->getNamedGlobal("cuda_ctx");
+            if (ctx) {
+                Contents::ee->addGlobalMapping(ctx, (void*)&cuda_ctx);
+            }
         
-        std::string errstr;
-        llvm::raw_fd_ostream stdout("passes.txt", errstr);
+            if (!fromDisk) {
+                //printf("optimizing ll...\n");
         
-        Contents::mPassMgr->run(*m);
+                std::string errstr;
+                llvm::raw_fd_ostream stdout("passes.txt", errstr);
+        
+                Contents::mPassMgr->run(*m);
 
-        Contents::fPassMgr->doInitialization();
+                Contents::fPassMgr->doInitialization();
         
-        Contents::fPassMgr->run(*inner);
+                Contents::fPassMgr->run(*inner);
         
-        Contents::fPassMgr->doFinalization();
+                Contents::fPassMgr->doFinalization();
+
+                saveCachedModule(m, cachePath);
+            }
+        }
         
         //printf("compiling ll -> machine code...\n");
-        void *ptr = Contents::ee->getPointerToFunction(f);
+        void *ptr = Contents::ee->getPointerToFunction(inner);
         contents->functionPtr = (void (*)(void*))ptr;
         
         llvm::Function *copyToHost = m->getFunction("__copy_to_host");
@@ -867,6 +1379,74 @@ namespace Halide {
         ptr = Contents::ee->getPointerToFunction(setErrorHandler);
         void (*setErrorHandlerFn)(void (*)(char *)) = (void (*)(void (*)(char *)))ptr;
         if (contents->errorHandler) setErrorHandlerFn(contents->errorHandler);
+
+        contents->profileReport = NULL;
+        contents->profileReset = NULL;
+        llvm::Function *profileReport = m->getFunction("halide_profile_report");
+        llvm::Function *profileReset = m->getFunction("halide_profile_reset");
+        if (profileReport && profileReset) {
+            ptr = Contents::ee->getPointerToFunction(profileReport);
+            contents->profileReport = (void (*)())ptr;
+            ptr = Contents::ee->getPointerToFunction(profileReset);
+            contents->profileReset = (void (*)())ptr;
+        }
+
+        contents->setNumThreads = NULL;
+        contents->threadPoolStats = NULL;
+        llvm::Function *setNumThreads = m->getFunction("halide_set_num_threads");
+        llvm::Function *threadPoolStats = m->getFunction("halide_thread_pool_stats");
+        if (setNumThreads && threadPoolStats) {
+            ptr = Contents::ee->getPointerToFunction(setNumThreads);
+            contents->setNumThreads = (void (*)(int))ptr;
+            ptr = Contents::ee->getPointerToFunction(threadPoolStats);
+            contents->threadPoolStats = (void (*)(int *, int *, int *))ptr;
+        }
+
+        contents->scratchStats = NULL;
+        llvm::Function *scratchStats = m->getFunction("halide_scratch_stats");
+        if (scratchStats) {
+            ptr = Contents::ee->getPointerToFunction(scratchStats);
+            contents->scratchStats = (void (*)(size_t *, size_t *))ptr;
+        }
+    }
+
+    void Func::printProfile() {
+        if (!contents->functionPtr || !contents->profileReport) {
+            printf("%s has not been compiled with a profiler\n", name().c_str());
+            return;
+        }
+        contents->profileReport();
+    }
+
+    void Func::resetProfile() {
+        if (contents->functionPtr && contents->profileReset) contents->profileReset();
+    }
+
+    void Func::setNumThreads(int n) {
+        if (!contents->functionPtr) compileJIT();
+        if (contents->setNumThreads) contents->setNumThreads(n);
+    }
+
+    void Func::threadPoolStats(int *numThreads, int *busyThreads, int *queuedIterations) {
+        if (!contents->functionPtr) compileJIT();
+        if (!contents->threadPoolStats) {
+            // This runtime has no thread pool
+            if (numThreads) *numThreads = 0;
+            if (busyThreads) *busyThreads = 0;
+            if (queuedIterations) *queuedIterations = 0;
+            return;
+        }
+        contents->threadPoolStats(numThreads, busyThreads, queuedIterations);
+    }
+
+    void Func::scratchStats(size_t *bytesRequested, size_t *bytesReused) {
+        if (!contents->functionPtr) compileJIT();
+        if (!contents->scratchStats) {
+            if (bytesRequested) *bytesRequested = 0;
+            if (bytesReused) *bytesReused = 0;
+            return;
+        }
+        contents->scratchStats(bytesRequested, bytesReused);
     }
 
     size_t im_size(const DynImage &im, int dim) {
@@ -877,28 +1457,64 @@ namespace Halide {
         return im.boundImage().size(dim);
     }
 
-    void Func::realize(const DynImage &im) {
+    struct Func::Callable::Contents {
+        void (*functionPtr)(void *);
+        void (*copyToHost)(buffer_t *);
+        void (*freeBuffer)(buffer_t *);
+
+        // The argument list, in the order the compiled code expects:
+        // uniforms, images, uniform images, then the output. The
+        // uniform and image entries are fixed. The rest are filled in
+        // on each call.
+        std::vector<void *> arguments;
+        size_t firstUniformImage;
+
+        // Keep alive the things the arguments point into
+        std::vector<DynUniform> uniforms;
+        std::vector<DynImage> images;
+        std::vector<UniformImage> uniformImages;
+    };
+
+    Func::Callable Func::callable() {
+        if (contents->callable) return *contents->callable;
+
         if (!contents->functionPtr) compileJIT();
 
-        //printf("Constructing argument list...\n");
+        std::shared_ptr<Callable::Contents> c(new Callable::Contents);
+        c->functionPtr = contents->functionPtr;
+        c->copyToHost = contents->copyToHost;
+        c->freeBuffer = contents->freeBuffer;
+        c->uniforms = rhs().uniforms();
+        c->images = rhs().images();
+        c->uniformImages = rhs().uniformImages();
+        for (size_t i = 0; i < c->uniforms.size(); i++) {
+            c->arguments.push_back(c->uniforms[i].data());
+        }
+        for (size_t i = 0; i < c->images.size(); i++) {
+            c->arguments.push_back(c->images[i].buffer());
+        }
+        c->firstUniformImage = c->arguments.size();
+        c->arguments.resize(c->arguments.size() + c->uniformImages.size() + 1);
+        assert(c->arguments.size() <= 256 && "Too many arguments");
+
+        contents->callable.reset(new Callable(c));
+        return *contents->callable;
+    }
+
+    void Func::Callable::operator()(const DynImage &im) const {
+        const Contents *c = contents.get();
+
+        // Copy the argument list onto the stack, so that a Callable
+        // can be used from several threads at once.
         void *arguments[256];
-        buffer_t *buffers[256];
-        size_t j = 0;
-        size_t k = 0;
+        size_t n = c->arguments.size();
+        memcpy(arguments, &c->arguments[0], n * sizeof(void *));
 
-        for (size_t i = 0; i < rhs().uniforms().size(); i++) {
-            arguments[j++] = rhs().uniforms()[i].data();
-        }
-        for (size_t i = 0; i < rhs().images().size(); i++) {
-            buffers[k++] = rhs().images()[i].buffer();
-            arguments[j++] = buffers[k-1];
-        }               
-        for (size_t i = 0; i < rhs().uniformImages().size(); i++) {
-            buffers[k++] = rhs().uniformImages()[i].boundImage().buffer();
-            arguments[j++] = buffers[k-1];
+        size_t j = c->firstUniformImage;
+        for (size_t i = 0; i < c->uniformImages.size(); i++) {
+            arguments[j++] = c->uniformImages[i].boundImage().buffer();
         }
-        buffers[k] = im.buffer();
-        arguments[j] = buffers[k];
+        arguments[j] = im.buffer();
 
         /*
         printf("Args: ");
@@ -907,13 +1523,13 @@ namespace Halide {
         }
         printf("\n");
 
-        printf("Calling function at %p\n", contents->functionPtr); 
+        printf("Calling function at %p\n", c->functionPtr); 
         */
-        contents->functionPtr(&arguments[0]);
+        c->functionPtr(&arguments[0]);
         
         if (use_gpu()) {
-            assert(contents->copyToHost);
-            im.setRuntimeHooks(contents->copyToHost, contents->freeBuffer);
+            assert(c->copyToHost);
+            im.setRuntimeHooks(c->copyToHost, c->freeBuffer);
         }
         
         // TODO: the actual codegen entrypoint should probably set this for x86/ARM targets too
@@ -922,6 +1538,11 @@ namespace Halide {
         }
     }
 
+    void Func::realize(const DynImage &im) {
+        if (!contents->callable) callable();
+        (*contents->callable)(im);
+    }
+
     MLVal *Func::environment = NULL;
 
 }
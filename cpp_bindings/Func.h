@@ -14,6 +14,19 @@ namespace Halide {
 
     class Func;
     class Var;
+    class RVar;
+
+    // What to do when a split factor doesn't divide the extent of the
+    // dimension being split. RoundUp computes past the end, which
+    // needs the function to be defined (and allocated) there, and
+    // trips the bounds check if it's the output. ShiftInward moves
+    // the last iteration back so that it ends at the end of the
+    // extent, recomputing some values; the extent must be at least
+    // the factor. Recomputing isn't safe for the update step of a
+    // reduction, so there it means ScalarEpilogue. ScalarEpilogue stops
+    // at the last whole iteration and does the leftovers in a serial
+    // loop.
+    enum TailStrategy {RoundUp, ShiftInward, ScalarEpilogue};
 
     // A function call (if you cast it to an expr), or a function definition lhs (if you assign an expr to it).
     class FuncRef {
@@ -77,12 +90,52 @@ namespace Halide {
         DynImage realize(int a, int b, int c);
         DynImage realize(int a, int b, int c, int d);
         DynImage realize(std::vector<int> sizes);
+
+        // Realize into an existing image. The results are written
+        // straight into its memory, so it can be a crop of another
+        // image, or wrap a buffer owned by someone else. Unless
+        // allowAnyLayout has been called, it must be dense in its
+        // first dimension and 64-byte aligned, and so must any
+        // uniform images.
         void realize(const DynImage &);
 
+        // A handle to the compiled form of a function, with its
+        // argument list laid out ahead of time. Calling it just fills
+        // in the output buffer and jumps to the compiled code, so it's
+        // the cheapest way to realize lots of small images. Uniforms
+        // are read and uniform images looked up at call time, so they
+        // may be changed between calls.
+        class Callable {
+        public:
+            void operator()(const DynImage &output) const;
+        private:
+            friend class Func;
+            struct Contents;
+            Callable(const std::shared_ptr<Contents> &c) : contents(c) {}
+            std::shared_ptr<Contents> contents;
+        };
+
+        // Get a Callable for this function, JIT compiling it if necessary
+        Callable callable();
+
         /* If this function is a reduction, get a handle to its update
            step for scheduling */
         Func &update();
 
+        /* If this function is a reduction with an associative update
+           (one made with sum, product, minimum, maximum, += or *=),
+           split r into the given number of slices and reduce each
+           slice in parallel into a private copy of the result, then
+           combine the copies. This makes scatters like histograms
+           scale with cores. */
+        Func &rfactor(const RVar &r, int slices);
+
+        /* If this function is a reduction with an associative update
+           that doesn't scatter, interleave r across the lanes of
+           vectors of the given width, reduce into a vector of partial
+           results, and combine the lanes at the end. */
+        Func &vectorize(const RVar &r, int width);
+
         /* These methods generate a partially applied function that
          * takes a schedule and modifies it. These functions get pushed
          * onto the scheduleTransforms vector, which is traversed in
@@ -90,31 +143,67 @@ namespace Halide {
          * mutated schedule */
         Func &tile(const Var &, const Var &,
                    const Var &, const Var &,
-                   const Expr &f1, const Expr &f2);
+                   const Expr &f1, const Expr &f2, TailStrategy tail = RoundUp);
         Func &tile(const Var &, const Var &,
                    const Var &, const Var &, 
                    const Var &, const Var &, 
-                   const Expr &f1, const Expr &f2);
+                   const Expr &f1, const Expr &f2, TailStrategy tail = RoundUp);
         Func &rename(const Var &, const Var &);
         Func &reset();
         Func &vectorize(const Var &);
         Func &unroll(const Var &);
         Func &transpose(const Var &, const Var &);
         Func &chunk(const Var &);
+        // Like chunk, but values computed for one iteration of the
+        // caller's loop are kept for the next, so only the new ones
+        // are computed. The caller's loop must be serial.
+        Func &slide(const Var &);
         Func &root();
         Func &parallel(const Var &);
         Func &random(int seed);
-        Func &vectorize(const Var &, int factor);
-        Func &unroll(const Var &, int factor);
-        Func &split(const Var &, const Var &, const Var &, const Expr &factor);
+        Func &vectorize(const Var &, int factor, TailStrategy tail = RoundUp);
+        Func &unroll(const Var &, int factor, TailStrategy tail = RoundUp);
+        Func &split(const Var &, const Var &, const Var &, const Expr &factor, TailStrategy tail = RoundUp);
         Func &cuda(const Var &, const Var &);
         Func &cuda(const Var &, const Var &, const Var &, const Var &);
         Func &cudaTile(const Var &, int xFactor);
         Func &cudaTile(const Var &, const Var &, int xFactor, int yFactor);
         //Func &cuda(const Var &, const Var &, const Var &, const Var &, const Var &, const Var &);
 
+        // Schedule this function and everything it calls using a
+        // simple cost model, for an output of roughly the given
+        // size. Hand-written call schedules (chunk, root) for the
+        // functions it calls still apply.
+        Func &autoSchedule(std::vector<int> sizes);
+        Func &autoSchedule(int a);
+        Func &autoSchedule(int a, int b);
+        Func &autoSchedule(int a, int b, int c);
+
         int autotune(int argc, char **argv, std::vector<int> sizes);
 
+        // Search for a faster schedule for this function and
+        // everything it calls, by evolving random schedule transforms
+        // on top of the current ones for the given number of
+        // generations. Candidates are compiled in parallel in forked
+        // copies of this process and timed one at a time on an
+        // output of the given size. The best one found is adopted,
+        // and saved to guruFile if that's not empty. Returns its time
+        // per run in microseconds.
+        double autotune(std::vector<int> sizes, int generations, const std::string &guruFile = "");
+
+        // Also compile a general version of this function that
+        // accepts outputs and uniform images with any stride in their
+        // first dimension and any alignment, such as interleaved
+        // planes, crops at odd offsets and memory owned by someone
+        // else. The fast version is still used when everything is
+        // dense and aligned. This doubles the compiled code.
+        Func &allowAnyLayout(bool allow = true);
+
+        // Schedule the pipeline with a guru saved by autotune,
+        // instead of the schedule transforms of this function and
+        // the ones it calls
+        Func &loadSchedule(const std::string &guruFile);
+
         bool operator==(const Func &other) const;
 
         /* The space of all living functions (TODO: remove a function
@@ -134,10 +223,38 @@ namespace Halide {
         std::string serialize();
 
         void compileJIT();
-        void compileToFile(const std::string &name);
+
+        // Compile to a bitcode file and header. The target string is
+        // the arch and any instruction set extensions to use,
+        // separated by dashes (e.g. "x86_64-avx2"). By default we
+        // target the baseline for the arch, so the result runs
+        // anywhere. Pass the same extensions to llc when compiling
+        // the bitcode (e.g. -mattr=+avx2).
+        void compileToFile(const std::string &name, const std::string &target = "");
 
         void setErrorHandler(void (*)(char *));
 
+        // If HL_PROFILE was set when this function was compiled, the
+        // compiled code times each stage of the pipeline. Print a
+        // table of the time, calls and memory allocated per stage
+        // (and thread utilization per parallel loop) over all the
+        // realizations since the last reset.
+        void printProfile();
+        void resetProfile();
+
+        // Control the thread pool that this function's compiled code
+        // runs its parallel loops on (see halide_set_num_threads and
+        // halide_thread_pool_stats in the runtime). Compiles the
+        // function if it hasn't been already. Resizing the pool while
+        // a realization is running takes effect once it finishes.
+        void setNumThreads(int n);
+        void threadPoolStats(int *numThreads, int *busyThreads, int *queuedIterations);
+
+        // How many bytes of scratch memory this function's compiled
+        // code has asked for, and how many of those reused memory
+        // from earlier realizations (see halide_scratch_stats).
+        void scratchStats(size_t *bytesRequested, size_t *bytesReused);
+
         struct Arg {
             template<typename T>
             Arg(const Uniform<T> &u) : arg(Arg(DynUniform(u)).arg) {}
@@ -149,11 +266,12 @@ namespace Halide {
             MLVal arg;
         };
 
-        void compileToFile(const std::string &name, std::vector<Arg> args);
+        void compileToFile(const std::string &name, std::vector<Arg> args, const std::string &target = "");
 
     private:
         struct Contents;
 
+        MLVal guru();
         MLVal lower();
         MLVal inferArguments();
 
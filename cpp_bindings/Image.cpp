@@ -4,24 +4,45 @@
 #include "Uniform.h"
 #include "Var.h"
 #include <assert.h>
+#include <algorithm>
 #include "../src/buffer.h"
 
 namespace Halide {
+    // The largest power of two up to 64 that the pointer is a multiple of
+    static int pointerAlignment(const unsigned char *ptr) {
+        int a = 64;
+        while (((size_t)ptr) & (a - 1)) a /= 2;
+        return a;
+    }
+
     struct DynImage::Contents {
         Contents(const Type &t, int a);
         Contents(const Type &t, int a, int b);
         Contents(const Type &t, int a, int b, int c);
         Contents(const Type &t, int a, int b, int c, int d);
         Contents(const Type &t, std::vector<int> sizes);
+        Contents(const std::shared_ptr<Contents> &parent, unsigned char *data,
+                 const std::vector<int> &sizes, const std::vector<int> &strides,
+                 const std::vector<int> &mins);
+        Contents(const Type &t, unsigned char *data, const std::vector<int> &sizes,
+                 const std::vector<int> &strides, int alignment,
+                 const std::function<void(unsigned char *)> &deleter);
         ~Contents();
         
         void allocate(size_t bytes);
+        void initBuffer();
         
         Type type;
-        std::vector<int> size, stride;
+        std::vector<int> size, stride, min;
         const std::string name;
         unsigned char *data;
+        // The number of bytes data is known to be aligned to, up to 64
+        int alignment;
         std::vector<unsigned char> host_buffer;
+        // Called on data when it's owned by someone else
+        std::function<void(unsigned char *)> deleter;
+        // Views into another image keep it alive
+        std::shared_ptr<Contents> parent;
         buffer_t buf;
         mutable void (*copyToHost)(buffer_t*);
         mutable void (*freeBuffer)(buffer_t*);
@@ -63,30 +84,82 @@ namespace Halide {
 
         allocate(total * (t.bits/8));
     }
+
+    DynImage::Contents::Contents(const std::shared_ptr<Contents> &parent, unsigned char *data,
+                                 const std::vector<int> &sizes, const std::vector<int> &strides,
+                                 const std::vector<int> &mins) :
+        type(parent->type), size(sizes), stride(strides), min(mins), name(uniqueName('i')), 
+        data(data), alignment(std::min(parent->alignment, pointerAlignment(data))),
+        parent(parent), copyToHost(NULL), freeBuffer(NULL) {
+        assert(sizes.size() == strides.size() && sizes.size() == mins.size());
+        for (size_t i = 0; i < sizes.size(); i++) {
+            assert(sizes[i] > 0 && "Images must have positive sizes");
+        }
+        initBuffer();
+    }
+
+    DynImage::Contents::Contents(const Type &t, unsigned char *data, const std::vector<int> &sizes,
+                                 const std::vector<int> &strides, int alignment,
+                                 const std::function<void(unsigned char *)> &deleter) :
+        type(t), size(sizes), stride(strides), min(sizes.size(), 0), name(uniqueName('i')),
+        data(data), alignment(alignment ? alignment : pointerAlignment(data)), deleter(deleter),
+        copyToHost(NULL), freeBuffer(NULL) {
+        assert(data && "Can't wrap a null pointer");
+        assert((alignment & (alignment - 1)) == 0 && "Alignment must be a power of two");
+        assert(((size_t)data & (this->alignment - 1)) == 0 && "Data is less aligned than declared");
+        if (this->alignment > 64) this->alignment = 64;
+        if (stride.empty()) {
+            int total = 1;
+            for (size_t i = 0; i < sizes.size(); i++) {
+                stride.push_back(total);
+                total *= sizes[i];
+            }
+        }
+        assert(sizes.size() == stride.size());
+        for (size_t i = 0; i < sizes.size(); i++) {
+            assert(sizes[i] > 0 && "Images must have positive sizes");
+        }
+        initBuffer();
+    }
     
     DynImage::Contents::~Contents() {
         if (freeBuffer) {
             fprintf(stderr, "freeBuffer %p\n", &buf);
             freeBuffer(&buf);
         }
+        if (deleter) deleter(data);
     }
 
     void DynImage::Contents::allocate(size_t bytes) {
-        host_buffer.resize(bytes+16);
+        // Align to 64 bytes, so that vector loads as wide as AVX-512
+        // can be aligned loads
+        host_buffer.resize(bytes+64);
         data = &(host_buffer[0]);
-        unsigned char offset = ((size_t)data) & 0xf;
+        unsigned char offset = ((size_t)data) & 0x3f;
         if (offset) {
-            data += 16 - offset;
+            data += 64 - offset;
         }
-        
+        alignment = 64;
+
+        min.resize(size.size(), 0);
+        initBuffer();
+    }
+
+    void DynImage::Contents::initBuffer() {        
         assert(size.size() <= 4);
         buf.host = data;
         buf.dev = 0;
         buf.host_dirty = false;
         buf.dev_dirty = false;
-        buf.dims[0] = buf.dims[1] = buf.dims[2] = buf.dims[3] = 1;
+        for (size_t i = 0; i < 4; i++) {
+            buf.dims[i] = 1;
+            buf.stride[i] = 0;
+            buf.min[i] = 0;
+        }
         for (size_t i = 0; i < size.size(); i++) {
             buf.dims[i] = size[i];
+            buf.stride[i] = stride[i];
+            buf.min[i] = min[i];
         }
         buf.elem_size = type.bits/8;
     }
@@ -100,8 +173,34 @@ namespace Halide {
     DynImage::DynImage(const Type &t, int a, int b, int c, int d) : contents(new Contents(t, a, b, c, d)) {}
     DynImage::DynImage(const Type &t, std::vector<int> sizes) : contents(new Contents(t, sizes)) {}
 
+    DynImage::DynImage(const Type &t, unsigned char *data, const std::vector<int> &sizes,
+                       const std::vector<int> &strides, int alignment,
+                       std::function<void(unsigned char *)> deleter) :
+        contents(new Contents(t, data, sizes, strides, alignment, deleter)) {}
+
     DynImage::DynImage(const DynImage &other) : contents(other.contents) {}
 
+    DynImage::DynImage(const std::shared_ptr<Contents> &c) : contents(c) {}
+
+    DynImage DynImage::crop(const std::vector<int> &mins, const std::vector<int> &sizes) const {
+        assert(mins.size() == (size_t)dimensions() && sizes.size() == (size_t)dimensions());
+        copyToHost();
+        unsigned char *ptr = data();
+        for (int i = 0; i < dimensions(); i++) {
+            assert(mins[i] >= min(i) && mins[i] + sizes[i] <= min(i) + size(i) && 
+                   "Crop must lie within the image");
+            ptr += (mins[i] - min(i)) * stride(i) * (type().bits/8);
+        }
+        return DynImage(std::shared_ptr<Contents>(new Contents(contents, ptr, sizes, contents->stride, mins)));
+    }
+
+    DynImage DynImage::view(int offset, const std::vector<int> &sizes, const std::vector<int> &strides) const {
+        copyToHost();
+        unsigned char *ptr = data() + offset * (type().bits/8);
+        return DynImage(std::shared_ptr<Contents>(new Contents(contents, ptr, sizes, strides, 
+                                                               std::vector<int>(sizes.size(), 0))));
+    }
+
     const Type &DynImage::type() const {
         return contents->type;
     }
@@ -116,6 +215,16 @@ namespace Halide {
         return contents->stride[i];
     }
 
+    int DynImage::min(int i) const {
+        if (i >= dimensions()) {
+            fprintf(stderr,
+                    "ERROR: accessing min of dim %d of %d-dimensional image %s\n",
+                    i, dimensions(), name().c_str());
+            assert(i < dimensions());
+        }
+        return contents->min[i];
+    }
+
     int DynImage::size(int i) const {
         if (i >= dimensions()) {
             fprintf(stderr,
@@ -134,6 +243,10 @@ namespace Halide {
         return contents->data;
     }
 
+    int DynImage::alignment() const {
+        return contents->alignment;
+    }
+
     const std::string &DynImage::name() const {
         return contents->name;
     }
@@ -182,42 +295,68 @@ namespace Halide {
         return contents->buf.dev_dirty;
     }
 
+    // The strides and mins get baked into the index. If the data
+    // isn't 64-byte aligned (e.g. it's a crop of another image, or
+    // wrapped memory declared less aligned than that), the
+    // min of the first dimension is left symbolic, so that the
+    // compiler can't assume vector loads from it are aligned.
+    static Expr imageIndex(const DynImage &im, const std::vector<Expr> &args) {
+        assert(args.size() == (size_t)im.dimensions());
+        Expr idx;
+        for (size_t i = 0; i < args.size(); i++) {
+            Expr min = im.min(i);
+            if (i == 0 && im.alignment() < 64) {
+                min = Var(std::string(".") + im.name() + ".min.0");
+                min.child(im);
+            }
+            Expr term = (args[i] - min) * im.stride(i);
+            idx = idx.isDefined() ? idx + term : term;
+        }
+        return idx;
+    }
+
     Expr DynImage::operator()(const Expr &a) const {
-        return ImageRef(*this, a*stride(0));
+        return ImageRef(*this, imageIndex(*this, {a}));
     }
 
     Expr DynImage::operator()(const Expr &a, const Expr &b) const {
-        return ImageRef(*this, a*stride(0) + b*stride(1));
+        return ImageRef(*this, imageIndex(*this, {a, b}));
     }
     
     Expr DynImage::operator()(const Expr &a, const Expr &b, const Expr &c) const {
-        return ImageRef(*this, a*stride(0) + b*stride(1) + c*stride(2));
+        return ImageRef(*this, imageIndex(*this, {a, b, c}));
     }
     
     Expr DynImage::operator()(const Expr &a, const Expr &b, const Expr &c, const Expr &d) const {
-        return ImageRef(*this, a*stride(0) + b*stride(1) + c*stride(2) + d*stride(3));
+        return ImageRef(*this, imageIndex(*this, {a, b, c, d}));
     }
 
     struct UniformImage::Contents {
         Contents(const Type &t, int dims) :
             t(t), name(uniqueName('m')) {
-            sizes.resize(dims);
-            for (int i = 0; i < dims; i++) {
-                sizes[i] = Var(std::string(".") + name + ".dim." + int_to_str(i));  // Connelly: std::ostringstream broken in Python binding, use string + instead
-            }
+            init(dims);
         }
 
         Contents(const Type &t, int dims, const std::string &name) :
             t(t), name(name) {
+            init(dims);
+        }
+
+        void init(int dims) {
             sizes.resize(dims);
+            strides.resize(dims);
+            mins.resize(dims);
             for (int i = 0; i < dims; i++) {
-                sizes[i] = Var(std::string(".") + name + ".dim." + int_to_str(i));  // Connelly: std::ostringstream broken in Python binding, use string + instead
+                // Connelly: std::ostringstream broken in Python binding, use string + instead
+                sizes[i] = Var(std::string(".") + name + ".dim." + int_to_str(i));
+                strides[i] = Var(std::string(".") + name + ".stride." + int_to_str(i));
+                mins[i] = Var(std::string(".") + name + ".min." + int_to_str(i));
             }
         }
 
         Type t;
         std::unique_ptr<DynImage> image;
-        std::vector<Expr> sizes;
+        std::vector<Expr> sizes, strides, mins;
         const std::string name;
     };
 
@@ -225,6 +364,8 @@ namespace Halide {
         contents(new Contents(t, dims)) {
         for (int i = 0; i < dims; i++) {
             contents->sizes[i].child(*this);
+            contents->strides[i].child(*this);
+            contents->mins[i].child(*this);
         }
     }
 
@@ -232,6 +373,8 @@ namespace Halide {
         contents(new Contents(t, dims, name)) {
         for (int i = 0; i < dims; i++) {
             contents->sizes[i].child(*this);
+            contents->strides[i].child(*this);
+            contents->mins[i].child(*this);
         }
     }
 
@@ -259,20 +402,24 @@ namespace Halide {
         return contents == other.contents;
     }
 
+    // The stride of the first dimension is assumed to be one at
+    // compile time, and checked at runtime.
     Expr UniformImage::operator()(const Expr &a) const {
-        return UniformImageRef(*this, a);
+        return UniformImageRef(*this, (a - min(0)) * stride(0));
     }
 
     Expr UniformImage::operator()(const Expr &a, const Expr &b) const {
-        return UniformImageRef(*this, a + size(0) * b);
+        return UniformImageRef(*this, (a - min(0)) * stride(0) + (b - min(1)) * stride(1));
     }
 
     Expr UniformImage::operator()(const Expr &a, const Expr &b, const Expr &c) const {
-        return UniformImageRef(*this, a + size(0) * (b + size(1) * c));
+        return UniformImageRef(*this, ((a - min(0)) * stride(0) + (b - min(1)) * stride(1) + 
+                                       (c - min(2)) * stride(2)));
     }
 
     Expr UniformImage::operator()(const Expr &a, const Expr &b, const Expr &c, const Expr &d) const {
-        return UniformImageRef(*this, a + size(0) * (b + size(1) * (c + size(2) * d)));
+        return UniformImageRef(*this, ((a - min(0)) * stride(0) + (b - min(1)) * stride(1) + 
+                                       (c - min(2)) * stride(2) + (d - min(3)) * stride(3)));
     }
     
     Type UniformImage::type() const {
@@ -290,5 +437,13 @@ namespace Halide {
     const Expr &UniformImage::size(int i) const {
         return contents->sizes[i];
     }
+
+    const Expr &UniformImage::stride(int i) const {
+        return contents->strides[i];
+    }
+
+    const Expr &UniformImage::min(int i) const {
+        return contents->mins[i];
+    }
         
 }
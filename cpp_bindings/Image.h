@@ -2,6 +2,7 @@
 #define HALIDE_IMAGE_H
 
 #include <stdint.h>
+#include <functional>
 #include "Expr.h"
 
 struct buffer_t;
@@ -20,6 +21,26 @@ namespace Halide {
         DynImage(const Type &t, std::vector<int> sizes);
         DynImage(const DynImage &other);
 
+        // Wrap memory owned by someone else, such as a DMA or shared
+        // memory buffer, without copying it. Strides are in elements,
+        // and default to a dense layout. alignment is the number of
+        // bytes the data is guaranteed to be aligned to; if it's zero
+        // it's worked out from the pointer. The deleter, if any, is
+        // called on the data once the last image referring to it goes
+        // away.
+        DynImage(const Type &t, unsigned char *data, const std::vector<int> &sizes,
+                 const std::vector<int> &strides = std::vector<int>(), int alignment = 0,
+                 std::function<void(unsigned char *)> deleter = nullptr);
+
+        // Make an image that aliases a region of this one, in the
+        // same coordinate system. No data is copied.
+        DynImage crop(const std::vector<int> &mins, const std::vector<int> &sizes) const;
+
+        // Make an image that aliases this one's storage with a
+        // different layout, starting offset elements in. Strides are
+        // in elements.
+        DynImage view(int offset, const std::vector<int> &sizes, const std::vector<int> &strides) const;
+
         Expr operator()(const Expr &a) const;
         Expr operator()(const Expr &a, const Expr &b) const;
         Expr operator()(const Expr &a, const Expr &b, const Expr &c) const;
@@ -28,8 +49,10 @@ namespace Halide {
         const Type &type() const;
         int stride(int i) const;
         int size(int i) const;
+        int min(int i) const;
         int dimensions() const;
         unsigned char *data() const;
+        int alignment() const;
         const std::string &name() const;
         struct buffer_t* buffer() const;
         void setRuntimeHooks(void (*copyToHostFn)(buffer_t *), void (*freeFn)(buffer_t *)) const;
@@ -57,6 +80,7 @@ namespace Halide {
 
     private:
         struct Contents;
+        DynImage(const std::shared_ptr<Contents> &);
         std::shared_ptr<Contents> contents;
     };
 
@@ -75,6 +99,10 @@ namespace Halide {
             if (im.dimensions() > 1) s1 = im.stride(1);
             if (im.dimensions() > 2) s2 = im.stride(2);
             if (im.dimensions() > 3) s3 = im.stride(3);            
+            // Offset base so that it can be indexed with absolute coordinates
+            for (int i = 0; i < im.dimensions(); i++) {
+                base -= im.min(i) * im.stride(i);
+            }
         }
 
     public:
@@ -82,6 +110,17 @@ namespace Halide {
         Image(int a, int b) : im(TypeOf<T>(), a, b) {init();}
         Image(int a, int b, int c) : im(TypeOf<T>(), a, b, c) {init();}
         Image(int a, int b, int c, int d) : im(TypeOf<T>(), a, b, c, d) {init();}
+        // Wrap memory owned by someone else. See the equivalent
+        // DynImage constructor.
+        Image(T *data, const std::vector<int> &sizes,
+              const std::vector<int> &strides = std::vector<int>(), int alignment = 0,
+              std::function<void(T *)> deleter = nullptr) :
+            im(TypeOf<T>(), (unsigned char *)data, sizes, strides, alignment,
+               deleter ? std::function<void(unsigned char *)>([deleter](unsigned char *p) {deleter((T *)p);})
+                       : std::function<void(unsigned char *)>()) {
+            init();
+        }
+
         Image(DynImage im) : im(im) {
             assert(TypeOf<T>() == im.type());
             im.copyToHost();
@@ -169,8 +208,11 @@ namespace Halide {
         int height() const {return im.height();}
         int channels() const {return im.channels();}
         int size(int i) const {return im.size(i);}
+        int stride(int i) const {return im.stride(i);}
+        int min(int i) const {return im.min(i);}
         int dimensions() const {return im.dimensions();}
         unsigned char *data() const {return im.data();}
+        int alignment() const {return im.alignment();}
     };
 
     
@@ -201,6 +243,8 @@ namespace Halide {
         const DynImage &boundImage() const;
 
         const Expr &size(int i) const;
+        const Expr &stride(int i) const;
+        const Expr &min(int i) const;
         const Expr &width() const {return size(0);}
         const Expr &height() const {return size(1);}
         const Expr &channels() const {return size(2);}
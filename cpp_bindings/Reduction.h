@@ -10,10 +10,12 @@
 
 namespace Halide {
   
-    // Reductions are anonymous functions that can be cast to an Expr to use
+    // Reductions are anonymous functions that can be cast to an Expr to
+    // use. Given a vector width, they reduce in vectors over the
+    // innermost dimension of the reduction domain (see Func::vectorize).
     class sum {
     public:
-        sum(const Expr &body) {
+        sum(const Expr &body, int vectorWidth = 1) {
             Func anon;
             std::vector<Expr> args(body.vars().size());
             for (size_t i = 0; i < body.vars().size(); i++) {
@@ -23,6 +25,7 @@ namespace Halide {
             init.addImplicitArgs(body.implicitArgs());
             anon(args) = init;
             anon(args) = anon(args) + body;
+            if (vectorWidth > 1) anon.vectorize(body.rdom()[0], vectorWidth);
             call = anon(args);
         }
 
@@ -35,7 +38,7 @@ namespace Halide {
 
     class product {
     public:
-        product(const Expr &body) {
+        product(const Expr &body, int vectorWidth = 1) {
             Func anon;
             std::vector<Expr> args(body.vars().size());
             for (size_t i = 0; i < body.vars().size(); i++) {
@@ -45,6 +48,7 @@ namespace Halide {
             init.addImplicitArgs(body.implicitArgs());
             anon(args) = init;
             anon(args) = anon(args) * body;
+            if (vectorWidth > 1) anon.vectorize(body.rdom()[0], vectorWidth);
             call = anon(args);
         }
         
@@ -57,7 +61,7 @@ namespace Halide {
 
     class minimum {
       public:
-        minimum(const Expr &body) {
+        minimum(const Expr &body, int vectorWidth = 1) {
             Func anon;
             std::vector<Expr> args(body.vars().size());
             for (size_t i = 0; i < body.vars().size(); i++) {
@@ -67,6 +71,7 @@ namespace Halide {
             init.addImplicitArgs(body.implicitArgs());
             anon(args) = init;
             anon(args) = min(anon(args), body);
+            if (vectorWidth > 1) anon.vectorize(body.rdom()[0], vectorWidth);
             call = anon(args);
         }
         
@@ -79,7 +84,7 @@ namespace Halide {
     
     class maximum {
       public:
-        maximum(const Expr &body) {
+        maximum(const Expr &body, int vectorWidth = 1) {
             Func anon;
             std::vector<Expr> args(body.vars().size());
             for (size_t i = 0; i < body.vars().size(); i++) {
@@ -89,6 +94,7 @@ namespace Halide {
             init.addImplicitArgs(body.implicitArgs());
             anon(args) = init;
             anon(args) = max(anon(args), body);
+            if (vectorWidth > 1) anon.vectorize(body.rdom()[0], vectorWidth);
             call = anon(args);
         }
         
@@ -85,6 +85,7 @@ let fold_children_in_expr mutator combiner base_case = function
 let fold_children_in_stmt expr_mutator stmt_mutator combiner = function
   | For (name, min, n, order, body) ->
     combiner (combiner (expr_mutator min) (expr_mutator n)) (stmt_mutator body)
+  | Block [] -> expr_mutator (IntImm 0)
   | Block l -> List.fold_left combiner (stmt_mutator (List.hd l)) (List.map stmt_mutator (List.tl l))
   | Store (expr, buf, idx) -> combiner (expr_mutator expr) (expr_mutator idx)
   | Provide (expr, func, args) -> List.fold_left combiner (expr_mutator expr) (List.map expr_mutator args)
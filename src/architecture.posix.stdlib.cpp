@@ -3,7 +3,12 @@
 #include <sys/mman.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 #include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
 #include <cfloat>
 
 #include "buffer.h"
@@ -25,9 +30,10 @@ WEAK void __copy_to_host(buffer_t* buf) { /* NOP */ }
 #endif //_COPY_TO_HOST
 
 WEAK void *fast_malloc(size_t x) {
-    void *orig = malloc(x+16);
-    // Walk either 8 or 16 bytes forward
-    void *ptr = (void *)((((size_t)orig + 16) >> 4) << 4);
+    void *orig = malloc(x+64);
+    // Walk forward to the next 64-byte boundary, which leaves at least
+    // 8 bytes to stash the original pointer in
+    void *ptr = (void *)((((size_t)orig + 64) >> 6) << 6);
     ((void **)ptr)[-1] = orig;
     return ptr;
 }
@@ -59,6 +65,179 @@ WEAK void safe_free(void *ptr) {
     free(start);
 }
 
+// Scratch memory for Pipeline realizations. Realizations nest, and are
+// freed in the reverse order they were allocated, so each thread gets a
+// stack of blocks it bump-allocates from. Freeing just moves the top of
+// the stack back down. Blocks are kept after they empty, so once a
+// thread's stack has grown to fit a pipeline, running it again doesn't
+// touch malloc at all.
+struct scratch_block {
+    // The blocks allocated before and after this one
+    scratch_block *below, *above;
+    uint8_t *base;
+    size_t size, used;
+    // The most that has ever been in use at once. Allocations below
+    // this are reusing memory.
+    size_t high_water;
+};
+
+struct scratch_arena {
+    // The block we're allocating from
+    scratch_block *top;
+    // Only this thread writes these, so they don't need atomics.
+    // halide_scratch_stats adds them up across the arenas.
+    size_t bytes_requested, bytes_reused;
+    // Every live arena, so that they can be found for the stats
+    scratch_arena *prev, *next;
+};
+
+// Scratch allocations are 64-byte aligned, the same as fast_malloc,
+// so a buffer's alignment doesn't depend on whether it came from an
+// arena or fell through to fast_malloc. That's a full cache line, and
+// enough for the widest vectors we generate.
+#define SCRATCH_ALIGNMENT 64
+#define SCRATCH_MIN_BLOCK (64 * 1024)
+// Bigger allocations than this go straight to fast_malloc, so that one
+// huge realization doesn't pin the memory for the life of the thread.
+#define SCRATCH_MAX_ALLOC (16 * 1024 * 1024)
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_key_once = PTHREAD_ONCE_INIT;
+// The live arenas, and the counts of the ones whose threads have
+// exited. Only touched when a thread gets or frees its arena, and when
+// collecting stats.
+static pthread_mutex_t scratch_arenas_mutex = PTHREAD_MUTEX_INITIALIZER;
+static scratch_arena *scratch_arenas = NULL;
+static size_t scratch_retired_requested = 0;
+static size_t scratch_retired_reused = 0;
+
+static void free_scratch_arena(void *ptr) {
+    scratch_arena *arena = (scratch_arena *)ptr;
+    pthread_mutex_lock(&scratch_arenas_mutex);
+    scratch_retired_requested += arena->bytes_requested;
+    scratch_retired_reused += arena->bytes_reused;
+    if (arena->prev) arena->prev->next = arena->next;
+    else scratch_arenas = arena->next;
+    if (arena->next) arena->next->prev = arena->prev;
+    pthread_mutex_unlock(&scratch_arenas_mutex);
+    scratch_block *block = arena->top;
+    while (block && block->below) block = block->below;
+    while (block) {
+        scratch_block *next = block->above;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+static void make_scratch_key() {
+    pthread_key_create(&scratch_key, free_scratch_arena);
+}
+
+static scratch_arena *my_scratch_arena() {
+    pthread_once(&scratch_key_once, make_scratch_key);
+    scratch_arena *arena = (scratch_arena *)pthread_getspecific(scratch_key);
+    if (!arena) {
+        arena = (scratch_arena *)malloc(sizeof(scratch_arena));
+        arena->top = NULL;
+        arena->bytes_requested = 0;
+        arena->bytes_reused = 0;
+        arena->prev = NULL;
+        pthread_mutex_lock(&scratch_arenas_mutex);
+        arena->next = scratch_arenas;
+        if (scratch_arenas) scratch_arenas->prev = arena;
+        scratch_arenas = arena;
+        pthread_mutex_unlock(&scratch_arenas_mutex);
+        pthread_setspecific(scratch_key, arena);
+    }
+    return arena;
+}
+
+static scratch_block *new_scratch_block(scratch_block *below, size_t size) {
+    scratch_block *block = (scratch_block *)malloc(sizeof(scratch_block) + size + SCRATCH_ALIGNMENT);
+    block->below = below;
+    block->above = NULL;
+    size_t base = (size_t)(block + 1);
+    block->base = (uint8_t *)((base + SCRATCH_ALIGNMENT - 1) & ~(size_t)(SCRATCH_ALIGNMENT - 1));
+    block->size = size;
+    block->used = 0;
+    block->high_water = 0;
+    if (below) below->above = block;
+    return block;
+}
+
+WEAK void *halide_scratch_alloc(size_t x) {
+    if (x > SCRATCH_MAX_ALLOC) return fast_malloc(x);
+
+    size_t bytes = (x + SCRATCH_ALIGNMENT - 1) & ~(size_t)(SCRATCH_ALIGNMENT - 1);
+    scratch_arena *arena = my_scratch_arena();
+    scratch_block *block = arena->top;
+
+    if (!block || block->used + bytes > block->size) {
+        if (block && block->above && block->above->size >= bytes) {
+            // Move up into a block we made earlier
+            block = block->above;
+        } else {
+            // Blocks above this one are too small. Replace them with
+            // one big enough.
+            scratch_block *above = block ? block->above : NULL;
+            while (above) {
+                scratch_block *next = above->above;
+                free(above);
+                above = next;
+            }
+            size_t size = block ? block->size * 2 : SCRATCH_MIN_BLOCK;
+            if (size < bytes) size = bytes;
+            block = new_scratch_block(arena->top, size);
+        }
+        arena->top = block;
+    }
+
+    size_t start = block->used;
+    block->used += bytes;
+    arena->bytes_requested += x;
+    if (start < block->high_water) {
+        size_t end = start + x < block->high_water ? start + x : block->high_water;
+        arena->bytes_reused += end - start;
+    }
+    if (block->used > block->high_water) block->high_water = block->used;
+
+    return block->base + start;
+}
+
+WEAK void halide_scratch_free(void *ptr) {
+    scratch_arena *arena = my_scratch_arena();
+    scratch_block *block = arena->top;
+    uint8_t *p = (uint8_t *)ptr;
+    if (!block || p < block->base || p >= block->base + block->size) {
+        // It didn't come from the arena
+        fast_free(ptr);
+        return;
+    }
+    // Everything allocated after ptr has already been freed
+    block->used = p - block->base;
+    if (block->used == 0 && block->below) {
+        arena->top = block->below;
+    }
+}
+
+// Report how many bytes of scratch memory have been asked for, and
+// how many of those were satisfied by reusing memory from earlier
+// realizations. Either pointer may be null. Counts from threads that
+// are allocating while this runs may be slightly behind.
+WEAK void halide_scratch_stats(size_t *bytes_requested, size_t *bytes_reused) {
+    pthread_mutex_lock(&scratch_arenas_mutex);
+    size_t requested = scratch_retired_requested;
+    size_t reused = scratch_retired_reused;
+    for (scratch_arena *arena = scratch_arenas; arena; arena = arena->next) {
+        requested += ((volatile scratch_arena *)arena)->bytes_requested;
+        reused += ((volatile scratch_arena *)arena)->bytes_reused;
+    }
+    pthread_mutex_unlock(&scratch_arenas_mutex);
+    if (bytes_requested) *bytes_requested = requested;
+    if (bytes_reused) *bytes_reused = reused;
+}
+
 static void (*halide_error_handler)(char *) = NULL;
 
 WEAK void halide_error(char *msg) {
@@ -73,141 +252,777 @@ WEAK void set_error_handler(void (*handler)(char *)) {
     halide_error_handler = handler;
 }
 
+// A parallel for loop in flight. It lives on the stack of the thread
+// that called do_par_for (the master), which doesn't return until
+// remaining has dropped to zero.
 struct work {
     void (*f)(int, uint8_t *);
-    int next, max;
     uint8_t *closure;
-    int id;
-    int active_workers;
-};
-
-// The work queue and thread count are static, which means each halide
-// function gets a unique one. Is this a good idea?
-#define MAX_JOBS 65536
-#define MAX_THREADS 64
-static struct {
-    work jobs[MAX_JOBS];
-    int head;
-    int tail;
+    // The number of iterations that have not yet finished running
+    int remaining;
+    // Set by whichever thread finishes the last iteration. The master
+    // parks on finished once it has run out of things to claim.
+    volatile bool done;
     pthread_mutex_t mutex;
-    pthread_cond_t not_empty;
-    pthread_t threads[MAX_THREADS];
-    int ids;
-} work_queue;
+    pthread_cond_t finished;
+};
 
-struct worker_arg {
-    int id;
+// A contiguous range of iterations of some job. The owner of a deque
+// claims iterations from the front of its newest range, and thieves
+// steal the back half of the oldest range, so big ranges get split
+// in two for every thread that goes looking for work.
+struct task {
     work *job;
+    int next, max;
 };
 
+// Each thread in the pool has its own deque of ranges behind its own
+// lock. Slot 0 is shared by all threads outside the pool. The claim
+// path only ever touches one of these, so in the common case the lock
+// is uncontended.
+#define MAX_TASKS 256
+struct work_deque {
+    pthread_mutex_t mutex;
+    task tasks[MAX_TASKS];
+    int count;
+    // Keep neighbouring deques on separate cache lines
+    char padding[64];
+};
+
+// The thread pool is static, which means each halide function gets a
+// unique one. Is this a good idea?
+static struct {
+    // One deque per thread, including slot 0. Allocated when the pool
+    // starts, and freed when it shuts down.
+    work_deque *deques;
+    pthread_t *threads;
+    pthread_key_t slot_key;
+    bool slot_key_created;
+    // Bumped every time work is pushed. Workers about to sleep check
+    // it so they can't miss a wakeup.
+    volatile int epoch;
+    volatile int sleepers;
+    pthread_mutex_t sleep_mutex;
+    pthread_cond_t wake_up;
+    volatile bool initialized;
+    volatile bool shutting_down;
+    // How many parallel loops are running, including nested ones, and
+    // whether the pool should be shut down when that gets to zero.
+    volatile int active_jobs;
+    volatile bool restart_pending;
+    // Set through the thread pool API below. Zero means pick a default.
+    int requested_threads;
+    // The cpus pool threads get pinned to, round robin. Empty means
+    // let the OS place them.
+    int *cpus;
+    int cpu_count;
+} work_pool;
+static pthread_mutex_t work_pool_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static int threads;
 
-WEAK void *worker(void *void_arg) {
-    worker_arg *arg = (worker_arg *)void_arg;
-    while (1) {
-        //fprintf(stderr, "About to lock mutex\n");
-        pthread_mutex_lock(&work_queue.mutex);
-        //fprintf(stderr, "Mutex locked, checking for work\n");
-
-        // we're master, and there's no more work
-        if (arg && arg->job->id != arg->id) {
-            // wait until other workers are done
-            if (arg->job->active_workers) {
-                pthread_mutex_unlock(&work_queue.mutex);
-                while (true) {
-                    //fprintf(stderr, "Master waiting for workers to finish\n");
-                    pthread_mutex_lock(&work_queue.mutex);
-                    if (!arg->job->active_workers)
-                        break;
-                    pthread_mutex_unlock(&work_queue.mutex);
-                }
-            }
-            // job is actually done
-            pthread_mutex_unlock(&work_queue.mutex);
-            //fprintf(stderr, "My work here is done. I am needed ... elsewhere!\n");
-            return NULL;
+// How many times to poll before going to sleep, either while waiting
+// for a job to finish or while looking for something to do. Spinning
+// briefly saves a trip through the kernel when the wait is short.
+static int spin_count;
+
+static inline void spin_pause() {
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// Which deque does the calling thread own?
+static int my_slot() {
+    return (int)(size_t)pthread_getspecific(work_pool.slot_key);
+}
+
+// Drop exhausted ranges, keeping the rest in order. Must hold the deque lock.
+static void compact_deque(work_deque *d) {
+    int j = 0;
+    for (int i = 0; i < d->count; i++) {
+        if (d->tasks[i].next < d->tasks[i].max) d->tasks[j++] = d->tasks[i];
+    }
+    d->count = j;
+}
+
+static void push_task(int slot, task t) {
+    work_deque *d = work_pool.deques + slot;
+    pthread_mutex_lock(&d->mutex);
+    compact_deque(d);
+    assert(d->count < MAX_TASKS);
+    d->tasks[d->count++] = t;
+    pthread_mutex_unlock(&d->mutex);
+
+    __sync_fetch_and_add(&work_pool.epoch, 1);
+    if (work_pool.sleepers) {
+        pthread_mutex_lock(&work_pool.sleep_mutex);
+        pthread_cond_broadcast(&work_pool.wake_up);
+        pthread_mutex_unlock(&work_pool.sleep_mutex);
+    }
+}
+
+// Claim some iterations from our own deque, newest range first. If
+// job is non-null, only ranges belonging to that job are considered.
+static bool claim_local(int slot, work *job, task *claimed) {
+    work_deque *d = work_pool.deques + slot;
+    if (!d->count) return false;
+    bool found = false;
+    pthread_mutex_lock(&d->mutex);
+    compact_deque(d);
+    for (int i = d->count - 1; i >= 0; i--) {
+        task *t = d->tasks + i;
+        if (job && t->job != job) continue;
+        // Take a slice proportional to what's left, so that the
+        // range shrinks geometrically and there's always something
+        // left to steal until near the end.
+        int n = (t->max - t->next) / (2 * threads);
+        if (n < 1) n = 1;
+        claimed->job = t->job;
+        claimed->next = t->next;
+        claimed->max = t->next + n;
+        t->next += n;
+        found = true;
+        break;
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return found;
+}
+
+// Steal the back half of the oldest matching range from some other
+// deque, and push it onto our own.
+static bool steal(int slot, work *job) {
+    for (int i = 1; i < threads; i++) {
+        int victim = (slot + i) % threads;
+        work_deque *d = work_pool.deques + victim;
+        if (!d->count) continue;
+        task stolen;
+        bool found = false;
+        pthread_mutex_lock(&d->mutex);
+        for (int j = 0; j < d->count; j++) {
+            task *t = d->tasks + j;
+            if (t->next == t->max) continue;
+            if (job && t->job != job) continue;
+            int n = (t->max - t->next + 1) / 2;
+            stolen.job = t->job;
+            stolen.next = t->max - n;
+            stolen.max = t->max;
+            t->max -= n;
+            found = true;
+            break;
+        }
+        pthread_mutex_unlock(&d->mutex);
+        if (found) {
+            push_task(slot, stolen);
+            return true;
         }
-            
-        if (work_queue.head == work_queue.tail) {
-            assert(!arg); // the master should never get here
-            //fprintf(stderr, "No work left. Going to sleep.\n");
+    }
+    return false;
+}
+
+static bool find_work(int slot, work *job, task *claimed) {
+    if (claim_local(slot, job, claimed)) return true;
+    return steal(slot, job) && claim_local(slot, job, claimed);
+}
+
+static void run_task(task t) {
+    for (int i = t.next; i < t.max; i++) {
+        t.job->f(i, t.job->closure);
+    }
+    work *job = t.job;
+    if (__sync_sub_and_fetch(&job->remaining, t.max - t.next) == 0) {
+        // We ran the last iteration. Let the master know. It can't
+        // return until we release the mutex, so the job stays valid.
+        pthread_mutex_lock(&job->mutex);
+        job->done = true;
+        pthread_cond_signal(&job->finished);
+        pthread_mutex_unlock(&job->mutex);
+    }
+}
+
+// Wait for the other threads to finish off a job.
+static void wait_for_job(work *job) {
+    for (int i = 0; i < spin_count && !job->done; i++) {
+        spin_pause();
+    }
+    // Even if we saw done while spinning, the thread that set it may
+    // still be holding the mutex, so synchronize with it before the
+    // job goes out of scope.
+    pthread_mutex_lock(&job->mutex);
+    while (!job->done) {
+        pthread_cond_wait(&job->finished, &job->mutex);
+    }
+    pthread_mutex_unlock(&job->mutex);
+}
 
-            pthread_cond_wait(&work_queue.not_empty, &work_queue.mutex);
-            pthread_mutex_unlock(&work_queue.mutex);
+WEAK void *worker(void *void_arg) {
+    int slot = (int)(size_t)void_arg;
+    pthread_setspecific(work_pool.slot_key, void_arg);
+    while (!work_pool.shutting_down) {
+        int epoch = work_pool.epoch;
+        task t;
+        if (find_work(slot, NULL, &t)) {
+            run_task(t);
             continue;
         }
 
-        //fprintf(stderr, "There is work\n");
-        work *job = work_queue.jobs + work_queue.head;
-        if (job->next == job->max) {
-            //fprintf(stderr, "Found a finished job. Removing it\n");
-            work_queue.head = (work_queue.head + 1) % MAX_JOBS;            
-            job->id = 0; // mark the job done
-            pthread_mutex_unlock(&work_queue.mutex);
-        } else {
-            int remaining = job->max - job->next;
-            // Claim some tasks
-            //int claimed = (remaining + threads - 1)/threads;
-            int claimed = 1;
-            //printf("Claiming %d tasks\n", claimed);
-            work myjob = *job;
-            job->next += claimed;            
-            myjob.max = job->next;
-            job->active_workers++;
-            pthread_mutex_unlock(&work_queue.mutex);
-            //fprintf(stderr, "Doing job %d\n", myjob.next);
-            for (; myjob.next < myjob.max; myjob.next++)
-                myjob.f(myjob.next, myjob.closure);
-            //fprintf(stderr, "Done with job %d\n", myjob.next);
-            pthread_mutex_lock(&work_queue.mutex);
-            job->active_workers--;
-            pthread_mutex_unlock(&work_queue.mutex);
-        }        
+        // There's nothing to do anywhere. Poll for new work for a
+        // little while, then go to sleep until someone pushes some.
+        for (int i = 0; i < spin_count && epoch == work_pool.epoch; i++) {
+            spin_pause();
+        }
+        if (epoch != work_pool.epoch) continue;
+
+        pthread_mutex_lock(&work_pool.sleep_mutex);
+        __sync_fetch_and_add(&work_pool.sleepers, 1);
+        if (epoch == work_pool.epoch) {
+            pthread_cond_wait(&work_pool.wake_up, &work_pool.sleep_mutex);
+        }
+        __sync_fetch_and_sub(&work_pool.sleepers, 1);
+        pthread_mutex_unlock(&work_pool.sleep_mutex);
     }
+    return NULL;
+}
+
+// Pin pool thread i to its share of the cpu list. Returns -1 if this
+// platform can't do that.
+static int pin_thread(int i) {
+#ifdef CPU_SET
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (work_pool.cpu_count) {
+        CPU_SET(work_pool.cpus[(i - 1) % work_pool.cpu_count], &set);
+    } else {
+        for (int c = 0; c < CPU_SETSIZE; c++) CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(work_pool.threads[i], sizeof(set), &set) ? -1 : 0;
+#else
+    return work_pool.cpu_count ? -1 : 0;
+#endif
+}
+
+// Stop and join all the pool threads. The caller holds
+// work_pool_init_mutex, and no parallel loop may be running.
+static void shutdown_thread_pool_locked() {
+    if (!work_pool.initialized) return;
+    pthread_mutex_lock(&work_pool.sleep_mutex);
+    work_pool.shutting_down = true;
+    __sync_fetch_and_add(&work_pool.epoch, 1);
+    pthread_cond_broadcast(&work_pool.wake_up);
+    pthread_mutex_unlock(&work_pool.sleep_mutex);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(work_pool.threads[i], NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&work_pool.deques[i].mutex);
+    }
+    free(work_pool.deques);
+    free(work_pool.threads);
+    work_pool.deques = NULL;
+    work_pool.threads = NULL;
+    work_pool.initialized = false;
+}
+
+// A forked child has only the thread that called fork, so the pool
+// threads it inherits the bookkeeping for don't exist. Forget them
+// (they can't be joined) and start a fresh pool the next time a
+// parallel loop runs. Any of the locks might have been held by some
+// other thread at the fork, so they all start over too.
+static void reset_thread_pool_after_fork() {
+    pthread_mutex_init(&work_pool_init_mutex, NULL);
+    pthread_mutex_init(&work_pool.sleep_mutex, NULL);
+    pthread_cond_init(&work_pool.wake_up, NULL);
+    if (work_pool.initialized) {
+        free(work_pool.deques);
+        free(work_pool.threads);
+        work_pool.deques = NULL;
+        work_pool.threads = NULL;
+    }
+    work_pool.sleepers = 0;
+    work_pool.active_jobs = 0;
+    work_pool.restart_pending = false;
+    work_pool.shutting_down = false;
+    work_pool.initialized = false;
+}
+
+// The caller holds work_pool_init_mutex.
+static void init_thread_pool_locked() {
+    if (work_pool.initialized) return;
+    if (!work_pool.slot_key_created) {
+        pthread_key_create(&work_pool.slot_key, NULL);
+        pthread_mutex_init(&work_pool.sleep_mutex, NULL);
+        pthread_cond_init(&work_pool.wake_up, NULL);
+        pthread_atfork(NULL, NULL, reset_thread_pool_after_fork);
+        work_pool.slot_key_created = true;
+    }
+    // An explicit request wins, then HL_NUMTHREADS, then one
+    // thread per online cpu.
+    threads = work_pool.requested_threads;
+    char *threadStr = getenv("HL_NUMTHREADS");
+    if (!threads && threadStr) threads = atoi(threadStr);
+    if (!threads) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    char *spinStr = getenv("HL_SPIN_COUNT");
+    spin_count = spinStr ? atoi(spinStr) : 1000;
+    work_pool.deques = (work_deque *)malloc(threads * sizeof(work_deque));
+    work_pool.threads = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&work_pool.deques[i].mutex, NULL);
+        work_pool.deques[i].count = 0;
+    }
+    work_pool.shutting_down = false;
+    // Slot 0 belongs to threads outside the pool
+    for (int i = 1; i < threads; i++) {
+        pthread_create(work_pool.threads + i, NULL, worker, (void *)(size_t)i);
+        if (work_pool.cpu_count) pin_thread(i);
+    }
+    __sync_synchronize();
+    work_pool.initialized = true;
+}
+
+// Shut down the pool if a restart was asked for while parallel loops
+// were running and none are now. The caller holds
+// work_pool_init_mutex.
+static void finish_pending_restart_locked() {
+    if (work_pool.restart_pending && !work_pool.active_jobs) {
+        shutdown_thread_pool_locked();
+        work_pool.restart_pending = false;
+    }
+}
+
+// Count a parallel loop as running, starting the pool first if
+// necessary. Usually that's just the increment. A thread asking for a
+// restart sets restart_pending before it looks at active_jobs, and we
+// bump active_jobs before we look at restart_pending, so one of us
+// always sees the other.
+static void begin_job() {
+    __sync_fetch_and_add(&work_pool.active_jobs, 1);
+    bool pending = work_pool.restart_pending;
+    __sync_synchronize();
+    if (!pending && work_pool.initialized) return;
+    __sync_fetch_and_sub(&work_pool.active_jobs, 1);
+
+    pthread_mutex_lock(&work_pool_init_mutex);
+    finish_pending_restart_locked();
+    init_thread_pool_locked();
+    __sync_fetch_and_add(&work_pool.active_jobs, 1);
+    pthread_mutex_unlock(&work_pool_init_mutex);
+}
+
+// The last parallel loop to finish carries out a pending restart. It
+// can't be a pool thread, because a parallel loop run by a pool
+// thread is nested inside another one.
+static void end_job() {
+    if (__sync_sub_and_fetch(&work_pool.active_jobs, 1) || !work_pool.restart_pending) return;
+    pthread_mutex_lock(&work_pool_init_mutex);
+    finish_pending_restart_locked();
+    pthread_mutex_unlock(&work_pool_init_mutex);
 }
 
 WEAK void do_par_for(void (*f)(int, uint8_t *), int min, int size, uint8_t *closure) {
-    static bool thread_pool_initialized = false;
-    if (!thread_pool_initialized) {
-        pthread_mutex_init(&work_queue.mutex, NULL);
-        pthread_cond_init(&work_queue.not_empty, NULL);
-        work_queue.head = work_queue.tail = 0;
-        work_queue.ids = 1;
-        char *threadStr = getenv("HL_NUMTHREADS");
-        threads = 8;
-        if (threadStr) {
-            threads = atoi(threadStr);
-        } else {
-            printf("HL_NUMTHREADS not defined. Defaulting to 8 threads.\n");
+    if (size <= 0) return;
+    begin_job();
+
+    int slot = my_slot();
+    work job;
+    job.f = f;
+    job.closure = closure;
+    job.remaining = size;
+    job.done = false;
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.finished, NULL);
+    task t = {&job, min, min + size};
+    push_task(slot, t);
+
+    // Work on our own job (and only our own job) until it's all
+    // claimed, then park until whoever has the last pieces is done.
+    task mine;
+    while (find_work(slot, &job, &mine)) {
+        run_task(mine);
+    }
+    wait_for_job(&job);
+
+    pthread_cond_destroy(&job.finished);
+    pthread_mutex_destroy(&job.mutex);
+    end_job();
+}
+
+// The functions below let the application that embeds a halide
+// pipeline control its thread pool. They're safe to call from any
+// thread, including from inside a parallel loop. Pool threads can't be
+// stopped while parallel loops are running, so a shutdown or resize
+// asked for then waits until the last of them finishes; until then
+// the loops keep the pool they started with.
+
+// Stop the pool if no parallel loop is running, and ask it to stop
+// as soon as none are otherwise. Either way it starts up again the
+// next time a parallel loop runs.
+static void restart_thread_pool_locked() {
+    work_pool.restart_pending = true;
+    __sync_synchronize();
+    finish_pending_restart_locked();
+}
+
+// Stop and join all the pool threads. The pool starts up again the
+// next time a parallel loop runs.
+WEAK void halide_shutdown_thread_pool() {
+    pthread_mutex_lock(&work_pool_init_mutex);
+    restart_thread_pool_locked();
+    pthread_mutex_unlock(&work_pool_init_mutex);
+}
+
+// Set the number of threads (including the caller's) that run
+// parallel loops. Zero means use HL_NUMTHREADS, or failing that the
+// number of online cpus. Resizes a running pool.
+WEAK void halide_set_num_threads(int n) {
+    if (n < 0) n = 0;
+    pthread_mutex_lock(&work_pool_init_mutex);
+    if (n != work_pool.requested_threads) {
+        work_pool.requested_threads = n;
+        restart_thread_pool_locked();
+    }
+    pthread_mutex_unlock(&work_pool_init_mutex);
+}
+
+// The number of threads in the pool. Starts the pool if necessary.
+// While a resize is waiting for parallel loops to finish, this is
+// still the size of the pool they're running on.
+WEAK int halide_get_num_threads() {
+    pthread_mutex_lock(&work_pool_init_mutex);
+    init_thread_pool_locked();
+    int n = threads;
+    pthread_mutex_unlock(&work_pool_init_mutex);
+    return n;
+}
+
+// Pin pool threads round robin to the given cpus. A count of zero
+// unpins them. Returns -1 if thread affinity isn't supported here.
+WEAK int halide_set_thread_affinity(const int *cpus, int count) {
+    pthread_mutex_lock(&work_pool_init_mutex);
+    free(work_pool.cpus);
+    work_pool.cpus = NULL;
+    work_pool.cpu_count = 0;
+    if (count > 0) {
+        work_pool.cpus = (int *)malloc(count * sizeof(int));
+        for (int i = 0; i < count; i++) work_pool.cpus[i] = cpus[i];
+        work_pool.cpu_count = count;
+    }
+    int result = 0;
+#ifndef CPU_SET
+    if (count > 0) result = -1;
+#endif
+    if (work_pool.initialized) {
+        for (int i = 1; i < threads; i++) {
+            if (pin_thread(i)) result = -1;
         }
-        if (threads > MAX_THREADS) threads = MAX_THREADS;
-        for (int i = 0; i < threads-1; i++) {
-            pthread_create(work_queue.threads + i, NULL, worker, NULL);
+    }
+    pthread_mutex_unlock(&work_pool_init_mutex);
+    return result;
+}
+
+// Pin pool threads to the cpus of one NUMA node, as listed by the
+// kernel. Returns -1 if the node doesn't exist or affinity isn't
+// supported here.
+WEAK int halide_set_thread_numa_node(int node) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    // The list looks like 0-7,16-23
+    int cpus[1024];
+    int count = 0;
+    int lo, hi;
+    while (count < 1024 && fscanf(f, "%d", &lo) == 1) {
+        hi = lo;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &hi) != 1) break;
+            c = fgetc(f);
         }
+        for (int i = lo; i <= hi && count < 1024; i++) cpus[count++] = i;
+        if (c != ',') break;
+    }
+    fclose(f);
+    if (!count) return -1;
+    return halide_set_thread_affinity(cpus, count);
+}
 
-        thread_pool_initialized = true;
+// Report how busy the pool is: how many threads it has, how many are
+// awake (running or looking for work), and how many loop iterations
+// are queued but not yet claimed. Any pointer may be null.
+WEAK void halide_thread_pool_stats(int *num_threads, int *busy_threads, int *queued_iterations) {
+    int total = 0, busy = 0, queued = 0;
+    pthread_mutex_lock(&work_pool_init_mutex);
+    if (work_pool.initialized) {
+        total = threads;
+        // Pool threads that aren't asleep. Slot 0 isn't a pool thread.
+        busy = threads - 1 - work_pool.sleepers;
+        for (int i = 0; i < threads; i++) {
+            work_deque *d = work_pool.deques + i;
+            pthread_mutex_lock(&d->mutex);
+            for (int j = 0; j < d->count; j++) {
+                queued += d->tasks[j].max - d->tasks[j].next;
+            }
+            pthread_mutex_unlock(&d->mutex);
+        }
     }
+    pthread_mutex_unlock(&work_pool_init_mutex);
+    if (num_threads) *num_threads = total;
+    if (busy_threads) *busy_threads = busy;
+    if (queued_iterations) *queued_iterations = queued;
+}
 
-    // Enqueue the job
-    pthread_mutex_lock(&work_queue.mutex);
-    //fprintf(stderr, "Enqueuing some work\n");
-    work job = {f, min, min + size, closure, work_queue.ids++, 0};
-    if (job.id == 0) job.id = work_queue.ids++; // disallow zero, as it flags a completed job
-    work_queue.jobs[work_queue.tail] = job;
-    work *jobPtr = work_queue.jobs + work_queue.tail;
-    worker_arg arg = {job.id, jobPtr};
-    int new_tail = (work_queue.tail + 1) % MAX_JOBS;
-    assert(new_tail != work_queue.head); 
-    work_queue.tail = new_tail;
+// Profiling. When HL_PROFILE is set at compile time, the generated
+// code brackets the entrypoint, the produce step of each Pipeline, and
+// each parallel loop with calls to the functions below, which
+// accumulate per-stage counts in a table that halide_profile_report
+// prints. A stage's total time is measured on the thread that ran it,
+// and its self time leaves out the stages it contains that ran on the
+// same thread, so the self times of all the stages add up to the cpu
+// time spent in the pipeline. A parallel loop's time is the time its
+// caller spent waiting for it. Its iterations are timed separately on
+// whichever thread ran them, which is where the utilization figures
+// come from.
 
-    // TODO: check to make sure the work queue doesn't overflow
-    pthread_mutex_unlock(&work_queue.mutex);
-    
-    // Wake up everyone
-    pthread_cond_broadcast(&work_queue.not_empty);
+#define PROFILE_MAX_STAGES 256
+#define PROFILE_MAX_DEPTH 64
+#define PROFILE_MAX_THREADS 64
+#define PROFILE_HASH_SIZE 1024
+
+struct profile_stage {
+    const char *name;
+    bool parallel;
+    volatile uint64_t calls, ticks, self_ticks, bytes;
+    // Parallel loops only: how many iterations ran, and for how long
+    // on each thread
+    volatile uint64_t iterations, busy_ticks[PROFILE_MAX_THREADS];
+};
+
+// A stage in progress on some thread
+struct profile_frame {
+    int stage;
+    uint64_t start;
+    // The time spent in the stages it contains
+    uint64_t child_ticks;
+};
+
+struct profile_stack {
+    int depth;
+    profile_frame frames[PROFILE_MAX_DEPTH];
+};
 
-    // Do some work myself
-    worker((void *)(&arg));
+static struct {
+    profile_stage stages[PROFILE_MAX_STAGES];
+    volatile int num_stages;
+    // Stage names are looked up by address first. Each compiled
+    // pipeline has its own copy of each name, so the same stage may
+    // appear here under several addresses.
+    const char *volatile hash_keys[PROFILE_HASH_SIZE];
+    int hash_values[PROFILE_HASH_SIZE];
+    // When the first stage was entered, so that ticks can be converted
+    // to seconds
+    volatile bool started;
+    uint64_t start_ticks;
+    timeval start_time;
+} profile;
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t profile_key;
+static pthread_once_t profile_key_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t profile_ticks() {
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+#endif
+}
+
+static void make_profile_key() {
+    pthread_key_create(&profile_key, free);
+}
+
+static profile_stack *my_profile_stack() {
+    pthread_once(&profile_key_once, make_profile_key);
+    profile_stack *stack = (profile_stack *)pthread_getspecific(profile_key);
+    if (!stack) {
+        stack = (profile_stack *)malloc(sizeof(profile_stack));
+        stack->depth = 0;
+        pthread_setspecific(profile_key, stack);
+    }
+    return stack;
+}
+
+// Find or make the table entry for a stage. Returns -1 if the table is full.
+static int profile_stage_index(const char *name, bool parallel) {
+    size_t h = ((size_t)name >> 3) % PROFILE_HASH_SIZE;
+    for (int i = 0; i < PROFILE_HASH_SIZE; i++) {
+        const char *key = profile.hash_keys[(h + i) % PROFILE_HASH_SIZE];
+        if (key == name) return profile.hash_values[(h + i) % PROFILE_HASH_SIZE];
+        if (!key) break;
+    }
+
+    pthread_mutex_lock(&profile_mutex);
+    if (!profile.started) {
+        profile.start_ticks = profile_ticks();
+        gettimeofday(&profile.start_time, NULL);
+        profile.started = true;
+    }
+    int index = -1;
+    for (int i = 0; i < profile.num_stages; i++) {
+        if (!strcmp(profile.stages[i].name, name)) index = i;
+    }
+    if (index < 0 && profile.num_stages < PROFILE_MAX_STAGES) {
+        index = profile.num_stages;
+        profile_stage *s = profile.stages + index;
+        memset(s, 0, sizeof(profile_stage));
+        s->name = name;
+        s->parallel = parallel;
+        __sync_synchronize();
+        profile.num_stages++;
+    }
+    // Remember the address, unless someone else beat us to it
+    for (int i = 0; index >= 0 && i < PROFILE_HASH_SIZE; i++) {
+        size_t slot = (h + i) % PROFILE_HASH_SIZE;
+        if (profile.hash_keys[slot] == name) break;
+        if (!profile.hash_keys[slot]) {
+            profile.hash_values[slot] = index;
+            __sync_synchronize();
+            profile.hash_keys[slot] = name;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&profile_mutex);
+    return index;
+}
+
+// Start timing a stage on this thread. Returns a token to pass to
+// halide_profile_exit, which is negative if the stage won't be
+// counted.
+WEAK int halide_profile_enter(const char *name, int64_t bytes, int parallel) {
+    int stage = profile_stage_index(name, parallel != 0);
+    profile_stack *stack = my_profile_stack();
+    if (stage < 0 || stack->depth >= PROFILE_MAX_DEPTH) return -1;
+    if (bytes > 0) __sync_fetch_and_add(&profile.stages[stage].bytes, (uint64_t)bytes);
+    profile_frame *f = stack->frames + stack->depth;
+    f->stage = stage;
+    f->child_ticks = 0;
+    f->start = profile_ticks();
+    return stack->depth++;
+}
+
+WEAK void halide_profile_exit(int token) {
+    uint64_t now = profile_ticks();
+    if (token < 0) return;
+    profile_stack *stack = my_profile_stack();
+    profile_frame *f = stack->frames + token;
+    profile_stage *s = profile.stages + f->stage;
+    uint64_t ticks = now - f->start;
+    __sync_fetch_and_add(&s->calls, 1);
+    __sync_fetch_and_add(&s->ticks, ticks);
+    if (!s->parallel && ticks > f->child_ticks) {
+        __sync_fetch_and_add(&s->self_ticks, ticks - f->child_ticks);
+    }
+    // Anything entered after this and not exited (which only happens
+    // when an assertion fails) is abandoned along with it
+    stack->depth = token;
+    if (token > 0) stack->frames[token - 1].child_ticks += ticks;
+}
+
+// Time one iteration of a parallel loop. The end call names the loop.
+WEAK int64_t halide_profile_iteration_begin() {
+    return (int64_t)profile_ticks();
+}
+
+WEAK void halide_profile_iteration_end(const char *name, int64_t start) {
+    uint64_t ticks = profile_ticks() - (uint64_t)start;
+    int stage = profile_stage_index(name, true);
+    if (stage < 0) return;
+    profile_stage *s = profile.stages + stage;
+    int slot = work_pool.initialized ? my_slot() : 0;
+    if (slot >= PROFILE_MAX_THREADS) slot = PROFILE_MAX_THREADS - 1;
+    __sync_fetch_and_add(&s->iterations, 1);
+    __sync_fetch_and_add(&s->busy_ticks[slot], ticks);
+}
+
+// Print the per-stage table to stderr. Stages are listed in the order
+// they first ran.
+WEAK void halide_profile_report() {
+    if (!profile.started) {
+        fprintf(stderr, "No stages have been profiled. Compile with HL_PROFILE=1.\n");
+        return;
+    }
+
+    // Work out how fast the ticks go, waiting a little if the first
+    // stage ran too recently to tell
+    timeval now;
+    uint64_t now_ticks;
+    double seconds;
+    do {
+        gettimeofday(&now, NULL);
+        now_ticks = profile_ticks();
+        seconds = (now.tv_sec - profile.start_time.tv_sec) +
+            (now.tv_usec - profile.start_time.tv_usec) / 1000000.0;
+        if (seconds < 0.01) usleep(1000);
+    } while (seconds < 0.01);
+    double ms_per_tick = seconds * 1000 / (now_ticks - profile.start_ticks);
+
+    uint64_t total_self = 0;
+    for (int i = 0; i < profile.num_stages; i++) {
+        total_self += profile.stages[i].self_ticks;
+    }
+
+    int num_threads = work_pool.initialized ? threads : 1;
+    if (num_threads > PROFILE_MAX_THREADS) num_threads = PROFILE_MAX_THREADS;
+
+    fprintf(stderr, "%-32s %10s %12s %12s %7s %14s\n",
+            "Stage", "Calls", "Total (ms)", "Self (ms)", "Self %", "Bytes");
+    for (int i = 0; i < profile.num_stages; i++) {
+        profile_stage *s = profile.stages + i;
+        const char *name = s->name[0] == '.' ? s->name + 1 : s->name;
+        if (!s->parallel) {
+            fprintf(stderr, "%-32s %10llu %12.3f %12.3f %6.1f%% %14llu\n",
+                    name, (unsigned long long)s->calls,
+                    s->ticks * ms_per_tick, s->self_ticks * ms_per_tick,
+                    total_self ? 100.0 * s->self_ticks / total_self : 0.0,
+                    (unsigned long long)s->bytes);
+            continue;
+        }
+
+        // For a parallel loop, how much of the time it was running
+        // the threads spent running its iterations
+        uint64_t busy = 0;
+        for (int t = 0; t < PROFILE_MAX_THREADS; t++) busy += s->busy_ticks[t];
+        double utilization = s->ticks ? (double)busy / ((double)s->ticks * num_threads) : 0.0;
+        fprintf(stderr, "%-32s %10llu %12.3f %12s %7s %14s\n",
+                name, (unsigned long long)s->calls, s->ticks * ms_per_tick, "parallel", "", "");
+        fprintf(stderr, "    %llu iterations, %.1f%% utilization of %d threads:",
+                (unsigned long long)s->iterations, 100 * utilization, num_threads);
+        for (int t = 0; t < num_threads; t++) {
+            fprintf(stderr, " %.0f%%", s->ticks ? 100.0 * s->busy_ticks[t] / s->ticks : 0.0);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+// Zero the counts, e.g. to leave out a warm-up run. No stage may be
+// running at the time.
+WEAK void halide_profile_reset() {
+    pthread_mutex_lock(&profile_mutex);
+    for (int i = 0; i < profile.num_stages; i++) {
+        profile_stage *s = profile.stages + i;
+        const char *name = s->name;
+        bool parallel = s->parallel;
+        memset(s, 0, sizeof(profile_stage));
+        s->name = name;
+        s->parallel = parallel;
+    }
+    pthread_mutex_unlock(&profile_mutex);
 }
 
 WEAK float sqrt_f32(float x) {
@@ -234,6 +1049,229 @@ WEAK float pow_f32(float x, float y) {
     return powf(x, y);
 }
 
+// Vector versions of the transcendental functions above. The
+// vectorizer calls these directly on four- or eight-wide float
+// vectors, rather than splitting the vector into lanes and calling
+// libm once per lane. They use the cephes range reductions and
+// polynomials, and are accurate to a few ulps over the normal range
+// of each function. sqrt and the eight-wide versions live in the
+// architecture-specific .ll files; the latter just call these twice.
+#if defined(__clang__) || (__GNUC__ * 100 + __GNUC_MINOR__ >= 407)
+
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+
+static inline f32x4 splat_f32x4(float x) {
+    f32x4 v = {x, x, x, x};
+    return v;
+}
+
+static inline i32x4 splat_i32x4(int32_t x) {
+    i32x4 v = {x, x, x, x};
+    return v;
+}
+
+// Comparisons give -1 in the true lanes and 0 elsewhere, so we can
+// select between two vectors with bitwise ops on their bits.
+static inline f32x4 select_f32x4(i32x4 mask, f32x4 a, f32x4 b) {
+    return (f32x4)((mask & (i32x4)a) | (~mask & (i32x4)b));
+}
+
+// Round to the nearest integer by adding and subtracting 1.5 * 2^23,
+// which pushes the fractional bits off the end of the mantissa. Only
+// valid for |x| < 2^22. The integer value is left in the low bits of
+// the intermediate sum, which to_int_f32x4 extracts.
+#define ROUND_MAGIC 12582912.0f
+
+static inline f32x4 round_f32x4(f32x4 x) {
+    f32x4 magic = splat_f32x4(ROUND_MAGIC);
+    return (x + magic) - magic;
+}
+
+static inline i32x4 to_int_f32x4(f32x4 integral) {
+    return (i32x4)(integral + splat_f32x4(ROUND_MAGIC)) - (i32x4)splat_f32x4(ROUND_MAGIC);
+}
+
+static inline f32x4 to_float_i32x4(i32x4 x) {
+    return (f32x4)(x + (i32x4)splat_f32x4(ROUND_MAGIC)) - splat_f32x4(ROUND_MAGIC);
+}
+
+WEAK f32x4 exp_f32x4(f32x4 x) {
+    f32x4 hi = splat_f32x4(88.7228391116729996f), lo = splat_f32x4(-103.972077083991796f);
+    i32x4 too_big = x > hi, too_small = x < lo;
+    i32x4 is_nan = x != x;
+    x = select_f32x4(too_big, hi, select_f32x4(too_small, lo, x));
+
+    // exp(x) = 2^n * exp(r), with n = round(x / ln(2)).
+    f32x4 n = round_f32x4(x * splat_f32x4(1.44269504088896341f));
+    x -= n * splat_f32x4(0.693359375f);
+    x -= n * splat_f32x4(-2.12194440e-4f);
+
+    f32x4 z = x * x;
+    f32x4 y = splat_f32x4(1.9875691500E-4f);
+    y = y * x + splat_f32x4(1.3981999507E-3f);
+    y = y * x + splat_f32x4(8.3334519073E-3f);
+    y = y * x + splat_f32x4(4.1665795894E-2f);
+    y = y * x + splat_f32x4(1.6666665459E-1f);
+    y = y * x + splat_f32x4(5.0000001201E-1f);
+    y = y * z + x + splat_f32x4(1.0f);
+
+    // Build 2^n in the exponent bits. n runs from -150 to 128, which
+    // doesn't fit in one exponent, so scale by two halves of it.
+    i32x4 n1 = to_int_f32x4(n) >> 1;
+    i32x4 n2 = to_int_f32x4(n) - n1;
+    y *= (f32x4)((n1 + splat_i32x4(127)) << 23);
+    y *= (f32x4)((n2 + splat_i32x4(127)) << 23);
+
+    y = select_f32x4(too_big, splat_f32x4(INFINITY), y);
+    y = select_f32x4(too_small, splat_f32x4(0.0f), y);
+    return select_f32x4(is_nan, x, y);
+}
+
+WEAK f32x4 log_f32x4(f32x4 x) {
+    i32x4 is_zero = x == splat_f32x4(0.0f);
+    i32x4 is_invalid = (x < splat_f32x4(0.0f)) | (x != x);
+    i32x4 is_inf = x == splat_f32x4(INFINITY);
+
+    // Scale denormals up into the normal range.
+    i32x4 denormal = x < splat_f32x4(FLT_MIN);
+    x = select_f32x4(denormal, x * splat_f32x4(16777216.0f), x);
+    f32x4 bias = select_f32x4(denormal, splat_f32x4(24.0f), splat_f32x4(0.0f));
+
+    // Split into a mantissa m in [0.5, 1) and exponent e.
+    i32x4 bits = (i32x4)x;
+    f32x4 e = to_float_i32x4(((bits >> 23) & splat_i32x4(0xff)) - splat_i32x4(126)) - bias;
+    f32x4 m = (f32x4)((bits & splat_i32x4(0x007fffff)) | splat_i32x4(0x3f000000));
+
+    // Move the mantissa to [sqrt(0.5), sqrt(2)) then subtract one.
+    i32x4 small = m < splat_f32x4(0.707106781186547524f);
+    e = select_f32x4(small, e - splat_f32x4(1.0f), e);
+    m = select_f32x4(small, m + m, m) - splat_f32x4(1.0f);
+
+    f32x4 z = m * m;
+    f32x4 y = splat_f32x4(7.0376836292E-2f);
+    y = y * m - splat_f32x4(1.1514610310E-1f);
+    y = y * m + splat_f32x4(1.1676998740E-1f);
+    y = y * m - splat_f32x4(1.2420140846E-1f);
+    y = y * m + splat_f32x4(1.4249322787E-1f);
+    y = y * m - splat_f32x4(1.6668057665E-1f);
+    y = y * m + splat_f32x4(2.0000714765E-1f);
+    y = y * m - splat_f32x4(2.4999993993E-1f);
+    y = y * m + splat_f32x4(3.3333331174E-1f);
+    y = y * m * z;
+    y += e * splat_f32x4(-2.12194440e-4f);
+    y -= z * splat_f32x4(0.5f);
+    y = m + y + e * splat_f32x4(0.693359375f);
+
+    y = select_f32x4(is_inf, splat_f32x4(INFINITY), y);
+    y = select_f32x4(is_zero, splat_f32x4(-INFINITY), y);
+    return select_f32x4(is_invalid, splat_f32x4(NAN), y);
+}
+
+// sin and cos share a range reduction to [-pi/4, pi/4], and pick
+// between a sine and a cosine polynomial depending on the octant. The
+// reduction loses accuracy for large arguments, so if any lane is
+// outside +/-8192 we just call libm per lane.
+static inline f32x4 sin_cos_f32x4(f32x4 x, bool cosine) {
+    i32x4 sign_bit = splat_i32x4(0x80000000);
+    i32x4 sign = cosine ? splat_i32x4(0) : ((i32x4)x & sign_bit);
+    x = (f32x4)((i32x4)x & ~sign_bit);
+
+    // j is the octant, rounded up to an even number.
+    f32x4 q = x * splat_f32x4(1.27323954473516f);
+    f32x4 jf = round_f32x4(q);
+    jf = select_f32x4(jf > q, jf - splat_f32x4(1.0f), jf);
+    i32x4 j = (to_int_f32x4(jf) + splat_i32x4(1)) & splat_i32x4(~1);
+    jf = to_float_i32x4(j);
+    if (cosine) j -= splat_i32x4(2);
+
+    i32x4 flip = cosine ? (~j & splat_i32x4(4)) : (j & splat_i32x4(4));
+    sign ^= flip << 29;
+    i32x4 use_sin = (j & splat_i32x4(2)) == splat_i32x4(0);
+
+    x = ((x - jf * splat_f32x4(0.78515625f))
+         - jf * splat_f32x4(2.4187564849853515625e-4f))
+         - jf * splat_f32x4(3.77489497744594108e-8f);
+    f32x4 z = x * x;
+
+    f32x4 c = splat_f32x4(2.443315711809948E-005f);
+    c = c * z - splat_f32x4(1.388731625493765E-003f);
+    c = c * z + splat_f32x4(4.166664568298827E-002f);
+    c = c * z * z - z * splat_f32x4(0.5f) + splat_f32x4(1.0f);
+
+    f32x4 s = splat_f32x4(-1.9515295891E-4f);
+    s = s * z + splat_f32x4(8.3321608736E-3f);
+    s = s * z - splat_f32x4(1.6666654611E-1f);
+    s = s * z * x + x;
+
+    return (f32x4)((i32x4)select_f32x4(use_sin, s, c) ^ sign);
+}
+
+static inline bool in_sin_cos_range(f32x4 x) {
+    // Also catches NaNs, which fail every comparison
+    i32x4 ok = (x >= splat_f32x4(-8192.0f)) & (x <= splat_f32x4(8192.0f));
+    return (ok[0] & ok[1] & ok[2] & ok[3]) != 0;
+}
+
+WEAK f32x4 sin_f32x4(f32x4 x) {
+    if (!in_sin_cos_range(x)) {
+        f32x4 y = {sinf(x[0]), sinf(x[1]), sinf(x[2]), sinf(x[3])};
+        return y;
+    }
+    return sin_cos_f32x4(x, false);
+}
+
+WEAK f32x4 cos_f32x4(f32x4 x) {
+    if (!in_sin_cos_range(x)) {
+        f32x4 y = {cosf(x[0]), cosf(x[1]), cosf(x[2]), cosf(x[3])};
+        return y;
+    }
+    return sin_cos_f32x4(x, true);
+}
+
+// pow(x, y) = exp(y * log(x)), with the sign and special cases
+// patched up afterwards to match powf: negative bases, signed zeros,
+// infinities of either sign, pow(x, 0), pow(1, y) and pow(-1, +-inf)
+// all give what C99 says they should. The error in log is scaled up
+// by y, so this is only good to about 6.2e-6 relative error against
+// pow in double precision, rather than the 1 ulp of the others.
+WEAK f32x4 pow_f32x4(f32x4 x, f32x4 y) {
+    f32x4 zero = splat_f32x4(0.0f), one = splat_f32x4(1.0f);
+    i32x4 sign_bit = splat_i32x4(0x80000000);
+    f32x4 ax = (f32x4)((i32x4)x & ~sign_bit);
+    f32x4 r = exp_f32x4(y * log_f32x4(ax));
+
+    // A negative base works for integer exponents, and flips the
+    // sign of the result when the exponent is odd. We treat
+    // exponents of 2^22 or more as even integers, which only matters
+    // for a base of exactly -1.
+    f32x4 ay = (f32x4)((i32x4)y & ~sign_bit);
+    i32x4 big = ay >= splat_f32x4(4194304.0f);
+    f32x4 half = y * splat_f32x4(0.5f);
+    i32x4 is_int = big | (round_f32x4(y) == y);
+    i32x4 is_odd = ~big & (round_f32x4(half) != half) & is_int;
+    // Only a finite negative base has no real power for a non-integer
+    // exponent; pow(-inf, y) is inf or 0 like pow(inf, y).
+    f32x4 inf = splat_f32x4(INFINITY);
+    i32x4 neg = x < zero;
+    r = (f32x4)((i32x4)r ^ (neg & is_odd & sign_bit));
+    r = select_f32x4(neg & ~is_int & (ax != inf), splat_f32x4(NAN), r);
+
+    // pow(0, y) is 0 or inf depending on the sign of y, with the sign
+    // of the base if y is odd. pow(0, NaN) stays NaN.
+    i32x4 x_zero = (x == zero) & (y == y);
+    f32x4 r0 = select_f32x4(y < zero, inf, zero);
+    r0 = (f32x4)((i32x4)r0 | ((i32x4)x & is_odd & sign_bit));
+    r = select_f32x4(x_zero, r0, r);
+
+    // pow(x, 0) and pow(1, y) are one, even for NaNs. So is pow(-1,
+    // +-inf), where y * log(x) above is inf * 0.
+    i32x4 is_one = (y == zero) | (x == one) | ((ax == one) & (ay == inf));
+    return select_f32x4(is_one, one, r);
+}
+
+#endif
+
 WEAK float floor_f32(float x) {
     return floorf(x);
 }
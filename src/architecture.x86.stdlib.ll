@@ -12,5 +12,90 @@ define weak void @unaligned_store_128(<16 x i8> %arg, i8 * nocapture %ptr) nounw
   ret void
 }
 
+define weak <32 x i8> @unaligned_load_256(i8 * nocapture %ptr) nounwind readonly alwaysinline {
+  %1 = bitcast i8 * %ptr to <32 x i8> *
+  %2 = load <32 x i8>* %1, align 1
+  ret <32 x i8> %2
+}
+
+define weak void @unaligned_store_256(<32 x i8> %arg, i8 * nocapture %ptr) nounwind alwaysinline {
+  %1 = bitcast i8 * %ptr to <32 x i8> *
+  store <32 x i8> %arg, <32 x i8>* %1, align 1
+  ret void
+}
+
+define weak <64 x i8> @unaligned_load_512(i8 * nocapture %ptr) nounwind readonly alwaysinline {
+  %1 = bitcast i8 * %ptr to <64 x i8> *
+  %2 = load <64 x i8>* %1, align 1
+  ret <64 x i8> %2
+}
 
+define weak void @unaligned_store_512(<64 x i8> %arg, i8 * nocapture %ptr) nounwind alwaysinline {
+  %1 = bitcast i8 * %ptr to <64 x i8> *
+  store <64 x i8> %arg, <64 x i8>* %1, align 1
+  ret void
+}
+
+; Vector math. The four-wide versions of everything but sqrt are in
+; architecture.posix.stdlib.cpp; the eight-wide ones run them on each
+; half.
+
+declare <4 x float> @llvm.sqrt.v4f32(<4 x float>) nounwind readnone
+declare <8 x float> @llvm.sqrt.v8f32(<8 x float>) nounwind readnone
+
+define weak <4 x float> @sqrt_f32x4(<4 x float> %x) nounwind readnone alwaysinline {
+  %1 = call <4 x float> @llvm.sqrt.v4f32(<4 x float> %x)
+  ret <4 x float> %1
+}
 
+define weak <8 x float> @sqrt_f32x8(<8 x float> %x) nounwind readnone alwaysinline {
+  %1 = call <8 x float> @llvm.sqrt.v8f32(<8 x float> %x)
+  ret <8 x float> %1
+}
+
+define weak <8 x float> @exp_f32x8(<8 x float> %x) nounwind readnone alwaysinline {
+  %lo = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 0, i32 1, i32 2, i32 3>
+  %hi = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 4, i32 5, i32 6, i32 7>
+  %1 = call <4 x float> @exp_f32x4(<4 x float> %lo)
+  %2 = call <4 x float> @exp_f32x4(<4 x float> %hi)
+  %3 = shufflevector <4 x float> %1, <4 x float> %2, <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>
+  ret <8 x float> %3
+}
+
+define weak <8 x float> @log_f32x8(<8 x float> %x) nounwind readnone alwaysinline {
+  %lo = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 0, i32 1, i32 2, i32 3>
+  %hi = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 4, i32 5, i32 6, i32 7>
+  %1 = call <4 x float> @log_f32x4(<4 x float> %lo)
+  %2 = call <4 x float> @log_f32x4(<4 x float> %hi)
+  %3 = shufflevector <4 x float> %1, <4 x float> %2, <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>
+  ret <8 x float> %3
+}
+
+define weak <8 x float> @sin_f32x8(<8 x float> %x) nounwind readnone alwaysinline {
+  %lo = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 0, i32 1, i32 2, i32 3>
+  %hi = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 4, i32 5, i32 6, i32 7>
+  %1 = call <4 x float> @sin_f32x4(<4 x float> %lo)
+  %2 = call <4 x float> @sin_f32x4(<4 x float> %hi)
+  %3 = shufflevector <4 x float> %1, <4 x float> %2, <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>
+  ret <8 x float> %3
+}
+
+define weak <8 x float> @cos_f32x8(<8 x float> %x) nounwind readnone alwaysinline {
+  %lo = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 0, i32 1, i32 2, i32 3>
+  %hi = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 4, i32 5, i32 6, i32 7>
+  %1 = call <4 x float> @cos_f32x4(<4 x float> %lo)
+  %2 = call <4 x float> @cos_f32x4(<4 x float> %hi)
+  %3 = shufflevector <4 x float> %1, <4 x float> %2, <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>
+  ret <8 x float> %3
+}
+
+define weak <8 x float> @pow_f32x8(<8 x float> %x, <8 x float> %y) nounwind readnone alwaysinline {
+  %xlo = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 0, i32 1, i32 2, i32 3>
+  %xhi = shufflevector <8 x float> %x, <8 x float> undef, <4 x i32> <i32 4, i32 5, i32 6, i32 7>
+  %ylo = shufflevector <8 x float> %y, <8 x float> undef, <4 x i32> <i32 0, i32 1, i32 2, i32 3>
+  %yhi = shufflevector <8 x float> %y, <8 x float> undef, <4 x i32> <i32 4, i32 5, i32 6, i32 7>
+  %1 = call <4 x float> @pow_f32x4(<4 x float> %xlo, <4 x float> %ylo)
+  %2 = call <4 x float> @pow_f32x4(<4 x float> %xhi, <4 x float> %yhi)
+  %3 = shufflevector <4 x float> %1, <4 x float> %2, <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>
+  ret <8 x float> %3
+}
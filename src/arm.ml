@@ -403,7 +403,7 @@ let rec cg_stmt (con : context) (stmt : stmt) =
 (* Same as X86 code for malloc / free. TODO: make a posix/cpu arch module? *)
 let free (con : context) (name:string) (address:llvalue) =
   let c = con.c and b = con.b and m = con.m in
-  let free = declare_function "fast_free" (function_type (void_type c) [|pointer_type (i8_type c)|]) m in
+  let free = declare_function "halide_scratch_free" (function_type (void_type c) [|pointer_type (i8_type c)|]) m in
   ignore (build_call free [|address|] "" b)
 
 let malloc (con : context) (name : string) (elems : expr) (elem_size : expr) =
@@ -421,7 +421,7 @@ let malloc (con : context) (name : string) (elems : expr) (elem_size : expr) =
         let ptr = build_pointercast ptr (pointer_type (i8_type c)) "" b in
         (ptr, fun _ -> ())
     | _ -> 
-        let malloc = declare_function "fast_malloc" (function_type (pointer_type (i8_type c)) [|i32_type c|]) m in  
+        let malloc = declare_function "halide_scratch_alloc" (function_type (pointer_type (i8_type c)) [|i32_type c|]) m in  
         let size = Constant_fold.constant_fold_expr (Cast (Int 32, elems *~ elem_size)) in
         let addr = build_call malloc [|con.cg_expr size|] name b in
         (addr, fun con -> free con name addr)
@@ -31,7 +31,16 @@ let check_result expr result =
   ()
 
 
-let is_monotonic = function
+(* The vectorizer calls <name>x4 or <name>x8 for some float math
+   functions. Bounds are scalar, so map those back to the scalar
+   function. *)
+let scalar_function f =
+  let n = String.length f in
+  if n > 6 && (String.sub f (n-6) 6 = "_f32x4" || String.sub f (n-6) 6 = "_f32x8") then
+    String.sub f 0 (n-2)
+  else f
+
+let is_monotonic f = match scalar_function f with
   | ".floor_f32"
   | ".ceil_f32"
   | ".sqrt_f32"
@@ -312,6 +321,7 @@ let bounds_of_expr_in_env env expr =
           
       (* Unary monotonic built-ins *)
       | Call (t, f, [arg]) when is_monotonic f ->
+          let t = element_val_type t and f = scalar_function f in
           begin match (recurse arg) with 
             | Range (min, max) ->
                 make_range (Call (t, f, [min]),
@@ -320,7 +330,8 @@ let bounds_of_expr_in_env env expr =
           end
              
       (* Trig built-ins *)
-      | Call (t, f, [arg]) when f = ".sin" || f = ".cos" -> 
+      | Call (t, f, [arg]) when List.mem (scalar_function f) [".sin_f32"; ".cos_f32"] ->
+          let t = element_val_type t in
           Range ((make_zero t) -~ (make_one t), make_one t)                  
 
       | Call (t, _, _) -> bounds_of_type t
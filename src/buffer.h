@@ -10,7 +10,10 @@ typedef struct buffer_t {
     bool dev_dirty;
     size_t dims[4];
     size_t elem_size;
-    // TODO: strides
+    // Strides are in elements, not bytes. host points to the element
+    // at coordinates (min[0], min[1], ...).
+    int32_t stride[4];
+    int32_t min[4];
 } buffer_t;
 
 #endif //_BUFFER_T
@@ -56,11 +56,17 @@ let cg_entry e =
     | Buffer(n) -> (cname n, C.Ptr buffer_t)
   in
 
-  let syms_of_buf b = [C.Arrow  ((C.ID (cname b)), "host");
-                       C.Access (C.Arrow ((C.ID (cname b)), "dims"), C.IntConst 0);
-                       C.Access (C.Arrow ((C.ID (cname b)), "dims"), C.IntConst 1);
-                       C.Access (C.Arrow ((C.ID (cname b)), "dims"), C.IntConst 2);
-                       C.Access (C.Arrow ((C.ID (cname b)), "dims"), C.IntConst 3)]
+  let syms_of_buf b =
+    let field f = List.map
+      (fun i -> C.Access (C.Arrow ((C.ID (cname b)), f), C.IntConst i))
+      [0; 1; 2; 3]
+    in
+    let host = C.Arrow ((C.ID (cname b)), "host") in
+    let misalignment =
+      C.Cast (C.Int (C.IInt, C.Signed),
+              C.Infix (C.Cast (C.Int (C.Long, C.Unsigned), host), C.Mod, C.IntConst 64))
+    in
+    host :: (field "dims") @ (field "stride") @ (field "min") @ [misalignment]
   in
 
   let carg_vals = function
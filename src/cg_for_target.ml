@@ -19,6 +19,69 @@ let target =
     | "armv7l" -> ARM
     | arch -> Printf.eprintf "`%s` is not a supported arch\n%!" arch; exit (-1) end
 
+let target_name = match target with
+  | X86_64 -> "x86_64"
+  | PTX -> "ptx"
+  | ARM -> "arm"
+
+let split_features str = Str.split (Str.regexp "[-, ]+") (String.lowercase str)
+
+(* HL_X86_FEATURES overrides whatever we would otherwise target *)
+let features_from_env () =
+  try Some (split_features (Sys.getenv "HL_X86_FEATURES")) with Not_found -> None
+
+(* Jitted code targets the cpu we're running on *)
+let use_host_target () =
+  if target = X86_64 then
+    X86.set_target_features (match features_from_env () with
+      | Some features -> features
+      | None -> split_features (Llutil.host_cpu_features ()))
+
+(* Code compiled to a file targets an explicit target string, made of
+   the arch and then the extensions to use, separated by dashes
+   (e.g. "x86_64-avx2-fma"). The arch alone, or an empty string, means
+   the baseline for the arch. *)
+let use_target_string str =
+  match split_features str with
+    | [] ->
+        if target = X86_64 then
+          X86.set_target_features (match features_from_env () with
+            | Some features -> features
+            | None -> [])
+    | arch::features ->
+        let arch_ok = match (target, arch) with
+          | (X86_64, ("x86_64" | "amd64" | "i386")) -> true
+          | (PTX, "ptx") -> true
+          | (ARM, ("arm" | "armv7l")) -> true
+          | _ -> false
+        in
+        if not arch_ok then
+          failwith ("Target " ^ str ^ " doesn't match the arch we're compiling for: " ^ target_name);
+        if target = X86_64 then X86.set_target_features features
+        else if features <> [] then
+          failwith ("Target " ^ str ^ ": only x86 takes instruction set extensions")
+
+(* The width in bytes of the vector registers we're targeting *)
+let natural_vector_bytes () = match target with
+  | X86_64 -> if X86.has_feature "avx512f" then 64 else if X86.has_feature "avx" then 32 else 16
+  | ARM -> 16
+  | PTX -> 0
+
+(* A digest of the runtime linked into the code we generate for the
+   target, so that code cached by a build with a different runtime
+   isn't reused *)
+let runtime_digest = lazy (
+  let archs = match target with
+    | X86_64 -> ["x86"]
+    | PTX -> ["ptx"; "ptx_dev"]
+    | ARM -> ["arm"]
+  in
+  Digest.to_hex (Digest.string (String.concat "" (List.map Stdlib.runtime_bitcode archs))))
+
+(* A description of the target including the extensions in use *)
+let target_description () =
+  String.concat "-" (target_name :: (if target = X86_64 then !X86.target_features else []))
+
 let codegen_entry,
     codegen_c_wrapper,
     codegen_to_bitcode_and_header,
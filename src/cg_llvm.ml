@@ -51,11 +51,53 @@ module type Codegen = sig
   val codegen_to_file : entrypoint -> string -> unit
 end
 
+(* If HL_PROFILE is set, the generated code times each stage and each
+   parallel loop by calling into the runtime (see halide_profile_enter
+   in architecture.posix.stdlib.cpp), if the runtime can do that. *)
+let profiling =
+  try Sys.getenv "HL_PROFILE" <> "0" with Not_found -> false
+
+let profiling_in_module m =
+  profiling && lookup_function "halide_profile_enter" m <> None
+
+(* A pointer to a stage name for the profiler. There's one copy of each
+   name per module. *)
+let cg_profile_name c m b name =
+  let global_name = "profile_name." ^ name in
+  let global = match lookup_global global_name m with
+    | Some g -> g
+    | None ->
+        let g = define_global global_name (const_stringz c name) m in
+        set_linkage Llvm.Linkage.Internal g;
+        g in
+  build_pointercast global (pointer_type (i8_type c)) "" b
+
+(* Start timing a stage that allocates some number of bytes, if we're
+   profiling. Returns the token to stop timing it with. *)
+let cg_profile_enter c m b name bytes parallel =
+  if profiling_in_module m then begin
+    let enter = declare_function "halide_profile_enter"
+      (function_type (i32_type c) [|pointer_type (i8_type c); i64_type c; i32_type c|]) m in
+    let parallel = const_int (i32_type c) (if parallel then 1 else 0) in
+    Some (build_call enter [|cg_profile_name c m b name; bytes (); parallel|] "" b)
+  end else None
+
+let cg_profile_exit c m b = function
+  | Some token ->
+      let exit = declare_function "halide_profile_exit"
+        (function_type (void_type c) [|i32_type c|]) m in
+      ignore (build_call exit [|token|] "" b)
+  | None -> ()
+
 module CodegenForArch ( Arch : Architecture ) = struct
 
 type arch_state = Arch.state
 type context = arch_state cg_context
 
+(* The entrypoint being generated, and the token for its profiling
+   frame, which has to be closed if an assertion bails out *)
+let entry_profile_token = ref None
+
 (* Algebraic type wrapper for LLVM comparison ops *)
 type cmp =
   | CmpInt of Icmp.t
@@ -120,6 +162,10 @@ let rec make_cg_context c m b sym_table arch_state =
     | Bop (Add, l, r) -> cg_binop build_add  build_add  build_fadd l r
     | Bop (Sub, l, r) -> cg_binop build_sub  build_sub  build_fsub l r
     | Bop (Mul, l, r) -> cg_binop build_mul  build_mul  build_fmul l r
+    | Bop (Div, l, r) when const_divisor (val_type_of_expr l) r <> None ->
+        cg_div_mod_by_const false l r
+    | Bop (Mod, l, r) when const_divisor (val_type_of_expr l) r <> None ->
+        cg_div_mod_by_const true l r
     | Bop (Div, l, r) -> cg_binop build_sdiv build_udiv build_fdiv l r
     | Bop (Min, l, r) -> cg_minmax Min l r
     | Bop (Max, l, r) -> cg_minmax Max l r
@@ -236,6 +282,12 @@ let rec make_cg_context c m b sym_table arch_state =
       | Float _ | FloatVector(_,_) -> fop
     in build (cg_expr l) (cg_expr r) "" b
 
+  and cg_div_mod_by_const is_mod l r =
+    let t = val_type_of_expr l in
+    let d = match const_divisor t r with Some d -> d | None -> assert false in
+    let signed = match element_val_type t with Int _ -> true | _ -> false in
+    build_div_mod_by_const build_mulhi signed is_mod (cg_expr l) d b
+
   and cg_mod l r =
     match val_type_of_expr l with
       | Float _ | FloatVector (_, _) -> build_frem (cg_expr l) (cg_expr r) "" b
@@ -388,10 +440,14 @@ let rec make_cg_context c m b sym_table arch_state =
       let preheader_bb = insertion_block b in
       let the_function = block_parent preheader_bb in
       let loop_bb = append_block c (var_name ^ "_loop") the_function in
+      let after_bb = append_block c (var_name ^ "_afterloop") the_function in
 
-      (* Insert an explicit fall through from the current block to the
-       * loop_bb. *)
-      ignore (build_br loop_bb b);
+      (* The end condition is only tested after the body, so skip
+       * straight past the loop if it runs zero times. Lowering relies
+       * on this for loops whose extent can be zero: tails of split
+       * loops, partitioned loops, sliding windows that don't move. *)
+      let enter = build_icmp Icmp.Sgt size (const_int (type_of size) 0) "" b in
+      ignore (build_cond_br enter loop_bb after_bb b);
 
       (* Start insertion in loop_bb. *)
       position_at_end loop_bb b;
@@ -414,9 +470,7 @@ let rec make_cg_context c m b sym_table arch_state =
       (* Compute the end condition. *)
       let end_cond = build_icmp Icmp.Ne next_var max "" b in
 
-      (* Create the "after loop" block and insert it. *)
       let loop_end_bb = insertion_block b in
-      let after_bb = append_block c (var_name ^ "_afterloop") the_function in
 
       (* Insert the conditional branch into the end of loop_end_bb. *)
       ignore (build_cond_br end_cond loop_bb after_bb b);
@@ -491,15 +545,30 @@ let rec make_cg_context c m b sym_table arch_state =
     set_value_name var_name (param body_fn 0);
     Hashtbl.add sub_sym_table var_name (param body_fn 0);
 
-    (* Generate the function body *)
+    (* Generate the function body, timing it if we're profiling *)
+    let profile_start =
+      if profiling_in_module m then
+        Some (build_call (declare_function "halide_profile_iteration_begin"
+                            (function_type (i64_type c) [||]) m) [||] "" sub_builder)
+      else None in
     ignore (sub_context.cg_stmt body);
+    begin match profile_start with
+      | Some start ->
+          let iteration_end = declare_function "halide_profile_iteration_end"
+            (function_type (void_type c) [|pointer_type (i8_type c); i64_type c|]) m in
+          let name = cg_profile_name c m sub_builder var_name in
+          ignore (build_call iteration_end [|name; start|] "" sub_builder)
+      | None -> ()
+    end;
     ignore (build_ret_void sub_builder);
 
     (* Call do_par_for back in the main function *)
     let do_par_for = declare_function "do_par_for"
       (function_type (void_type c) [|pointer_type body_fn_type; int_imm_t; int_imm_t; buffer_t|]) m in
     let closure = build_pointercast closure buffer_t "" b in
+    let token = cg_profile_enter c m b var_name (fun _ -> const_int (i64_type c) 0) true in
     ignore(build_call do_par_for [|body_fn; min; size; closure|] "" b);
+    cg_profile_exit c m b token;
 
     (* Free the closure *)
     cleanup_closure cg_context;
@@ -517,7 +586,7 @@ let rec make_cg_context c m b sym_table arch_state =
         cg_stmt (Block (second::rest))
     | Block (first::[]) ->
         cg_stmt first
-    | Block _ -> failwith "cg_stmt of empty block"
+    | Block [] -> const_int int_imm_t 0
 
     | LetStmt (name, value, stmt) ->
         sym_add name (cg_expr value);
@@ -534,7 +603,11 @@ let rec make_cg_context c m b sym_table arch_state =
         (* push the symbol environment *)
         sym_add name scratch;
 
+        let bytes _ = cg_expr (Constant_fold.constant_fold_expr
+                                 (Cast (Int 64, size) *~ Cast (Int 64, elem_size))) in
+        let token = cg_profile_enter c m b name bytes false in
         ignore (cg_stmt produce);
+        cg_profile_exit c m b token;
         let res = cg_stmt consume in
 
         (* pop the symbol environment *)
@@ -615,6 +688,11 @@ let rec make_cg_context c m b sym_table arch_state =
           | _ -> cg_gather t buf idx
         end          
 
+  (* Aligned loads and stores don't give an alignment, so LLVM assumes
+     the natural alignment of the vector type. The index is a multiple
+     of the vector width, so that holds as long as the buffer's host
+     pointer is aligned. Lowering only leaves dense ramps into input
+     and output buffers when it is (see lower_function). *)
   and cg_aligned_load t buf idx =
     build_load (cg_memref t buf idx) "" b
 
@@ -718,6 +796,11 @@ let rec make_cg_context c m b sym_table arch_state =
       (function_type (void_type c) [|pointer_type (i8_type c)|]) m in
     ignore(build_call ll_halide_error [|msg|] "" b);
 
+    begin match !entry_profile_token with
+      | Some (f, token) when f == the_function -> cg_profile_exit c m b (Some token)
+      | _ -> ()
+    end;
+
     (* Right now all asserts are preconditions in the preamble to the
        function, so there are no allocations to clean up *)
     ignore (build_ret_void b);
@@ -750,9 +833,15 @@ let cg_entry c m e =
   (* start codegen at entry block of main *)
   let b = builder_at_end c (entry_block f) in
 
-  (* actually generate from the root statement *)
+  (* actually generate from the root statement, timing the whole thing
+     if we're profiling *)
   let ctx = make_cg_context c m b param_syms (Arch.start_state ()) in
+  let name,_,_ = e in
+  let token = cg_profile_enter c m b name (fun _ -> const_int (i64_type c) 0) false in
+  entry_profile_token := (match token with Some t -> Some (f, t) | None -> None);
   ignore (Arch.cg_stmt ctx stmt);
+  entry_profile_token := None;
+  cg_profile_exit c m b token;
 
   (* return void from main *)
   ignore (build_ret_void b);
@@ -8,6 +8,9 @@ exception UnalignedVectorMemref
 exception ArgExprOfBufferArgument
 exception ArgTypeMismatch of Ir.val_type * Ir.val_type
 
+(* Whether HL_PROFILE asks for the generated code to time its stages *)
+val profiling : bool
+
 (* These are not parallel, because Architecture overrides module/context used by cg_entry
  * TODO: make parallel? *)
 type cg_entry = llcontext -> llmodule -> entrypoint -> llvalue
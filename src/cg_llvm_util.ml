@@ -85,21 +85,36 @@ let cg_buffer_field bufptr field b =
       b
   in
   match field with
-    | Dim _ | ElemSize -> toi32 raw b
+    | Dim _ | ElemSize | Stride _ | Min _ -> toi32 raw b
     | HostPtr | DevPtr | HostDirty | DevDirty -> raw
 
 (* codegen an llvalue which loads buf->dim[i] *)
 let cg_buffer_dim bufptr dim b =
   cg_buffer_field bufptr (Dim dim) b
 
+(* codegen an llvalue which loads buf->stride[i] *)
+let cg_buffer_stride bufptr dim b =
+  cg_buffer_field bufptr (Stride dim) b
+
+(* codegen an llvalue which loads buf->min[i] *)
+let cg_buffer_min bufptr dim b =
+  cg_buffer_field bufptr (Min dim) b
+
 (* codegen an llvalue which loads buf->host *)
 let cg_buffer_host_ptr bufptr b =
   cg_buffer_field bufptr HostPtr b
 
+(* codegen an llvalue which is how many bytes buf->host is past a
+   64-byte boundary *)
+let cg_buffer_host_misalignment bufptr b =
+  let i64_t = i64_type (context_of_val bufptr) in
+  let host = build_ptrtoint (cg_buffer_host_ptr bufptr b) i64_t "" b in
+  toi32 (build_and host (const_int i64_t 63) "" b) b
+
 (* map an Ir.arg to an ordered list of types for its constituent Var parts *)
 let types_of_arg_vars c = function
   | Scalar (_, vt) -> [type_of_val_type c vt]
-  | Buffer _ -> [raw_buffer_t c; i32_type c; i32_type c; i32_type c; i32_type c]
+  | Buffer _ -> raw_buffer_t c :: (Array.to_list (Array.make 13 (i32_type c)))
 
 let arg_var_types c arglist = List.flatten (List.map (types_of_arg_vars c) arglist)
 
@@ -107,11 +122,12 @@ let arg_var_types c arglist = List.flatten (List.map (types_of_arg_vars c) argli
  * exploded arg Var values *)
 let vals_of_arg_vars b = function
   | Buffer _, param ->
-      [cg_buffer_host_ptr param b;
-       cg_buffer_dim param 0 b;
-       cg_buffer_dim param 1 b;
-       cg_buffer_dim param 2 b;
-       cg_buffer_dim param 3 b]
+      let dims = [0; 1; 2; 3] in
+      (cg_buffer_host_ptr param b) ::
+        (List.map (fun i -> cg_buffer_dim param i b) dims) @
+        (List.map (fun i -> cg_buffer_stride param i b) dims) @
+        (List.map (fun i -> cg_buffer_min param i b) dims) @
+        [cg_buffer_host_misalignment param b]
   | _, param -> [param]
 
 (*
@@ -228,3 +244,147 @@ let save_bc_to_file m fname =
     | false -> raise (BCWriteFailed fname)
     | true -> ()
   end
+
+(* Integer division and modulo by a constant, lowered to a multiply by
+   a magic number and some shifts, after Granlund and Montgomery,
+   "Division by Invariant Integers using Multiplication". The result is
+   exact for every numerator. Division truncates for signed types, and
+   modulo is always in the range of the divisor, to match cg_mod. *)
+
+type div_method =
+  | DivShift of int         (* power of two: shift right *)
+  | DivMul of int * int     (* (mulhi x m) >> s *)
+  | DivMulAdd of int * int  (* m needs one more bit than the type has *)
+
+(* The constant value of an expression, looking through broadcasts and
+   casts that don't change it *)
+let rec const_int_of_expr = function
+  | IntImm i | UIntImm i -> Some i
+  | Broadcast (e, _) -> const_int_of_expr e
+  | Cast (Int bits, e) -> begin match const_int_of_expr e with
+      | Some i when i >= -(1 lsl (bits-1)) && i < (1 lsl (bits-1)) -> Some i
+      | _ -> None
+    end
+  | Cast (UInt bits, e) -> begin match const_int_of_expr e with
+      | Some i when i >= 0 && i < (1 lsl bits) -> Some i
+      | _ -> None
+    end
+  | _ -> None
+
+(* The divisor, if dividing a value of type t by r can be done this way *)
+let const_divisor t r =
+  match (element_val_type t, const_int_of_expr r) with
+    | (UInt bits, Some d) when bits <= 32 && d >= 2 -> Some d
+    | (Int bits, Some d) when bits <= 32 && (d >= 2 || d <= -2) -> Some d
+    | _ -> None
+
+(* floor (2^p / d) and the remainder. The quotients we need fit in one
+   more bit than the type, but 2^p may not fit in an ocaml int *)
+let div_pow2 p d =
+  let rec step i q r =
+    if i = p then (q, r) else
+      if 2*r >= d then step (i+1) (2*q+1) (2*r-d) else step (i+1) (2*q) (2*r)
+  in step 0 0 1
+
+let ceil_log2 d =
+  let rec find l = if 1 lsl l >= d then l else find (l+1) in find 0
+
+let is_power_of_two d = d > 0 && d land (d-1) = 0
+
+let unsigned_div_method bits d =
+  let l = ceil_log2 d in
+  if is_power_of_two d then DivShift l else
+    (* Look for the smallest shift for which a magic number that fits
+       in the type is exact *)
+    let rec search p =
+      if p = bits + l then
+        let (q, _) = div_pow2 (bits + l) d in
+        DivMulAdd (q - (1 lsl bits) + 1, l - 1)
+      else
+        let (q, r) = div_pow2 p d in
+        if q + 1 < 1 lsl bits && d - r <= 1 lsl (p - bits) then
+          DivMul (q + 1, p - bits)
+        else search (p+1)
+    in search bits
+
+(* For the magnitude of a signed divisor *)
+let signed_div_method bits d =
+  let l = ceil_log2 d in
+  if is_power_of_two d then DivShift l else
+    let rec search p =
+      if p = bits + l then
+        let (q, _) = div_pow2 (bits + l - 1) d in
+        DivMulAdd (q + 1 - (1 lsl bits), l - 1)
+      else
+        let (q, r) = div_pow2 p d in
+        if q + 1 < 1 lsl (bits-1) && d - r <= 1 lsl (p - bits + 1) then
+          DivMul (q + 1, p - bits)
+        else search (p+1)
+    in search bits
+
+(* A constant of type t, which may be a vector *)
+let const_splat t v =
+  match classify_type t with
+    | TypeKind.Vector ->
+        const_vector (Array.make (vector_size t) (const_int (element_type t) v))
+    | _ -> const_int t v
+
+(* The high half of the product of x and y, by multiplying at double
+   width *)
+let build_mulhi signed x y b =
+  let t = type_of x in
+  let bits = integer_bitwidth (match classify_type t with
+    | TypeKind.Vector -> element_type t
+    | _ -> t) in
+  let wide_elem_t = integer_type (type_context t) (2*bits) in
+  let wide_t = match classify_type t with
+    | TypeKind.Vector -> vector_type wide_elem_t (vector_size t)
+    | _ -> wide_elem_t in
+  let ext = if signed then build_sext else build_zext in
+  let shr = if signed then build_ashr else build_lshr in
+  let prod = build_mul (ext x wide_t "" b) (ext y wide_t "" b) "" b in
+  build_trunc (shr prod (const_splat wide_t bits) "" b) t "" b
+
+(* x / d or x % d. mulhi signed x m b gives the high half of x * m;
+   targets with a native multiply-high can pass their own *)
+let build_div_mod_by_const mulhi signed is_mod x d b =
+  let t = type_of x in
+  let bits = integer_bitwidth (match classify_type t with
+    | TypeKind.Vector -> element_type t
+    | _ -> t) in
+  let k = const_splat t in
+  let shr build x s = if s = 0 then x else build x (k s) "" b in
+  let lshr = shr build_lshr and ashr = shr build_ashr in
+  let add x y = build_add x y "" b and sub x y = build_sub x y "" b in
+  let remainder q = sub x (build_mul q (k d) "" b) in
+  if not signed then
+    match unsigned_div_method bits d with
+      | DivShift _ when is_mod -> build_and x (k (d-1)) "" b
+      | DivShift s -> lshr x s
+      | DivMul (m, s) ->
+          let q = lshr (mulhi false x (k m) b) s in
+          if is_mod then remainder q else q
+      | DivMulAdd (m, s) ->
+          let hi = mulhi false x (k m) b in
+          let q = lshr (add hi (lshr (sub x hi) 1)) s in
+          if is_mod then remainder q else q
+  else if is_mod && d > 0 && is_power_of_two d then
+    build_and x (k (d-1)) "" b
+  else
+    let sign = ashr x (bits-1) in
+    let q = match signed_div_method bits (abs d) with
+      | DivShift s ->
+          (* Round towards zero by adding d-1 to negative numerators *)
+          ashr (add x (lshr sign (bits - s))) s
+      | DivMul (m, s) ->
+          sub (ashr (mulhi true x (k m) b) s) sign
+      | DivMulAdd (m, s) ->
+          sub (ashr (add x (mulhi true x (k m) b)) s) sign
+    in
+    let q = if d < 0 then build_neg q "" b else q in
+    if not is_mod then q else
+      (* The truncated remainder has the sign of x. Add d if that's
+         not the sign of d. *)
+      let r = remainder q in
+      let wrong_sign = if d > 0 then ashr r (bits-1) else ashr (build_neg r "" b) (bits-1) in
+      add r (build_and wrong_sign (k d) "" b)
@@ -12,6 +12,8 @@ type buffer_field =
   | DevDirty
   | Dim of int
   | ElemSize
+  | Stride of int
+  | Min of int
 
 let string_of_buffer_field = function
   | HostPtr -> "host"
@@ -20,6 +22,8 @@ let string_of_buffer_field = function
   | DevDirty -> "dev_dirty"
   | Dim dim -> "dim." ^ (string_of_int dim)
   | ElemSize -> "elem_size"
+  | Stride dim -> "stride." ^ (string_of_int dim)
+  | Min dim -> "min." ^ (string_of_int dim)
 
 let buffer_field_offset = function
   | HostPtr ->   [ 0 ]
@@ -28,11 +32,16 @@ let buffer_field_offset = function
   | DevDirty ->  [ 3 ]
   | Dim dim ->   [ 4; dim ]
   | ElemSize ->  [ 5 ]
+  | Stride dim -> [ 6; dim ]
+  | Min dim ->   [ 7; dim ]
 
 (* map an Ir.arg to an ordered list of names for its constituent Var parts *)
 let names_of_arg_vars = function
   | Scalar (n, _) -> [n]
-  | Buffer n -> [n; n ^ ".dim.0"; n ^ ".dim.1"; n ^ ".dim.2"; n ^ ".dim.3"]
+  | Buffer n -> [n; n ^ ".dim.0"; n ^ ".dim.1"; n ^ ".dim.2"; n ^ ".dim.3";
+                n ^ ".stride.0"; n ^ ".stride.1"; n ^ ".stride.2"; n ^ ".stride.3";
+                n ^ ".min.0"; n ^ ".min.1"; n ^ ".min.2"; n ^ ".min.3";
+                n ^ ".host_misalignment"]
 
 let arg_var_names arglist = List.flatten (List.map names_of_arg_vars arglist)
 
@@ -73,6 +82,8 @@ let codegen_c_header e header_file =
      "  bool dev_dirty;";
      "  size_t dims[4];";
      "  size_t elem_size;";
+     "  int32_t stride[4];";
+     "  int32_t min[4];";
      "} buffer_t;";
      "#endif";
      "";
@@ -82,6 +93,23 @@ let codegen_c_header e header_file =
      "";
      "void " ^ object_name ^ "(" ^ arg_string ^ ");";
      "";
+     "#ifndef halide_thread_pool_api_defined";
+     "#define halide_thread_pool_api_defined";
+     "void halide_set_num_threads(int n);";
+     "int halide_get_num_threads();";
+     "void halide_shutdown_thread_pool();";
+     "int halide_set_thread_affinity(const int *cpus, int count);";
+     "int halide_set_thread_numa_node(int node);";
+     "void halide_thread_pool_stats(int *num_threads, int *busy_threads, int *queued_iterations);";
+     "void halide_scratch_stats(size_t *bytes_requested, size_t *bytes_reused);";
+     "#endif";
+     "";
+     "#ifndef halide_profile_api_defined";
+     "#define halide_profile_api_defined";
+     "void halide_profile_report();";
+     "void halide_profile_reset();";
+     "#endif";
+     "";
      "#ifdef __cplusplus";
      "}";
      "#endif";
@@ -11,6 +11,11 @@ extern "C" {
 
 #include <iostream>
 #include <sstream>
+#include <string>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 #include <llvm-c/Core.h>
 
@@ -137,4 +142,50 @@ CAMLprim value compile_module_to_string(LLVMModuleRef modref) {
 #endif //disable on ARM
 }
 
+// The instruction set extensions of the host cpu (that the OS also
+// supports) as a comma-separated list, using the same names as target
+// strings, e.g. "sse41,avx,avx2"
+CAMLprim value host_cpu_features(value unit) {
+    std::string features;
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        bool sse41 = ecx & (1 << 19);
+        bool fma = ecx & (1 << 12);
+        bool avx = ecx & (1 << 28);
+        bool osxsave = ecx & (1 << 27);
+
+        // The OS has to save the wider registers for us to use them
+        unsigned int xcr0 = 0;
+        if (osxsave) {
+            unsigned int xcr0_hi;
+            __asm__ __volatile__ ("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+        }
+        bool ymm_state = (xcr0 & 0x6) == 0x6;
+        bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+
+        bool avx2 = false, avx512f = false, avx512bw = false;
+        if (__get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            avx2 = ebx & (1 << 5);
+            avx512f = ebx & (1 << 16);
+            avx512bw = ebx & (1 << 30);
+        }
+
+        if (sse41) features += "sse41,";
+        if (avx && ymm_state) {
+            features += "avx,";
+            if (fma) features += "fma,";
+            if (avx2) features += "avx2,";
+            if (avx512f && zmm_state) {
+                features += "avx512f,";
+                if (avx512bw) features += "avx512bw,";
+            }
+        }
+        if (!features.empty()) features.erase(features.size() - 1);
+    }
+#endif
+    return caml_copy_string(features.c_str());
+}
+
 }
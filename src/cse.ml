@@ -0,0 +1,192 @@
+open Ir
+open Analysis
+open Util
+
+(* Common subexpression elimination by global value numbering.
+
+   Inlining pastes a copy of the callee at every call site, so the
+   lowered code for a chain of inlined functions computes the same loads
+   and arithmetic many times over. We number the nodes of each
+   expression bottom-up, so that two subtrees get the same number
+   exactly when they compute the same thing, then rebuild it with the
+   nodes used more than once bound to names in Lets. The value and index
+   of a Store are numbered together, and what they share is bound with
+   LetStmts around it.
+
+   Most Lets already in the expression are seen through: a variable gets
+   the number of the value it's bound to, so the same thing computed
+   inside two inlined calls is shared even though their arguments were
+   bound to the same name. Lets of scalar integers are kept, because
+   constant folding leaves them there on purpose to help the modulus
+   analysis, and anything that refers to their variables stays where it
+   is so that it stays in scope. Nodes are looked up in a table keyed by the node with
+   its children replaced by their numbers, hashed with Hash.hash_expr.
+   Commutative operators are keyed with their children in a canonical
+   order, so a+b and b+a share a number too.
+
+   Only vectors, floats, loads, calls and selects get names. Scalar
+   integer arithmetic is nearly all address computation, which codegen
+   pattern matches (e.g. to tell aligned vector loads and stores from
+   unaligned ones), and LLVM does a fine job of sharing it anyway.
+   Ramps and broadcasts are left where they are for the same reason,
+   and conditions are left inside the selects that the backends
+   recognize them in.
+   Expressions containing Debug nodes are left alone, because merging
+   two of them would print once instead of twice.
+
+   Setting HL_CSE=0 turns this pass off. *)
+
+let enabled = try Sys.getenv "HL_CSE" <> "0" with Not_found -> true
+
+(* Keyed by a numbered node, and whether it's the variable of a Let we
+   kept, which need not mean the same as a variable of the same name
+   elsewhere *)
+module NodeTable = Hashtbl.Make (struct
+  type t = expr * bool
+  let equal = (=)
+  let hash (e, _) = let (h, _, _, _) = Hash.hash_expr e in h land max_int
+end)
+
+(* In the numbered form of a node, each child is a variable standing
+   for its number *)
+let node_prefix = "cse.node."
+
+let node_var t id = Var (t, node_prefix ^ string_of_int id)
+
+let node_id = function
+  | Var (_, n) ->
+      let len = String.length node_prefix in
+      int_of_string (String.sub n len (String.length n - len))
+  | _ -> failwith "Child of a numbered node that isn't a number"
+
+type numbering = {
+  table : int NodeTable.t;
+  (* The numbered form of each node, its type, and the variables of
+     Lets we kept that it refers to *)
+  nodes : (int, expr * val_type * StringSet.t) Hashtbl.t;
+}
+
+let node_of state id = let (node, _, _) = Hashtbl.find state.nodes id in node
+let type_of state id = let (_, t, _) = Hashtbl.find state.nodes id in t
+let free_vars_of state id = let (_, _, free) = Hashtbl.find state.nodes id in free
+
+let children_of node = fold_children_in_expr (fun c -> [node_id c]) (@) [] node
+
+(* The key to look a numbered node up by *)
+let canonical node =
+  let swap a b = node_id a > node_id b in
+  match node with
+    | Bop ((Add | Mul | Min | Max) as op, a, b) when swap a b -> Bop (op, b, a)
+    | Cmp ((EQ | NE) as op, a, b) when swap a b -> Cmp (op, b, a)
+    | And (a, b) when swap a b -> And (b, a)
+    | Or (a, b) when swap a b -> Or (b, a)
+    | _ -> node
+
+(* The number of an expression. lets maps the names bound by enclosing
+   Lets to the numbers of their values, or to None for the Lets we
+   keep. *)
+let rec number state lets expr =
+  let value_of n = try StringMap.find n lets with Not_found -> None in
+  match expr with
+    | Var (_, n) when value_of n <> None -> begin
+        match value_of n with Some id -> id | None -> assert false
+      end
+    | Let (n, a, b) when not (is_scalar a && is_integral a) ->
+        let a = number state lets a in
+        number state (StringMap.add n (Some a) lets) b
+    | _ ->
+        let child lets c = let id = number state lets c in node_var (type_of state id) id in
+        let node = match expr with
+          | Let (n, a, b) -> Let (n, child lets a, child (StringMap.add n None lets) b)
+          | _ -> mutate_children_in_expr (child lets) expr in
+        let kept_var = match node with
+          | Var (_, n) -> StringMap.mem n lets
+          | _ -> false in
+        let key = (canonical node, kept_var) in
+        try NodeTable.find state.table key with Not_found -> begin
+          let free = List.fold_left (fun s c -> StringSet.union s (free_vars_of state c))
+            StringSet.empty (children_of node) in
+          let free = match node with
+            | Var (_, n) when kept_var -> StringSet.add n free
+            | Let (n, a, b) ->
+                StringSet.union (free_vars_of state (node_id a))
+                  (StringSet.remove n (free_vars_of state (node_id b)))
+            | _ -> free in
+          let id = Hashtbl.length state.nodes in
+          Hashtbl.add state.nodes id (node, val_type_of_expr node, free);
+          NodeTable.add state.table key id;
+          id
+        end
+
+(* Is a node worth giving a name if it's used more than once? *)
+let worth_naming state id =
+  let node = node_of state id and t = type_of state id in
+  let rec is_const id = match node_of state id with
+    | Var _ | Load _ | Call _ | Debug _ -> false
+    | node -> List.for_all is_const (children_of node)
+  in
+  match node with
+    | _ when not (StringSet.is_empty (free_vars_of state id)) -> false
+    | IntImm _ | UIntImm _ | FloatImm _ | Var _ | Broadcast _ | Ramp _ | Let _ -> false
+    | _ when element_val_type t = bool1 -> false
+    | Load _ | Call _ | Select _ -> not (is_const id)
+    | _ when is_scalar node && (t = i32 || t = u32) -> false
+    | _ -> not (is_const id)
+
+(* Rebuild the expressions numbered roots. Returns the names to bind,
+   in an order in which each value only refers to names before it, and
+   the rebuilt roots. *)
+let rebuild state roots =
+  (* How many times each node is used, counting each node reachable
+     from the roots once *)
+  let uses = Hashtbl.create 16 in
+  let rec visit id =
+    let n = try Hashtbl.find uses id with Not_found -> 0 in
+    Hashtbl.replace uses id (n+1);
+    if n = 0 then List.iter visit (children_of (node_of state id))
+  in
+  List.iter visit roots;
+
+  let named = Hashtbl.fold (fun id n l ->
+    if n > 1 && worth_naming state id then id::l else l) uses [] in
+  (* Children are numbered before their parents *)
+  let named = List.sort compare named in
+  let names = Hashtbl.create 16 in
+  List.iter (fun id -> Hashtbl.add names id (Printf.sprintf "cse.%d" (Hashtbl.length names))) named;
+
+  let rec build id =
+    try Var (type_of state id, Hashtbl.find names id)
+    with Not_found -> expand id
+  and expand id =
+    mutate_children_in_expr (fun c -> build (node_id c)) (node_of state id)
+  in
+  (List.map (fun id -> (Hashtbl.find names id, expand id)) named, List.map build roots)
+
+let rec contains_debug = function
+  | Debug _ -> true
+  | e -> fold_children_in_expr contains_debug (||) false e
+
+let new_numbering () = {table = NodeTable.create 16; nodes = Hashtbl.create 16}
+
+let cse_expr expr =
+  if contains_debug expr then expr else begin
+    let state = new_numbering () in
+    let root = number state StringMap.empty expr in
+    match rebuild state [root] with
+      | (lets, [e]) -> List.fold_right (fun (n, v) e -> Let (n, v, e)) lets e
+      | _ -> assert false
+  end
+
+let rec cse_stmt stmt =
+  match stmt with
+    | Store (e, buf, idx) when not (contains_debug e || contains_debug idx) ->
+        let state = new_numbering () in
+        let roots = [number state StringMap.empty e; number state StringMap.empty idx] in
+        begin match rebuild state roots with
+          | (lets, [e; idx]) -> List.fold_right (fun (n, v) s -> LetStmt (n, v, s)) lets (Store (e, buf, idx))
+          | _ -> assert false
+        end
+    | _ -> mutate_children_in_stmt cse_expr cse_stmt stmt
+
+let common_subexpression_elimination stmt =
+  if enabled then cse_stmt stmt else stmt
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <caml/mlvalues.h>
 #include <caml/alloc.h>
@@ -136,5 +137,32 @@ extern "C" {
         AddBitcodeToModule(builtins_bitcode_arm, builtins_bitcode_arm_length, llvm::unwrap(ctx), llvm::unwrap(mod));
         return Val_unit;        
     }
+
+    /* string -> string: the runtime bitcode that init_module_<arch> links in */
+    CAMLprim value runtime_bitcode(value arch) {
+        CAMLparam1(arch);
+        CAMLlocal1(result);
+        extern unsigned char builtins_bitcode_x86[], builtins_bitcode_arm[];
+        extern unsigned char builtins_bitcode_ptx[], builtins_bitcode_ptx_dev[];
+        extern int builtins_bitcode_x86_length, builtins_bitcode_arm_length;
+        extern int builtins_bitcode_ptx_length, builtins_bitcode_ptx_dev_length;
+        const char *name = String_val(arch);
+        const unsigned char *bitcode;
+        int length;
+        if (!strcmp(name, "x86")) {
+            bitcode = builtins_bitcode_x86; length = builtins_bitcode_x86_length;
+        } else if (!strcmp(name, "arm")) {
+            bitcode = builtins_bitcode_arm; length = builtins_bitcode_arm_length;
+        } else if (!strcmp(name, "ptx")) {
+            bitcode = builtins_bitcode_ptx; length = builtins_bitcode_ptx_length;
+        } else if (!strcmp(name, "ptx_dev")) {
+            bitcode = builtins_bitcode_ptx_dev; length = builtins_bitcode_ptx_dev_length;
+        } else {
+            caml_failwith("Unknown runtime arch");
+        }
+        result = caml_alloc_string(length);
+        memcpy(String_val(result), bitcode, length);
+        CAMLreturn(result);
+    }
     
 }
@@ -11,9 +11,17 @@ open Schedule
 open Lower
 open Schedule_transforms
 open Util
+open Hash
+
+(* Compiled modules, keyed on the canonicalized entrypoint *)
+module EntrypointTable = Hashtbl.Make (struct
+  type t = entrypoint
+  let equal = (=)
+  let hash e = let (h, _, _, _) = hash_entrypoint e in h land max_int
+end)
 
 let compilation_cache = 
-  Hashtbl.create 16
+  EntrypointTable.create 16
 
 let codegen_to_c_callable e =
   let module Cg = Cg_for_target in
@@ -21,10 +29,28 @@ let codegen_to_c_callable e =
   let w = Cg.codegen_c_wrapper c m f in
   (c,m,w)
 
-let lower (f:string) (env:environment) (sched: schedule_tree) =
+(* Lowered pipelines, keyed on the output, the schedule, and the
+   definitions of everything scheduled, so that realizing a function
+   again after a reset or a redefinition that changes nothing doesn't
+   lower it again. Stages that did change get lowered again, but
+   Lower reuses the ones that didn't. *)
+let lowering_cache = Hashtbl.create 16
+
+(* any_layout is an int from the front-end, non-zero to accept inputs
+   and outputs that aren't dense and aligned (see lower_function) *)
+let lower (f:string) (env:environment) (sched: schedule_tree) (any_layout:int) =
   (* Printexc.record_backtrace true; *)
 
-  lower_function f env sched
+  let any_layout = any_layout <> 0 in
+  let scheduled = List.sort compare (list_of_schedule sched) in
+  let definition n = try Some (find_function n env) with Failure _ -> None in
+  let key = (f, any_layout, List.map (fun n -> (n, find_schedule sched n, definition n)) scheduled) in
+  try Hashtbl.find lowering_cache key with Not_found -> begin
+    let stmt = lower_function f env sched any_layout in
+    if Hashtbl.length lowering_cache > 256 then Hashtbl.clear lowering_cache;
+    Hashtbl.add lowering_cache key stmt;
+    stmt
+  end
 
   (* with x -> begin
     Printf.printf "Compilation failed. Backtrace:\n%s\n%!" (Printexc.get_backtrace ());
@@ -34,28 +60,41 @@ let lower (f:string) (env:environment) (sched: schedule_tree) =
 let serializeEntry name args stmt = Sexplib.Sexp.to_string
                                       (sexp_of_entrypoint (name, args, stmt))
 
+(* A content hash of a lowered entrypoint, the target it will be
+   compiled for, whether it's profiled, and the runtime it will be
+   linked with. Used to key the on-disk JIT cache. *)
+let cache_key name args stmt =
+  let (name, args, stmt) = canonicalize_entrypoint (name, args, stmt) in
+  Cg_for_target.use_host_target ();
+  let target = Cg_for_target.target_description () in
+  let target = if Cg_llvm.profiling then target ^ "-profile" else target in
+  let runtime = Lazy.force Cg_for_target.runtime_digest in
+  Digest.to_hex (Digest.string (target ^ "\n" ^ runtime ^ "\n" ^ serializeEntry name args stmt))
+
 let compile name args stmt =
 
   (* Printexc.record_backtrace true; *)
 
 
-  (* TODO: Canonicalize names. Variables get renamed to v0 v1
-     v2... depending on the order in which they're found, arguments to
-     a0, a1, a2, depending on the order that they occur in the
-     arguments list. This is done to assist hashing. *)
+  (* Look up the canonicalized entrypoint, so that the same pipeline
+     built twice with different names shares compiled code. A hit may
+     return a module compiled under other names, so the caller must
+     use the function returned rather than looking it up by name. *)
 
   try begin
     let func = (name, args, stmt) in
-    if Hashtbl.mem compilation_cache func then begin
+    let key = canonicalize_entrypoint func in
+    if EntrypointTable.mem compilation_cache key then begin
       (* Printf.printf "Found function in cache\n%!";  *)
-      Hashtbl.find compilation_cache func
+      EntrypointTable.find compilation_cache key
     end else begin 
       dbg 2 "Initializing native target\n%!"; 
       ignore (initialize_native_target());
+      Cg_for_target.use_host_target ();
       dbg 2 "Compiling:\n%s to C callable\n%!" (string_of_toplevel func);
       let (c, m, f) = codegen_to_c_callable func in
       (* ignore(Llvm_bitwriter.write_bitcode_file m "generated.bc"); *)
-      Hashtbl.add compilation_cache func (m, f);
+      EntrypointTable.add compilation_cache key (m, f);
 
       (* Log the lowered entrypoint *)
       let out = open_out (name ^ ".sexp") in
@@ -72,7 +111,7 @@ let compile name args stmt =
     raise x
   end
 
-let compile_to_file name args stmt =
+let compile_to_file name args stmt target =
   (* Printexc.record_backtrace true; *)
   
   let backend = try
@@ -86,6 +125,7 @@ let compile_to_file name args stmt =
     | "llvm" ->
         ignore (initialize_native_target());
         let module Cg = Cg_for_target in
+        Cg.use_target_string target;
         Cg.codegen_to_bitcode_and_header (name, args, stmt)
     | "c" ->
         Cg_c.codegen_to_file (name, args, stmt)
@@ -171,6 +211,11 @@ let _ =
     Environment.add name reduce_func env
   );
 
+  Callback.register "addRFactorToDefinition" (fun env name rvar slices (partial, partial_update) (slice, inner) ->
+    Rfactor.rfactor env name rvar slices (partial, partial_update, slice, inner));
+  Callback.register "addVectorizedReductionToDefinition" (fun env name rvar width ((main, main_update), (tail, tail_update)) (lane, inner) ->
+    Rfactor.vectorize_reduction env name rvar width (main, main_update, tail, tail_update, lane, inner));
+
   Callback.register "makeList" (fun _ -> []);
   Callback.register "addToList" (fun l x -> x::l);  
   Callback.register "makePair" (fun x y -> (x, y));
@@ -197,6 +242,7 @@ let _ =
   
   Callback.register "doLower" lower;  
   Callback.register "doCompile" compile;
+  Callback.register "doCacheKey" cache_key;
   Callback.register "doCompileToFile" compile_to_file;
   
   (* Guru transformations. These partially apply the various ml
@@ -205,12 +251,20 @@ let _ =
   Callback.register "makeVectorizeTransform" (fun func var -> vectorize_schedule func var);
   Callback.register "makeUnrollTransform" (fun func var -> unroll_schedule func var);
   Callback.register "makeBoundTransform" (fun func var min size -> bound_schedule func var min size);
-  Callback.register "makeSplitTransform" (fun func var outer inner n -> split_schedule func var outer inner n);
+  Callback.register "makeSplitTransform" (fun func var outer inner n tail -> split_schedule func var outer inner n tail);
   Callback.register "makeTransposeTransform" (fun func var1 var2 -> transpose_schedule func var1 var2);
   Callback.register "makeChunkTransform" (fun func var -> chunk_schedule func var);
+  Callback.register "makeSlideTransform" (fun func var -> slide_schedule func var);
   Callback.register "makeRootTransform" (fun func -> root_schedule func);
   Callback.register "makeParallelTransform" (fun func var -> parallel_schedule func var);  
   Callback.register "makeRandomTransform" (fun func seed -> random_schedule func seed);
+  Callback.register "makeAutoScheduleTransform" (fun func sizes ->
+    if Cg_for_target.target = Cg_for_target.PTX then
+      failwith "The auto-scheduler only makes schedules for CPUs";
+    (* Pick vector widths for the machine we're on, unless a target
+       has already been chosen *)
+    if !X86.target_features = [] then Cg_for_target.use_host_target ();
+    auto_schedule func sizes (Cg_for_target.natural_vector_bytes ()));
 
   Callback.register "serializeExpr" (fun e -> Sexplib.Sexp.to_string (sexp_of_expr e));
   Callback.register "serializeStmt" (fun s -> Sexplib.Sexp.to_string (sexp_of_stmt s));
@@ -1,4 +1,6 @@
 open Ir
+open Analysis
+open Util
 
 (* Assuming a program has 1024 expressions, the probability of a collision using a k-bit hash is roughly:
 
@@ -108,3 +110,117 @@ let rec hash_expr e =
         List.fold_left hash_combine2 
           (hash_combine3 (hash_str "<Debug>") (hash_str fmt) (hash_expr e))
           (List.map hash_expr args)
+
+let rec hash_stmt s =
+  match s with
+    | For (n, min, size, order, body) ->
+        hash_combine4 
+          (hash_combine3 (hash_str "<For>") (hash_str n) (hash_expand order))
+          (hash_expr min) (hash_expr size) (hash_stmt body)
+    | Block l ->
+        List.fold_left hash_combine2 (hash_str "<Block>") (List.map hash_stmt l)
+    | Store (e, b, i) ->
+        hash_combine4 (hash_str "<Store>") (hash_expr e) (hash_str b) (hash_expr i)
+    | Provide (e, f, args) ->
+        List.fold_left hash_combine2 
+          (hash_combine3 (hash_str "<Provide>") (hash_str f) (hash_expr e))
+          (List.map hash_expr args)
+    | Pipeline (b, t, size, produce, consume) ->
+        hash_combine4 
+          (hash_combine3 (hash_str "<Pipeline>") (hash_str b) (hash_type t))
+          (hash_expr size) (hash_stmt produce) (hash_stmt consume)
+    | LetStmt (n, e, s) ->
+        hash_combine4 (hash_str "<LetStmt>") (hash_str n) (hash_expr e) (hash_stmt s)
+    | Print (p, l) ->
+        List.fold_left hash_combine2 
+          (hash_combine2 (hash_str "<Print>") (hash_str p))
+          (List.map hash_expr l)
+    | Assert (e, str) ->
+        hash_combine3 (hash_str "<Assert>") (hash_str str) (hash_expr e)
+
+let hash_arg = function
+  | Scalar (n, t) -> hash_combine3 (hash_str "<Scalar>") (hash_str n) (hash_type t)
+  | Buffer n -> hash_combine2 (hash_str "<Buffer>") (hash_str n)
+
+let hash_entrypoint (name, args, stmt) =
+  List.fold_left hash_combine2 
+    (hash_combine3 (hash_str "<Entrypoint>") (hash_str name) (hash_stmt stmt))
+    (List.map hash_arg args)
+
+(* Alpha-renaming, so that structurally identical entrypoints hash and
+   compare equal. The front-end names things with a letter and a
+   counter (f12, v3, i0, ...), so the same pipeline built twice gets
+   different names. Every such name component is renamed to one the
+   front-end can't produce (f$0, v$1, ...), numbered in the order
+   they're found. Qualified names are renamed a component at a time,
+   so derived names stay consistent with the names they're derived
+   from (.i3.dim.0 goes wherever .i3 goes). Everything else, including
+   extern function names, is left alone. *)
+
+(* The prefixes the front-end passes to uniqueName: funcs, images,
+   uniform images, update steps, reduction domains, uniforms and vars.
+   A user's own names can still look like these (a Func called
+   "f2"), but then they're renamed consistently, which is harmless. *)
+let generated_prefixes = ['f'; 'i'; 'm'; 'p'; 'r'; 'u'; 'v']
+
+let is_generated_name c =
+  let len = String.length c in
+  let rec digits i = i >= len || (c.[i] >= '0' && c.[i] <= '9' && digits (i+1)) in
+  len > 1 && List.mem c.[0] generated_prefixes && digits 1
+
+let canonicalize_entrypoint (name, args, stmt) =
+  let renaming = Hashtbl.create 16 in
+  let rename_component c =
+    if is_generated_name c then
+      try Hashtbl.find renaming c with Not_found ->
+        let c' = (String.make 1 c.[0]) ^ "$" ^ (string_of_int (Hashtbl.length renaming)) in
+        Hashtbl.add renaming c c';
+        c'
+    else c
+  in
+  let rename n = String.concat "." (List.map rename_component (split_name n)) in
+  (* Names also turn up in the text of asserts and prints, next to
+     punctuation (e.g. "f3.x(", "[i2]"), so rename each run of
+     characters that can make up a qualified name *)
+  let rename_words str =
+    let is_name_char ch =
+      (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+      (ch >= '0' && ch <= '9') || ch = '_' || ch = '.' in
+    let len = String.length str in
+    let out = Buffer.create len in
+    let rec scan start i =
+      if i < len && is_name_char str.[i] then scan start (i+1)
+      else begin
+        if i > start then Buffer.add_string out (rename (String.sub str start (i - start)));
+        if i < len then begin
+          Buffer.add_char out str.[i];
+          scan (i+1) (i+1)
+        end
+      end
+    in
+    scan 0 0;
+    Buffer.contents out
+  in
+  let rec canon_expr = function
+    | Var (t, n) -> Var (t, rename n)
+    | Let (n, a, b) -> Let (rename n, canon_expr a, canon_expr b)
+    | Load (t, b, i) -> Load (t, rename b, canon_expr i)
+    | Debug (e, fmt, l) -> Debug (canon_expr e, rename_words fmt, List.map canon_expr l)
+    | e -> mutate_children_in_expr canon_expr e
+  and canon_stmt = function
+    | For (n, min, size, order, body) -> 
+        For (rename n, canon_expr min, canon_expr size, order, canon_stmt body)
+    | Store (e, b, i) -> Store (canon_expr e, rename b, canon_expr i)
+    | Provide (e, f, l) -> Provide (canon_expr e, rename f, List.map canon_expr l)
+    | Pipeline (b, t, size, produce, consume) -> 
+        Pipeline (rename b, t, canon_expr size, canon_stmt produce, canon_stmt consume)
+    | LetStmt (n, e, s) -> LetStmt (rename n, canon_expr e, canon_stmt s)
+    | Print (p, l) -> Print (rename_words p, List.map canon_expr l)
+    | Assert (e, str) -> Assert (canon_expr e, rename_words str)
+    | s -> mutate_children_in_stmt canon_expr canon_stmt s
+  in
+  let canon_arg = function
+    | Scalar (n, t) -> Scalar (rename n, t)
+    | Buffer n -> Buffer (rename n)
+  in
+  (rename name, List.map canon_arg args, canon_stmt stmt)
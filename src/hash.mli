@@ -1 +1,4 @@
 val hash_expr : Ir.expr -> int * int * int * int
+val hash_stmt : Ir.stmt -> int * int * int * int
+val hash_entrypoint : Ir.entrypoint -> int * int * int * int
+val canonicalize_entrypoint : Ir.entrypoint -> Ir.entrypoint
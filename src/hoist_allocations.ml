@@ -0,0 +1,124 @@
+open Ir
+open Analysis
+open Util
+
+(* Convert this structure:
+   For (i, min, n, true,
+     ...
+       Pipeline (buf, ty, size, produce, consume)
+     ...)
+
+   to this:
+
+   Pipeline (buf, ty, max size, Block [],
+     For (i, min, n, true,
+       ...
+         Block [produce; consume]
+       ...))
+
+   so that a scratch buffer allocated once per iteration of a loop is
+   instead allocated once, big enough for the largest iteration. The
+   size may depend on i and on anything bound by a LetStmt inside the
+   loop (bounds inference puts the extents there); we substitute in
+   the lets and take the bounds over the loop range. If the max
+   still refers to something defined inside the loop we leave the
+   allocation where it is.
+
+   Unlike loop_lifting, the pipeline may be buried in blocks, lets, and
+   the produce or consume sides of other pipelines, but not in an inner
+   loop - those have already been visited, so anything that could move
+   out of them has moved as far as this loop already.
+
+   We only lift out of serial loops. Each iteration of a parallel loop
+   may run on a different thread, so they each need their own buffer.
+   GPU pipelines are left alone entirely, because the PTX backend
+   tracks which side owns a buffer by what its produce step does.
+*)
+
+(* Substitute the let-bound values in env into expr *)
+let rec subs_env env expr = match expr with
+  | Var (_, n) when StringMap.mem n env -> StringMap.find n env
+  | _ -> mutate_children_in_expr (subs_env env) expr
+
+(* Find the pipelines inside a loop body that could move out of it,
+   returning (buffer, type, size with lets substituted) *)
+let rec find_pipelines env = function
+  | LetStmt (name, value, body) ->
+      find_pipelines (StringMap.add name (subs_env env value) env) body
+  | Block l ->
+      List.concat (List.map (find_pipelines env) l)
+  | Pipeline (buf, ty, size, produce, consume) ->
+      (buf, ty, subs_env env size) ::
+        (find_pipelines env produce @ find_pipelines env consume)
+  | _ -> []
+
+(* Replace the pipeline named buf with its produce and consume steps *)
+let rec strip_pipeline buf = function
+  | Pipeline (name, _, _, produce, consume) when name = buf ->
+      Block [produce; consume]
+  | For _ as stmt -> stmt
+  | stmt -> mutate_children_in_stmt (fun x -> x) (strip_pipeline buf) stmt
+
+let rec count_pipelines buf = function
+  | Pipeline (name, _, _, produce, consume) ->
+      (if name = buf then 1 else 0) + count_pipelines buf produce + count_pipelines buf consume
+  | stmt -> fold_children_in_stmt (fun _ -> 0) (count_pipelines buf) (+) stmt
+
+let rec contains_simt_loop = function
+  | For (name, _, _, _, _) when Ptx_dev.is_simt_var name -> true
+  | stmt -> fold_children_in_stmt (fun _ -> false) contains_simt_loop (||) stmt
+
+(* The largest value size takes over the loop, if that can be
+   expressed in terms of things defined outside the loop *)
+let max_over_loop i min n size =
+  let max_size =
+    if expr_contains_expr (Var (i32, i)) size then
+      let loop_max = Constant_fold.constant_fold_expr (min +~ n -~ (IntImm 1)) in
+      match Bounds.bounds_of_expr i (min, loop_max) size with
+        | Bounds.Range (_, max) -> Some max
+        | Bounds.Unbounded -> None
+    else Some size
+  in
+  match max_size with
+    | Some max when
+        StringSet.is_empty (find_loads_in_expr max) &&
+        not (StringIntSet.exists (fun (n, _) -> n = i)
+               (find_names_in_expr StringSet.empty 8 max)) ->
+        Some (Constant_fold.constant_fold_expr
+                (Bop (Max, max, make_zero (val_type_of_expr max))))
+    | _ -> None
+
+(* Lift the named pipelines out of a loop, returning the ones that
+   couldn't be lifted alongside the new statement *)
+let lift_pipelines bufs = function
+  | For (i, min, n, order, body) ->
+      let candidates = List.filter
+        (fun (buf, _, _) -> List.mem buf bufs && count_pipelines buf body = 1)
+        (find_pipelines StringMap.empty body) in
+      let lifted = List.fold_left (fun l (buf, ty, size) ->
+        match max_over_loop i min n size with
+          | Some max ->
+              dbg 2 "Hoisting allocation of %s out of %s with size %s\n%!"
+                buf i (Ir_printer.string_of_expr max);
+              (buf, ty, max)::l
+          | None -> l)
+        [] candidates in
+      let body = List.fold_left (fun s (buf, _, _) -> strip_pipeline buf s) body lifted in
+      let stmt = List.fold_left
+        (fun s (buf, ty, size) -> Pipeline (buf, ty, size, Block [], s))
+        (For (i, min, n, order, body))
+        lifted in
+      let lifted_names = List.map (fun (buf, _, _) -> buf) lifted in
+      (stmt, List.filter (fun buf -> not (List.mem buf lifted_names)) bufs)
+  | stmt -> (stmt, bufs)
+
+let rec hoist stmt =
+  let stmt = mutate_children_in_stmt (fun x -> x) hoist stmt in
+  match stmt with
+    | For (_, _, _, true, body) ->
+        let bufs = List.map (fun (buf, _, _) -> buf) (find_pipelines StringMap.empty body) in
+        fst (lift_pipelines bufs stmt)
+    | _ -> stmt
+
+let hoist_allocations stmt =
+  if contains_simt_loop stmt then stmt else hoist stmt
@@ -0,0 +1,181 @@
+open Ir
+open Analysis
+open Util
+
+(* Loop-invariant code motion. Turn this:
+
+   For (i, min, n, order, ... LetStmt (a, f (j), ... g (j) ...) ...)
+
+   where f (j) and g (j) don't depend on i or on anything defined inside
+   the loop, into this:
+
+   LetStmt (a, f (j),
+   LetStmt (i.invariant.0, g (j),
+     For (i, min, n, order, ... i.invariant.0 ...)))
+
+   Loops are handled innermost first, so whatever comes out of a loop
+   gets another chance to come out of the one around it, and ends up
+   just inside the outermost loop that it depends on. Lowering leaves a
+   lot of these behind: things computed from uniforms and image sizes,
+   like clamp bounds, and anything inlined from a function of fewer
+   dimensions than the one using it.
+
+   Parallel loops get their body from a closure, which cg_par_for fills
+   in with the values of whatever the body refers to, so what's hoisted
+   out of one is computed once by the caller instead of once per
+   iteration. Only scalars that aren't bools cross a parallel loop,
+   because those are all the closure can hold safely; vectors stop just
+   inside it.
+
+   This runs after the last constant folding, which would put anything
+   it considers simple straight back where it came from.
+
+   Scalar integers are hoisted the way constant folding keeps Lets, as
+   a multiple of the modulus known for them plus a remainder, so that
+   alignment analysis still works on vector loads and stores. Ramps,
+   broadcasts and conditions stay where codegen expects them and only
+   their insides are hoisted.
+
+   A load is only invariant if its buffer isn't written to or
+   allocated inside the loop. Loads also have to be safe to do when the
+   loop runs zero times, so either the loop runs a known positive
+   number of times, or the load is from an input at an index that
+   doesn't depend on any loop or let. GPU loops are left alone. *)
+
+(* Numbers the hoisted values. It starts over for each statement, so
+   that the same pipeline always gets the same names, and so the same
+   key in the compilation caches. *)
+let counter = ref 0
+
+(* Every name bound by a For, LetStmt or Pipeline in stmt, with
+   repeats *)
+let rec bindings_in = function
+  | For (name, _, _, _, body) -> name :: bindings_in body
+  | LetStmt (name, _, body) -> name :: bindings_in body
+  | Pipeline (name, _, _, produce, consume) -> name :: (bindings_in produce @ bindings_in consume)
+  | stmt -> fold_children_in_stmt (fun _ -> []) bindings_in (@) stmt
+
+let rec buffers_written_in = function
+  | Store (_, buf, _) -> StringSet.singleton buf
+  | Pipeline (name, _, _, produce, consume) ->
+      StringSet.add name (StringSet.union (buffers_written_in produce) (buffers_written_in consume))
+  | stmt -> fold_children_in_stmt (fun _ -> StringSet.empty) buffers_written_in StringSet.union stmt
+
+(* The names an expression refers to, including buffers it loads from *)
+let free_names expr =
+  StringIntSet.fold (fun (n, _) s -> StringSet.add n s)
+    (find_names_in_expr StringSet.empty 8 expr) StringSet.empty
+
+let depends_on names expr =
+  not (StringSet.is_empty (StringSet.inter names (free_names expr)))
+
+(* Pull what doesn't depend on i out of the loop. all_names are the
+   names bound anywhere in the whole statement, unique the ones bound
+   only once, and inputs the buffers that are read but never written. *)
+let hoist_loop all_names unique inputs = function
+  | For (i, min, n, order, body) ->
+      let defined = ref (List.fold_right StringSet.add (i :: bindings_in body) StringSet.empty) in
+      let written = buffers_written_in body in
+      let runs = match n with IntImm k -> k > 0 | _ -> false in
+      let hoisted = ref [] and replacements = ref [] in
+
+      let rec safe_loads = function
+        | Load (_, buf, idx) ->
+            not (StringSet.mem buf written) &&
+            (runs || (StringSet.mem buf inputs && not (depends_on all_names idx))) &&
+            safe_loads idx
+        | Debug _ -> false
+        | e -> fold_children_in_expr safe_loads (&&) true e
+      in
+      let invariant inner e =
+        not (depends_on (StringSet.union inner !defined) e) && safe_loads e in
+      let can_move e =
+        let t = val_type_of_expr e in
+        element_val_type t <> bool1 && (order || is_scalar e) in
+
+      let hoist value =
+        try List.assoc value !replacements with Not_found -> begin
+          let t = val_type_of_expr value in
+          let name = Printf.sprintf "%s.invariant.%d" i !counter in
+          incr counter;
+          let (r, m) =
+            if is_scalar value && is_integral value then
+              try compute_remainder_modulus value with _ -> (0, 1)
+            else (0, 1) in
+          let (value', replacement) =
+            if m > 1 then
+              (Constant_fold.constant_fold_expr ((value -~ make_const t r) /~ make_const t m),
+               if r = 0 then Var (t, name) *~ make_const t m
+               else (Var (t, name) *~ make_const t m) +~ make_const t r)
+            else (value, Var (t, name)) in
+          hoisted := !hoisted @ [(name, value')];
+          unique := StringSet.add name !unique;
+          replacements := (value, replacement) :: !replacements;
+          replacement
+        end
+      in
+      let rec mutate inner e =
+        match e with
+          | IntImm _ | UIntImm _ | FloatImm _ | Var _ -> e
+          | Broadcast _ | Ramp _ -> mutate_children_in_expr (mutate inner) e
+          | _ when can_move e && invariant inner e -> hoist e
+          | Let (n, a, b) -> Let (n, mutate inner a, mutate (StringSet.add n inner) b)
+          | _ -> mutate_children_in_expr (mutate inner) e
+      in
+      let mutate = mutate StringSet.empty in
+
+      (* Lets can move whole if nothing else has the same name for them
+         to capture or be captured by *)
+      let movable name value =
+        StringSet.mem name !unique && can_move value && invariant StringSet.empty value in
+
+      (* Inner loops have already been done, so anything left in their
+         bodies depends on them *)
+      let rec walk stmt =
+        match stmt with
+          | For (j, jmin, jn, o, b) -> For (j, mutate jmin, mutate jn, o, b)
+          | LetStmt (name, value, stmt) when movable name value ->
+              hoisted := !hoisted @ [(name, value)];
+              defined := StringSet.remove name !defined;
+              walk stmt
+          | LetStmt (name, value, stmt) ->
+              let value = mutate value in
+              LetStmt (name, value, walk stmt)
+          | Store (e, buf, idx) ->
+              let e = mutate e in
+              Store (e, buf, mutate idx)
+          | Block l -> Block (List.map walk l)
+          | Pipeline (name, ty, size, produce, consume) ->
+              let size = mutate size in
+              let produce = walk produce in
+              Pipeline (name, ty, size, produce, walk consume)
+          | Print (fmt, args) -> Print (fmt, List.map mutate args)
+          | Assert (e, str) -> Assert (mutate e, str)
+          | Provide _ -> stmt
+      in
+      let body = walk body in
+      if !hoisted <> [] then dbg 2 "Hoisted %d values out of the loop over %s\n%!" (List.length !hoisted) i;
+      List.fold_right (fun (name, value) s -> LetStmt (name, value, s)) !hoisted
+        (For (i, min, n, order, body))
+  | stmt -> stmt
+
+let hoist_invariants stmt =
+  if Hoist_allocations.contains_simt_loop stmt then stmt else begin
+    counter := 0;
+    let bindings = bindings_in stmt in
+    let all_names = List.fold_right StringSet.add bindings StringSet.empty in
+    let count = Hashtbl.create 16 in
+    List.iter (fun n -> Hashtbl.replace count n (1 + try Hashtbl.find count n with Not_found -> 0)) bindings;
+    let unique = ref (Hashtbl.fold (fun n k s -> if k = 1 then StringSet.add n s else s) count StringSet.empty) in
+    let inputs = StringSet.diff
+      (StringIntSet.fold (fun (n, _) s -> StringSet.add n s)
+         (find_names_in_stmt StringSet.empty 8 stmt) StringSet.empty)
+      (buffers_written_in stmt) in
+    let rec hoist stmt =
+      let stmt = mutate_children_in_stmt (fun x -> x) hoist stmt in
+      match stmt with
+        | For _ -> hoist_loop all_names unique inputs stmt
+        | _ -> stmt
+    in
+    hoist stmt
+  end
@@ -1,2 +1,3 @@
 open Llvm
 external compile_module_to_string : llmodule -> string = "compile_module_to_string"
+external host_cpu_features : unit -> string = "host_cpu_features"
@@ -31,7 +31,7 @@ let rec resolve_name (context: string) (var: string) (schedule: schedule_tree) =
       | Serial (n, _, _)
       | Parallel (n, _, _)
       | Vectorized (n, _, _)
-      | Split (n, _, _, _)
+      | Split (n, _, _, _, _)
       | Unrolled (n, _, _) when n = var -> true
       | _ -> false
     in
@@ -81,6 +81,10 @@ let string_of_range = function
   | Range (a, b) -> "[" ^ string_of_expr a ^ ", " ^ string_of_expr b ^ "]" 
 let bounds f stmt = simplify_region (required_of_stmt f (StringMap.empty) stmt) 
 
+(* Stages lowered so far. See produce_stage. *)
+let stage_cache = Hashtbl.create 64
+let stage_cache_size = 4096
+
 let rec lower_stmt (func:string) (stmt:stmt) (env:environment) (schedule:schedule_tree) =
   (* Grab the schedule for the next function call to lower *)
   let (call_sched, sched_list) = find_schedule schedule func in
@@ -91,7 +95,7 @@ let rec lower_stmt (func:string) (stmt:stmt) (env:environment) (schedule:schedul
   
   let scheduled_call = 
     match call_sched with
-      | Chunk chunk_dim -> begin
+      | Chunk chunk_dim | Sliding chunk_dim -> begin
         (* Recursively descend the statement until we get to the loop in question *)
         let rec inner = function
           | For (for_dim, min, size, order, for_body) when for_dim = chunk_dim -> 
@@ -162,6 +166,32 @@ let rec lower_stmt (func:string) (stmt:stmt) (env:environment) (schedule:schedul
 
 (* Evaluate a function according to a schedule and wrap the stmt consuming it in a pipeline *)
 and realize func consume env schedule =
+  let (return_type, buffer_size, produce) = produce_stage func env schedule in
+  Pipeline (func, return_type, buffer_size, produce, consume)
+
+(* The loop nest that produces a function only depends on its
+   definition and its schedule (and those of its update step), so when
+   a pipeline is lowered again after some other stage changed, we
+   reuse it. *)
+and produce_stage func env schedule =
+  let (_, sched_list) = find_schedule schedule func in
+  let definition = find_function func env in
+  let update = match definition with
+    | (_, _, Reduce (_, _, update_func, _)) ->
+        let update_name = func ^ "." ^ update_func in
+        Some (find_function update_name env, snd (find_schedule schedule update_name))
+    | _ -> None
+  in
+  let key = (func, definition, sched_list, update) in
+  try Hashtbl.find stage_cache key with Not_found -> begin
+    let result = lower_stage func env schedule in
+    if Hashtbl.length stage_cache > stage_cache_size then Hashtbl.clear stage_cache;
+    Hashtbl.add stage_cache key result;
+    result
+  end
+
+(* Returns the type, the size of the buffer, and the loop nest that produces it *)
+and lower_stage func env schedule =
 
   let (_, sched_list) = find_schedule schedule func in
 
@@ -175,17 +205,92 @@ and realize func consume env schedule =
         Unroll.unroll_stmt name (For (name, min, IntImm size, false, stmt))
     | Vectorized (name, min, size) -> 
         Vectorize.vectorize_stmt name (For (name, min, IntImm size, false, stmt))
-    | Split (old_dim, new_dim_outer, new_dim_inner, offset) -> 
+    | Split (old_dim, new_dim_outer, new_dim_inner, offset, tail) -> 
         let (_, size_new_dim_inner) = stride_for_dim new_dim_inner sched_list in
+        let outer_start = (Var (i32, new_dim_outer)) *~ size_new_dim_inner in
+        (* Shifting inward pulls the last iteration back so that it
+           ends at the end of the old dimension *)
+        let outer_start = match tail with
+          | ShiftInward size ->
+              Bop (Min, outer_start, Bop (Max, size -~ size_new_dim_inner, IntImm 0))
+          | _ -> outer_start
+        in
         let rec expand_old_dim_expr = function
           | Var (i32, dim) when dim = old_dim -> 
-              ((Var (i32, new_dim_outer)) *~ size_new_dim_inner) +~ 
-                (Var (i32, new_dim_inner)) +~ offset
+              outer_start +~ (Var (i32, new_dim_inner)) +~ offset
           | x -> mutate_children_in_expr expand_old_dim_expr x 
         and expand_old_dim_stmt stmt = 
           mutate_children_in_stmt expand_old_dim_expr expand_old_dim_stmt stmt in
         expand_old_dim_stmt stmt 
   in
+
+  (* A split with a scalar epilogue becomes two loop nests: one in
+     which the outer dimension only covers whole multiples of the
+     split factor, followed by one that does whatever is left over with
+     a single serial loop over the inner dimension (replacing any
+     further splits of it). We make a schedule for each and wrap the
+     stmt in both. Either loop may have nothing to do: the first when
+     the size is less than the factor, the second when it's a
+     multiple of it. Serial loops with an extent of zero are skipped
+     (see cg_for), as are parallel ones (see do_par_for). *)
+  let rec expand_epilogues (sched_list: schedule list) =
+    let is_epilogue = function
+      | Split (_, _, _, _, Epilogue _) -> true
+      | _ -> false
+    in
+    match List.filter is_epilogue sched_list with
+      | [] -> [sched_list]
+      | (Split (old_dim, outer, inner, offset, Epilogue size) as split)::_ ->
+          let (_, factor) = stride_for_dim inner sched_list in
+          let whole = size /~ factor in
+          let leftover = size -~ whole *~ factor in
+          (* The dimensions made by splitting inner further *)
+          let rec descendants names = 
+            let more = List.fold_left (fun names -> function
+              | Split (d, o, i, _, _) when List.mem d names && not (List.mem i names) -> o::i::names
+              | _ -> names) names sched_list in
+            if List.length more = List.length names then names else descendants more
+          in
+          let inner_dims = List.filter (fun n -> n <> inner) (descendants [inner]) in
+          (* Only the entries after the split can refer to its new
+             dimensions; names may be reused by earlier ones *)
+          let rec modify f = function
+            | s::rest when s = split -> (f s) @ (List.concat (List.map f rest))
+            | s::rest -> s::(modify f rest)
+            | [] -> []
+          in
+          let main = modify (function
+            | s when s = split -> [Split (old_dim, outer, inner, offset, RoundUp)]
+            | Serial (n, min, _) when n = outer -> [Serial (n, min, whole)]
+            | Parallel (n, min, _) when n = outer -> [Parallel (n, min, whole)]
+            | Split (n, _, _, _, _) when n = outer ->
+                failwith ("Can't split " ^ n ^ " further, because it's the outer dimension of a split with a scalar epilogue")
+            | s -> [s]) sched_list
+          and tail = modify (function
+            | s when s = split -> [Split (old_dim, outer, inner, offset +~ whole *~ factor, RoundUp)]
+            | Serial (n, min, _) | Parallel (n, min, _) when n = outer -> [Serial (n, min, IntImm 1)]
+            | Serial (n, _, _) | Parallel (n, _, _) 
+            | Vectorized (n, _, _) | Unrolled (n, _, _) when n = inner -> [Serial (n, IntImm 0, leftover)]
+            (* If inner was split further, one serial loop replaces
+               all the loops that came from it *)
+            | Split (n, o, _, _, _) when n = inner -> 
+                if o = inner then [] else [Serial (n, IntImm 0, leftover)]
+            | Split (n, _, _, _, _) | Serial (n, _, _) | Parallel (n, _, _) 
+            | Vectorized (n, _, _) | Unrolled (n, _, _) when List.mem n inner_dims -> []
+            | s -> [s]) sched_list
+          in
+          if Constant_fold.constant_fold_expr leftover = IntImm 0 then
+            expand_epilogues main
+          else
+            (expand_epilogues main) @ (expand_epilogues tail)
+      | _ -> assert false
+  in
+
+  let wrap_all (sched_list: schedule list) (stmt: stmt) =
+    match expand_epilogues sched_list with
+      | [l] -> List.fold_left (wrap l) stmt l
+      | lists -> Block (List.map (fun l -> List.fold_left (wrap l) stmt l) lists)
+  in
   
   let (args, return_type, body) = make_function_body func env in
   let arg_vars = List.map (fun (t, n) -> Var (t, n)) args in
@@ -213,7 +318,7 @@ and realize func consume env schedule =
           else inner_stmt
         in
 
-        let produce = List.fold_left (wrap sched_list) inner_stmt sched_list in
+        let produce = wrap_all sched_list inner_stmt in
         let rec flatten = function
           | (x, y)::rest -> x::y::(flatten rest)
           | [] -> []
@@ -223,7 +328,7 @@ and realize func consume env schedule =
                    Print ("Realizing " ^ func ^ " over ", flatten strides);
                    produce] 
           else produce in
-        Pipeline (func, return_type, buffer_size, produce, consume)
+        (return_type, buffer_size, produce)
     | Reduce (init_expr, update_args, update_func, reduction_domain) ->
 
         let init_stmt = Provide (init_expr, func, arg_vars) in
@@ -233,7 +338,7 @@ and realize func consume env schedule =
           else init_stmt
         in
 
-        let initialize = List.fold_left (wrap sched_list) init_stmt sched_list in
+        let initialize = wrap_all sched_list init_stmt in
 
         dbg 2 "Making body of update function: %s\n%!" update_func;
         let (pure_update_args, _, update_body) = make_function_body update_func env in
@@ -254,7 +359,14 @@ and realize func consume env schedule =
 
         dbg 2 "Retrieving schedule of update func\n%!";
         let (_, update_sched_list) = find_schedule schedule update_func in
-        let update = List.fold_left (wrap update_sched_list) update_stmt update_sched_list in
+        (* Shifting inward would do some of the update twice, which
+           isn't safe when it isn't idempotent (f(x) = f(x) + g(x)), so
+           the update gets an epilogue instead *)
+        let update_sched_list = List.map (function
+          | Split (old_dim, outer, inner, offset, ShiftInward size) ->
+              Split (old_dim, outer, inner, offset, Epilogue size)
+          | s -> s) update_sched_list in
+        let update = wrap_all update_sched_list update_stmt in
 
         dbg 2 "Computing pure domain\n%!";
         let pure_domain = List.map 
@@ -294,9 +406,7 @@ and realize func consume env schedule =
             Block [initialize; update]
         in
 
-        (* Put the whole thing in a pipeline that exposes the updated
-           result to the consumer *)
-        Pipeline (func, return_type, buffer_size, produce, consume)
+        (return_type, buffer_size, produce)
 
 
 (* Figure out interdependent expressions that give the bounds required
@@ -366,6 +476,36 @@ let rec extract_bounds_soup env var_env bounds = function
  
 
 
+(* Whether expr never decreases as the variable var increases. This
+   is a conservative syntactic check, so false means "don't know". *)
+let non_decreasing_in var expr =
+  let v = Var (i32, var) in
+  (* 1 for non-decreasing, -1 for non-increasing, 0 for constant, and
+     None when we can't tell *)
+  let combine a b = match (a, b) with
+    | (Some 0, x) | (x, Some 0) -> x
+    | (Some a, Some b) when a = b -> Some a
+    | _ -> None
+  in
+  let flip = function Some d -> Some (-d) | None -> None in
+  let rec direction e =
+    if not (expr_contains_expr v e) then Some 0 else
+      match e with
+        | Var _ -> Some 1
+        | Cast ((Int _ | UInt _), e) when is_integral e -> direction e
+        | Bop ((Add | Min | Max), a, b) -> combine (direction a) (direction b)
+        | Bop (Sub, a, b) -> combine (direction a) (flip (direction b))
+        | Bop ((Mul | Div), a, IntImm k) when k > 0 -> direction a
+        | Bop ((Mul | Div), a, IntImm k) when k < 0 -> flip (direction a)
+        | Bop (Mul, IntImm k, a) when k >= 0 -> direction a
+        | Bop (Mul, IntImm k, a) -> flip (direction a)
+        | Select (c, a, b) when not (expr_contains_expr v c) -> combine (direction a) (direction b)
+        | _ -> None
+  in
+  match direction expr with
+    | Some d -> d >= 0
+    | None -> false
+
 let rec bounds_inference env schedule = function
   | For (var, min, size, order, body) ->
       (* Pull out the bounds of all function realizations within this body *)
@@ -400,18 +540,120 @@ let rec bounds_inference env schedule = function
               precomp
             in
 
+            (* Functions realized in this loop that keep a sliding
+               window over it *)
+            let is_sliding func =
+              match find_schedule schedule func with
+                | (Sliding v, _) -> v = var
+                | _ -> false
+            in
+            let sliding = List.exists (fun (func, _, _, _) -> is_sliding func) bounds in
+
+            if sliding && not order then
+              failwith ("Can't slide a window over the parallel loop " ^ var);
+
+            (* Substitute in the bounds of everything this one depends
+               on, so we can tell which bounds vary with the loop
+               variable. Dependencies come later in the list. *)
+            let loop_var = Var (i32, var) in
+            let loop_max = min +~ size -~ IntImm 1 in
+            let (resolved, folds) = List.fold_right
+              (fun (func, arg, fmin, fmax) (resolved, folds) ->
+                let name = func ^ "." ^ arg in
+                let fmin = Hoist_allocations.subs_env resolved fmin in
+                let fmax = Hoist_allocations.subs_env resolved fmax in
+                let extent = fmax -~ fmin +~ IntImm 1 in
+                if is_sliding func &&
+                  (expr_contains_expr loop_var fmin || expr_contains_expr loop_var fmax) then begin
+                  (* Each iteration only needs to compute what the
+                     last one didn't. The values are kept in a buffer
+                     that wraps around in this dimension, so it must
+                     be big enough for the whole window. *)
+                  if List.exists (fun (f, _, _) -> f = func) folds then
+                    failwith ("Can't slide " ^ func ^ " along more than one dimension of " ^ var);
+                  begin match find_function func env with
+                    | (_, _, Pure _) -> ()
+                    | _ -> failwith ("Can't slide the reduction " ^ func)
+                  end;
+                  let (_, sched_list) = find_schedule schedule func in
+                  if not (List.exists (function
+                    | Serial (n, _, _) | Parallel (n, _, _) -> n = name
+                    | _ -> false) sched_list) then
+                    failwith ("Can't slide " ^ func ^ " along " ^ arg ^
+                                 " because that dimension has been split, unrolled, or vectorized");
+                  let fold = match Hoist_allocations.max_over_loop var min size extent with
+                    | Some k -> k
+                    | None -> failwith ("Could not bound the window of " ^ func ^ " along " ^ arg)
+                  in
+                  (* Only computing what the last iteration didn't
+                     relies on the window never moving backwards *)
+                  if not (non_decreasing_in var fmin && non_decreasing_in var fmax) then
+                    failwith ("Can't slide " ^ func ^ " along " ^ arg ^ " over " ^ var ^
+                                 " because its required region isn't known to move forwards as " ^
+                                 var ^ " increases. Use chunk instead.");
+                  (* If the window doesn't move on some iteration,
+                     the new region is empty and the loops that
+                     produce it have an extent of zero, which cg_for
+                     skips *)
+                  let prev_max = subs_expr loop_var (loop_var -~ IntImm 1) fmax in
+                  let new_min = Select (loop_var =~ min, fmin,
+                                        Bop (Max, fmin, prev_max +~ IntImm 1)) in
+                  let new_min = Constant_fold.constant_fold_expr new_min in
+                  let resolved = StringMap.add (name ^ ".min") new_min resolved in
+                  let resolved = StringMap.add (name ^ ".extent") (fmax -~ new_min +~ IntImm 1) resolved in
+                  (resolved, (func, arg, fold)::folds)
+                end else begin
+                  let resolved = StringMap.add (name ^ ".min") fmin resolved in
+                  let resolved = StringMap.add (name ^ ".extent") extent resolved in
+                  (resolved, folds)
+                end)
+              bounds (StringMap.empty, []) in
+
             let rewrite_bound precomp (func, arg, min, max) =
-              (* Lift the storage of the min *)              
-              let precomp = lift_var precomp (func ^ "." ^ arg ^ ".min") min in
-              let precomp = lift_var precomp (func ^ "." ^ arg ^ ".extent") (max -~ min +~ IntImm 1) in
-              precomp
+              let name = func ^ "." ^ arg in
+              if List.exists (fun (f, a, _) -> f = func && a = arg) folds then
+                let precomp = lift_var precomp (name ^ ".min") (StringMap.find (name ^ ".min") resolved) in
+                lift_var precomp (name ^ ".extent") (max -~ Var (i32, name ^ ".min") +~ IntImm 1)
+              else
+                (* Lift the storage of the min *)              
+                let precomp = lift_var precomp (name ^ ".min") min in
+                let precomp = lift_var precomp (name ^ ".extent") (max -~ min +~ IntImm 1) in
+                precomp
             in
             
             let precomp = List.fold_left rewrite_bound (fun x -> x) bounds in
 
             let (body, schedule) = bounds_inference env schedule body in               
 
-            (For (var, min, size, order, precomp body), schedule)
+            (* Size the storage of the sliding functions by the window,
+               and move it outside the loop so that it persists from
+               one iteration to the next *)
+            let rec fold_storage = function
+              | Pipeline (func, ty, _, produce, consume)
+                  when List.exists (fun (f, _, _) -> f = func) folds ->
+                  let (args, _, _) = find_function func env in
+                  let (_, sched_list) = find_schedule schedule func in
+                  let names = List.map (fun (_, n) -> func ^ "." ^ n) args in
+                  let storage_size = List.fold_right2
+                    (fun (_, size) (_, n) old_size ->
+                      if List.exists (fun (f, a, _) -> f = func && a = n) folds then
+                        Var (i32, func ^ "." ^ n ^ ".fold") *~ old_size
+                      else size *~ old_size)
+                    (stride_list sched_list names) args (IntImm 1) in
+                  Pipeline (func, ty, storage_size, fold_storage produce, fold_storage consume)
+              | For _ as stmt -> stmt
+              | stmt -> mutate_children_in_stmt (fun x -> x) fold_storage stmt
+            in
+            let loop = For (var, min, size, order, fold_storage (precomp body)) in
+            let (loop, unlifted) =
+              Hoist_allocations.lift_pipelines (List.map (fun (f, _, _) -> f) folds) loop in
+            if unlifted <> [] then
+              failwith ("Could not allocate the sliding window of " ^
+                           (String.concat ", " unlifted) ^ " outside " ^ var);
+            let loop = List.fold_left
+              (fun stmt (func, arg, fold) -> LetStmt (func ^ "." ^ arg ^ ".fold", fold, stmt))
+              loop folds in
+            (loop, schedule)
       end
   | Block l ->
       let rec fix sched = function
@@ -455,8 +697,13 @@ let qualify_schedule (sched:schedule_tree) =
       | Parallel   (name, min, size) -> Parallel   (prefix name, prefix_expr min, prefix_expr size)
       | Unrolled   (name, min, size) -> Unrolled   (prefix name, prefix_expr min, size)
       | Vectorized (name, min, size) -> Vectorized (prefix name, prefix_expr min, size)
-      | Split (old_dim, new_dim_1, new_dim_2, offset) -> 
-          Split (prefix old_dim, prefix new_dim_1, prefix new_dim_2, prefix_expr offset)
+      | Split (old_dim, new_dim_1, new_dim_2, offset, tail) -> 
+          let tail = match tail with
+            | RoundUp -> RoundUp
+            | ShiftInward size -> ShiftInward (prefix_expr size)
+            | Epilogue size -> Epilogue (prefix_expr size)
+          in
+          Split (prefix old_dim, prefix new_dim_1, prefix new_dim_2, prefix_expr offset, tail)
     in
 
     (call_sched, List.map prefix_schedule sched_list)     
@@ -469,16 +716,34 @@ let qualify_schedule (sched:schedule_tree) =
   in
   List.fold_left update sched keys    
 
-let lower_function_calls (stmt:stmt) (env:environment) (schedule:schedule_tree) =
+let lower_function_calls (stmt:stmt) (env:environment) (schedule:schedule_tree) (output:string) =
+  (* Internal buffers are packed densely in the order of the function
+     args. The output lives in a buffer we were handed, so we use its
+     mins and strides. *)
+  let index_of_args func strides args =
+    if func = output then
+      let (index, _) = List.fold_left 
+        (fun (index, i) arg ->
+          let min = Var (i32, ".result.min." ^ (string_of_int i)) in
+          let stride = Var (i32, ".result.stride." ^ (string_of_int i)) in
+          (index +~ (arg -~ min) *~ stride, i+1))
+        (IntImm 0, 0) args in
+      index
+    else
+      List.fold_right2 
+        (fun arg (min, size, fold) subindex -> match fold with
+          (* Sliding windows wrap around in the dimension they slide along *)
+          | Some k -> k *~ subindex +~ (arg %~ k)
+          | None -> size *~ subindex +~ arg -~ min) 
+        args strides (IntImm 0)
+  in
   let rec replace_calls_with_loads_in_expr func strides expr = 
     let recurse = replace_calls_with_loads_in_expr func strides in
     match expr with 
       (* Match calls to f from someone else, or recursive calls from f to itself *)
       | Call (ty, f, args) when f = func || f = (func ^ "." ^ (base_name func)) ->
           let args = List.map recurse args in 
-          let index = List.fold_right2 
-            (fun arg (min,size) subindex -> size *~ subindex +~ arg -~ min) 
-            args strides (IntImm 0) in
+          let index = index_of_args func strides args in
           let load = Load (ty, func, index) in
           if (trace_verbosity > 1) then
             Debug (load, "Loading " ^ func ^ " at ", args)
@@ -492,13 +757,22 @@ let lower_function_calls (stmt:stmt) (env:environment) (schedule:schedule_tree)
     match stmt with
       | Provide (e, f, args) when f = func ->
           let args = List.map recurse_expr args in
-          let index = List.fold_right2 
-            (fun arg (min,size) subindex -> size *~ subindex +~ arg -~ min) 
-            args strides (IntImm 0) in          
+          let index = index_of_args func strides args in
           Store (recurse_expr e, f, index)
       | _ -> mutate_children_in_stmt recurse_expr recurse_stmt stmt
   in
 
+  (* Bounds inference defines a fold factor for each dimension that
+     slides *)
+  let rec find_folds = function
+    | LetStmt (n, _, s) ->
+        let folds = find_folds s in
+        let len = String.length n in
+        if len > 5 && String.sub n (len - 5) 5 = ".fold" then StringSet.add n folds else folds
+    | s -> fold_children_in_stmt (fun _ -> StringSet.empty) find_folds StringSet.union s
+  in
+  let folds = find_folds stmt in
+
   let functions = list_of_schedule schedule in
   let update stmt f =
     let (args, _, _) = find_function f env in
@@ -506,12 +780,17 @@ let lower_function_calls (stmt:stmt) (env:environment) (schedule:schedule_tree)
     match call_sched with
       | Inline | Reuse _ -> stmt
       | _ ->
-          let strides = stride_list sched_list (List.map (fun (_, n) -> f ^ "." ^ n) args) in
+          let names = List.map (fun (_, n) -> f ^ "." ^ n) args in
+          let strides = List.map2
+            (fun (min, size) n ->
+              let fold = n ^ ".fold" in
+              (min, size, if StringSet.mem fold folds then Some (Var (i32, fold)) else None))
+            (stride_list sched_list names) names in
           replace_calls_with_loads_in_stmt f strides stmt
   in
   List.fold_left update stmt functions 
 
-let lower_function (func:string) (env:environment) (schedule:schedule_tree) =
+let lower_function (func:string) (env:environment) (schedule:schedule_tree) (any_layout:bool) =
 
   (* dump pre-lowered form *)
   if 0 < verbosity then begin
@@ -607,9 +886,11 @@ let lower_function (func:string) (env:environment) (schedule:schedule_tree) =
     match range with
       | Unbounded -> (expr &&~ (IntImm 0), count+1)
       | Range (min, max) ->
+        let result_min = Var (i32, ".result.min." ^ (string_of_int count)) in
+        let result_extent = Var (i32, ".result.dim." ^ (string_of_int count)) in
         (expr &&~
-           (min >=~ (IntImm 0)) &&~
-           (max <~ (Var (i32, ".result.dim." ^ (string_of_int count)))),
+           (min >=~ result_min) &&~
+           (max <~ result_min +~ result_extent),
          count+1)
   ) (Cast (bool1, IntImm 1), 0) region in 
   let oob_check = Assert (check, "Function may access output image out of bounds") in
@@ -655,7 +936,7 @@ let lower_function (func:string) (env:environment) (schedule:schedule_tree) =
   let pass_desc = "Replace function references with loads and stores" in 
   dbg 1 "%s\n%!" pass_desc;
 
-  let stmt = lower_function_calls stmt env schedule in
+  let stmt = lower_function_calls stmt env schedule func in
 
   dump_stmt stmt pass pass_desc "loads_and_stores" 1;
 
@@ -683,11 +964,14 @@ let lower_function (func:string) (env:environment) (schedule:schedule_tree) =
   (* ----------------------------------------------- *)
   let pass_desc = "Replace references to bounds of output function with bounds of output buffer" in
   dbg 1 "%s\n%!" pass_desc;
+
   let args,_,_ = find_function func env in
   let (stmt,_) =
     List.fold_left
       (fun (stmt,i) (t,nm) ->
-        let stmt = LetStmt (func ^ "." ^ nm ^ ".min", IntImm 0, stmt) in
+        let stmt = LetStmt (func ^ "." ^ nm ^ ".min",
+                            Var (t, ".result.min." ^ (string_of_int i)),
+                            stmt) in
         LetStmt (func ^ "." ^ nm ^ ".extent",
                  Var (t, ".result.dim." ^ (string_of_int i)),
                  stmt), 
@@ -700,11 +984,108 @@ let lower_function (func:string) (env:environment) (schedule:schedule_tree) =
 
   let pass = pass + 1 in
 
+  (* ----------------------------------------------- *)
+  let pass_desc = "Hoisting loop-invariant allocations" in
+  dbg 1 "%s\n%!" pass_desc;
+  let stmt = Hoist_allocations.hoist_allocations stmt in
+
+  dump_stmt stmt pass pass_desc "hoist_allocations" 1;
+
+  let pass = pass + 1 in
+
+  (* ----------------------------------------------- *)
+  let pass_desc = "Specializing for dense, aligned inputs and outputs" in
+  dbg 1 "%s\n%!" pass_desc;
+
+  (* Any buffer whose stride in the first dimension is used
+     symbolically (the output, and inputs that don't have their
+     strides baked in) is assumed to be dense, so that vector loads
+     and stores stay vector loads and stores, and to have its host
+     pointer on a 64-byte boundary, like the images we allocate. The
+     alignment matters: vector accesses that alignment analysis proves
+     aligned are emitted with the alignment of the whole vector (see
+     cg_aligned_load), which is only true if the host pointer is
+     aligned. Both are checked at runtime.
+
+     If the caller asked for any layout to be accepted, we instead
+     keep a general version as well, for interleaved planes, crops
+     and memory owned by someone else, which runs when any of the
+     strides isn't one or any of the buffers is less aligned. The
+     choice between them is made by two loops that run once or not at
+     all (cg_for skips loops with no iterations). That doubles the
+     code, so it's only done on request. This comes after hoisting
+     allocations, so that those end up inside the two versions, and
+     only the one that runs allocates anything. GPU kernels aren't
+     duplicated, and don't get an alignment check. *)
+  let suffix = ".stride.0" in
+  let dense_strides = StringIntSet.fold
+    (fun (n, _) l ->
+      let len = String.length n and slen = String.length suffix in
+      if len > slen && n.[0] = '.' && String.sub n (len - slen) slen = suffix then
+        n :: l
+      else l)
+    (find_names_in_stmt StringSet.empty 8 stmt) [] in
+  let buffer n = String.sub n 0 (String.length n - String.length suffix) in
+  let dense = List.fold_left
+    (fun stmt n -> subs_expr_in_stmt (Var (i32, n)) (IntImm 1) stmt)
+    stmt dense_strides in
+  let is_dense n = Var (i32, n) =~ IntImm 1
+  and is_aligned n = Var (i32, buffer n ^ ".host_misalignment") =~ IntImm 0 in
+  let gpu = Hoist_allocations.contains_simt_loop stmt in
+  let stmt =
+    if dense_strides = [] then stmt
+    else if any_layout && not gpu then
+      let dense_and_aligned n = And (is_dense n, is_aligned n) in
+      let all_dense = List.fold_left
+        (fun c n -> And (c, dense_and_aligned n))
+        (dense_and_aligned (List.hd dense_strides)) (List.tl dense_strides) in
+      Block [For (func ^ ".dense", IntImm 0, Select (all_dense, IntImm 1, IntImm 0), true, dense);
+             For (func ^ ".strided", IntImm 0, Select (all_dense, IntImm 0, IntImm 1), true, stmt)]
+    else
+      let hint = if gpu then "" else " (see Func::allowAnyLayout)" in
+      let check n =
+        Assert (is_dense n, "Buffer " ^ buffer n ^ " must be dense in its first dimension" ^ hint) ::
+          (if gpu then []
+           else [Assert (is_aligned n, "Buffer " ^ buffer n ^ " must be 64-byte aligned" ^ hint)]) in
+      Block (List.concat (List.map check dense_strides) @ [dense])
+  in
+
+  dump_stmt stmt pass pass_desc "dense_buffers" 1;
+
+  let pass = pass + 1 in
+
+  (* ----------------------------------------------- *)
+  let pass_desc = "Partitioning loops to remove clamps from the steady state" in
+  dbg 1 "%s\n%!" pass_desc;
+  let stmt = Partition_loops.partition_loops stmt in
+
+  dump_stmt stmt pass pass_desc "partition_loops" 1;
+
+  let pass = pass + 1 in
+
   (* ----------------------------------------------- *)
   let pass_desc = "Constant folding" in
   dbg 1 "%s\n%!" pass_desc;
   let stmt = Constant_fold.constant_fold_stmt stmt in
 
+  dump_stmt stmt pass pass_desc "constant_fold" 1;
+
+  let pass = pass + 1 in
+
+  (* ----------------------------------------------- *)
+  let pass_desc = "Hoisting loop invariants" in
+  dbg 1 "%s\n%!" pass_desc;
+  let stmt = Hoist_invariants.hoist_invariants stmt in
+
+  dump_stmt stmt pass pass_desc "hoist_invariants" 1;
+
+  let pass = pass + 1 in
+
+  (* ----------------------------------------------- *)
+  let pass_desc = "Eliminating common subexpressions" in
+  dbg 1 "%s\n%!" pass_desc;
+  let stmt = Cse.common_subexpression_elimination stmt in
+
   dump_stmt stmt pass pass_desc "final" 1;
 
   stmt
@@ -1,3 +1,5 @@
 (* Generate the realization of some function over the region specified
-   in the schedule tree. *)
-val lower_function : string -> Ir.environment -> Schedule.schedule_tree -> Ir.stmt
+   in the schedule tree. If any_layout is set, the result also handles
+   inputs and outputs that aren't dense in their first dimension or
+   64-byte aligned, instead of checking that they are. *)
+val lower_function : string -> Ir.environment -> Schedule.schedule_tree -> bool -> Ir.stmt
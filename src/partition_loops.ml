@@ -0,0 +1,180 @@
+open Ir
+open Analysis
+open Util
+
+(* Split loops that load from clamped indices into three:
+
+   For (i, min, n, order, ... Load (t, buf, clamp (f i, lo, hi)) ...)
+
+   becomes
+
+   LetStmt (i.prologue_end, <first i for which f i >= lo>,
+   LetStmt (i.epilogue_start, <one past the last i for which f i <= hi>,
+     Block [For (i, min, i.prologue_end - min, order, ... Load (..., clamp (f i, lo, hi)) ...);
+            For (i, i.prologue_end, i.epilogue_start - i.prologue_end, order,
+                 ... Load (..., f i) ...);
+            For (i, i.epilogue_start, min + n - i.epilogue_start, order,
+                 ... Load (..., clamp (f i, lo, hi)) ...)]))
+
+   In the middle loop the clamp does nothing, so we leave it out, and a
+   vectorized index goes back to being a dense ramp instead of a
+   gather. Boundary conditions then only cost anything at the edges.
+
+   Any of the three loops can have an extent of zero, most often the
+   first, when the clamp never fires at the low edge. Serial loops
+   with nothing to do are skipped (see cg_for), as are parallel ones.
+
+   We only handle clamps (any Min or Max, really) of something linear
+   in the loop variable against something that doesn't depend on it,
+   and only when everything involved is defined outside the loop. The
+   bounds of each lane of f come from Bounds. GPU loops are left alone.
+*)
+
+(* The coefficient of i in an affine int expression, if it is one *)
+let rec coefficient i expr =
+  let depends e = expr_contains_expr (Var (i32, i)) e in
+  match expr with
+    | Var (_, n) when n = i -> Some 1
+    | Let _ -> None
+    | e when not (depends e) -> Some 0
+    | Bop (Add, a, b) | Bop (Sub, a, b) -> begin
+        match (coefficient i a, coefficient i b) with
+          | (Some x, Some y) -> Some (match expr with Bop (Add, _, _) -> x + y | _ -> x - y)
+          | _ -> None
+      end
+    | Bop (Mul, a, IntImm k) | Bop (Mul, IntImm k, a)
+    | Bop (Mul, a, Broadcast (IntImm k, _)) | Bop (Mul, Broadcast (IntImm k, _), a) -> begin
+        match coefficient i a with
+          | Some x -> Some (x * k)
+          | None -> None
+      end
+    | Ramp (base, stride, _) when not (depends stride) -> coefficient i base
+    | Broadcast (e, _) -> coefficient i e
+    | _ -> None
+
+let is_int32 expr = element_val_type (val_type_of_expr expr) = i32
+
+(* The range of values taken by the lanes of a loop-invariant expr *)
+let lane_bounds expr =
+  match Bounds.bounds_of_expr "" (IntImm 0, IntImm 0) expr with
+    | Bounds.Range (min, max) ->
+        Some (Constant_fold.constant_fold_expr min, Constant_fold.constant_fold_expr max)
+    | Bounds.Unbounded -> None
+
+(* floor (a / k) and ceil (a / k) for a positive constant k. Mod is
+   always positive for positive k. *)
+let floor_div a k = if k = 1 then a else (a -~ (a %~ IntImm k)) /~ IntImm k
+let ceil_div a k = floor_div (a +~ IntImm (k-1)) k
+
+type constraint_t = Lower of expr | Upper of expr
+
+(* The names defined within a statement *)
+let rec names_defined_in = function
+  | For (name, _, _, _, body) -> StringSet.add name (names_defined_in body)
+  | LetStmt (name, _, body) -> StringSet.add name (names_defined_in body)
+  | Pipeline (name, _, _, produce, consume) ->
+      StringSet.add name (StringSet.union (names_defined_in produce) (names_defined_in consume))
+  | stmt -> fold_children_in_stmt (fun _ -> StringSet.empty) names_defined_in StringSet.union stmt
+
+(* Apply f to the children of expr, gathering up the constraints *)
+let mutate_and_collect f expr =
+  let constraints = ref [] in
+  let expr = mutate_children_in_expr (fun e ->
+    let (e, c) = f e in
+    constraints := !constraints @ c;
+    e) expr in
+  (expr, !constraints)
+
+(* Find the clamps in a load index that can be removed for some range
+   of the loop variable, returning the index without them and the
+   constraints on i under which that's valid *)
+let rec strip_clamps i inner_names expr =
+  let invariant e =
+    not (expr_contains_expr (Var (i32, i)) e) &&
+    StringSet.is_empty (find_loads_in_expr e) &&
+    not (StringIntSet.exists (fun (n, _) -> StringSet.mem n inner_names)
+           (find_names_in_expr StringSet.empty 8 e)) in
+  match expr with
+    | Bop ((Min | Max) as op, a, b) when is_int32 expr ->
+        let (a, ca) = strip_clamps i inner_names a
+        and (b, cb) = strip_clamps i inner_names b in
+        let (e, bound) = if invariant b then (a, b) else (b, a) in
+        (* The lanes of e are s*i plus the lanes of e at i = 0 *)
+        let e0 = Constant_fold.constant_fold_expr (subs_expr (Var (i32, i)) (IntImm 0) e) in
+        let unchanged = (Bop (op, a, b), ca @ cb) in
+        begin match coefficient i e with
+          | Some s when s <> 0 && invariant bound && invariant e0 -> begin
+              match (lane_bounds e0, lane_bounds bound) with
+                | (Some (e_min, e_max), Some (b_min, b_max)) ->
+                    let c = match (op, s > 0) with
+                      (* Min (e, b) = e when s*i + e_max <= b_min *)
+                      | (Min, true) -> Upper (floor_div (b_min -~ e_max) s)
+                      | (Min, false) -> Lower (ceil_div (e_max -~ b_min) (-s))
+                      (* Max (e, b) = e when s*i + e_min >= b_max *)
+                      | (Max, true) -> Lower (ceil_div (b_max -~ e_min) s)
+                      | (Max, false) -> Upper (floor_div (e_min -~ b_max) (-s))
+                      | _ -> assert false
+                    in
+                    (e, c :: (ca @ cb))
+                | _ -> unchanged
+            end
+          | _ -> unchanged
+        end
+    | _ -> mutate_and_collect (strip_clamps i inner_names) expr
+
+(* Only clamps in load indices count, not ones in the values
+   computed. strip_clamps handles any loads nested in the index. *)
+let rec strip_clamps_in_loads i inner_names expr =
+  match expr with
+    | Load (t, buf, idx) ->
+        let (idx, c) = strip_clamps i inner_names idx in
+        (Load (t, buf, idx), c)
+    | _ -> mutate_and_collect (strip_clamps_in_loads i inner_names) expr
+
+let strip_clamps_in_stmt i inner_names stmt =
+  let constraints = ref [] in
+  let rec mutate_stmt stmt = mutate_children_in_stmt mutate_expr mutate_stmt stmt
+  and mutate_expr expr =
+    let (expr, c) = strip_clamps_in_loads i inner_names expr in
+    constraints := !constraints @ c;
+    expr in
+  let stmt = mutate_stmt stmt in
+  (stmt, !constraints)
+
+let partition_loop = function
+  | For (i, min, n, order, body) as stmt ->
+      let inner_names = names_defined_in body in
+      let (steady, constraints) = strip_clamps_in_stmt i inner_names body in
+      let fold = Constant_fold.constant_fold_expr in
+      let uniq l = List.fold_left (fun l x -> if List.mem x l then l else l @ [x]) [] l in
+      let lowers = uniq (List.concat (List.map (function Lower e -> [fold e] | _ -> []) constraints))
+      and uppers = uniq (List.concat (List.map (function Upper e -> [fold e] | _ -> []) constraints)) in
+      if lowers = [] && uppers = [] then stmt else begin
+        dbg 2 "Partitioning loop over %s\n%!" i;
+        let loop_end = min +~ n in
+        let clamp e lo hi = Bop (Max, Bop (Min, e, hi), lo) in
+        let prologue_end = i ^ ".prologue_end" and epilogue_start = i ^ ".epilogue_start" in
+        let pe = Var (i32, prologue_end) and es = Var (i32, epilogue_start) in
+        let pe_value = match lowers with
+          | [] -> min
+          | l::rest -> clamp (List.fold_left (fun a b -> Bop (Max, a, b)) l rest) min loop_end in
+        let es_value = match uppers with
+          | [] -> loop_end
+          | u::rest -> clamp (List.fold_left (fun a b -> Bop (Min, a, b)) u rest +~ IntImm 1) pe loop_end in
+        let loops =
+          (if lowers = [] then [] else [For (i, min, pe -~ min, order, body)]) @
+          [For (i, pe, es -~ pe, order, steady)] @
+          (if uppers = [] then [] else [For (i, es, loop_end -~ es, order, body)]) in
+        LetStmt (prologue_end, fold pe_value,
+                 LetStmt (epilogue_start, fold es_value, Block loops))
+      end
+  | stmt -> stmt
+
+let rec partition stmt =
+  let stmt = mutate_children_in_stmt (fun x -> x) partition stmt in
+  match stmt with
+    | For _ -> partition_loop stmt
+    | _ -> stmt
+
+let partition_loops stmt =
+  if Hoist_allocations.contains_simt_loop stmt then stmt else partition stmt
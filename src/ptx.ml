@@ -424,6 +424,11 @@ let malloc con name count elem_size =
   set_field (Dim 2)   one;
   set_field (Dim 3)   one;
   set_field ElemSize  (cg_expr con elem_size);
+  set_field (Stride 0) one;
+  set_field (Stride 1) (cg_expr con count);
+  set_field (Stride 2) (cg_expr con count);
+  set_field (Stride 3) (cg_expr con count);
+  List.iter (fun i -> set_field (Min i) zero) [0; 1; 2; 3];
 
   con.arch_state.buf_add name buf;
 
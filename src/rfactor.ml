@@ -0,0 +1,157 @@
+open Ir
+open Analysis
+
+(* Rewrite associative reductions so that their update can run in
+   parallel, or in vectors, over one dimension of the reduction
+   domain. In both cases the update of f
+
+   f (args (r)) = f (args (r)) op e (r)     for r in [min, min + size)
+
+   is split between some partial results, each of which is a reduction
+   over part of r into a private copy of the result indexed by a new
+   pure variable s
+
+   partial (x..., s) = identity
+   partial (args (r'), s) = partial (args (r'), s) op e (r')     for i in [0, extent)
+
+   where r' depends on s and i, and the update of f becomes a
+   reduction over s that combines the copies
+
+   f (x...) = f (x...) op partial (x..., s)     for s in [0, slices)
+
+   op can be +, *, min or max, which covers sum, product, minimum,
+   maximum, += and *=. *)
+
+type reduction = {
+  args : (val_type * string) list;
+  return_type : val_type;
+  init : expr;
+  update_args : expr list;
+  update_func : string;
+  domain : (string * expr * expr) list;
+  op : binop;
+  value : expr;
+  identity : expr;
+  rmin : expr;
+  rsize : expr;
+}
+
+let find_reduction env func rvar =
+  let (args, return_type, body) = find_function func env in
+  let (init, update_args, update_func, domain) = match body with
+    | Reduce (init, update_args, update_func, domain) -> (init, update_args, update_func, domain)
+    | _ -> failwith (func ^ " is not a reduction")
+  in
+  let update_expr = match find_function update_func env with
+    | (_, _, Pure e) -> e
+    | _ -> failwith "The update step of a reduction must be pure"
+  in
+
+  let rec calls_self = function
+    | Call (_, n, _) when n = func -> true
+    | e -> fold_children_in_expr calls_self (||) false e
+  in
+  let self = Call (return_type, func, update_args) in
+  let (op, value) = match update_expr with
+    | Bop ((Add | Mul | Min | Max) as op, a, b) when a = self && not (calls_self b) -> (op, b)
+    | Bop ((Add | Mul | Min | Max) as op, a, b) when b = self && not (calls_self a) -> (op, a)
+    | _ -> failwith ("Can't split the update of " ^ func ^
+                        ", because it isn't of the form f(...) = f(...) op e for op one of +, *, min, max")
+  in
+
+  let suffix = match return_type with
+    | Int b -> "s" ^ string_of_int b
+    | UInt b -> "u" ^ string_of_int b
+    | Float b -> "f" ^ string_of_int b
+    | _ -> failwith "Reductions must return scalars"
+  in
+  let identity = match op with
+    | Add -> make_zero return_type
+    | Mul -> make_one return_type
+    | Min -> Call (return_type, ".maxval_" ^ suffix, [])
+    | Max -> Call (return_type, ".minval_" ^ suffix, [])
+    | _ -> assert false
+  in
+
+  let (rmin, rsize) =
+    try let (_, m, s) = List.find (fun (n, _, _) -> n = rvar) domain in (m, s)
+    with Not_found -> failwith (rvar ^ " is not in the reduction domain of " ^ func)
+  in
+  {args = args; return_type = return_type; init = init; update_args = update_args;
+   update_func = update_func; domain = domain; op = op; value = value; identity = identity;
+   rmin = rmin; rsize = rsize}
+
+(* Add a partial result called name, with update step update_name, in
+   which rvar is replaced by inner in [0, extent) and index in terms of
+   inner and the slice. Where guard is given, the update only applies
+   where it's true. The slice is the first argument when slice_first
+   is set, and the last otherwise. *)
+let add_partial env red rvar (name, update_name) slice slice_first (inner, extent) index guard =
+  let with_slice l x = if slice_first then x :: l else l @ [x] in
+  let subs = subs_expr (Var (i32, rvar)) index in
+  let partial_args = with_slice (List.map subs red.update_args) (Var (i32, slice)) in
+  let value = match guard with
+    | Some g -> Select (g, subs red.value, red.identity)
+    | None -> subs red.value
+  in
+  let domain = List.map (fun (n, m, s) ->
+    if n = rvar then (inner, IntImm 0, extent) else (n, m, s)) red.domain in
+  let update_args = List.concat (List.map (function
+    | Var (t, n) when not (List.exists (fun (m, _, _) -> m = n) domain) -> [(t, n)]
+    | _ -> []) partial_args) in
+  let rt = red.return_type in
+  let env = Environment.add update_name
+    (update_name, update_args, rt, Pure (Bop (red.op, Call (rt, name, partial_args), value))) env in
+  Environment.add name
+    (name, with_slice red.args (i32, slice), rt,
+     Reduce (red.identity, partial_args, update_name, domain)) env
+
+(* Make the update of func a reduction over slice in [0, slices) of
+   the given combination of the partial results *)
+let set_merge env func red slice slices combine =
+  let vars = List.map (fun (t, n) -> Var (t, n)) red.args in
+  let merge = Bop (red.op, Call (red.return_type, func, vars), combine vars) in
+  let env = Environment.add red.update_func (red.update_func, red.args, red.return_type, Pure merge) env in
+  Environment.add func
+    (func, red.args, red.return_type,
+     Reduce (red.init, vars, red.update_func, [(slice, IntImm 0, IntImm slices)])) env
+
+(* Split r into contiguous slices that can each be reduced by a
+   different thread. The slice is the outermost dimension of the
+   partial result, so threads don't share cache lines. Slices that run
+   past the end of r are clamped back into it, and do nothing. *)
+let rfactor env func rvar slices (partial, partial_update, slice, inner) =
+  let red = find_reduction env func rvar in
+  let chunk = (red.rsize +~ IntImm (slices - 1)) /~ IntImm slices in
+  let unclamped = red.rmin +~ (Var (i32, slice) *~ chunk) +~ Var (i32, inner) in
+  let clamped = Bop (Min, unclamped, red.rmin +~ red.rsize -~ IntImm 1) in
+  let env = add_partial env red rvar (partial, partial_update) slice false (inner, chunk) clamped
+    (Some (Cmp (LT, unclamped, red.rmin +~ red.rsize))) in
+  set_merge env func red slice slices (fun vars ->
+    Call (red.return_type, partial, vars @ [Var (i32, slice)]))
+
+(* Interleave r across the lanes of a vector: lane s of the main
+   partial result reduces r = min + i*width + s. The slice is the
+   innermost dimension, so the main partial result can be vectorized
+   over it with dense loads and stores. The last size mod width values
+   of r go one per lane into a second, scalar, partial result, and the
+   update of f does the horizontal reduction over the lanes. Only
+   updates that don't scatter can be split this way, because the lanes
+   of a vector store can't collide. *)
+let vectorize_reduction env func rvar width (main, main_update, tail, tail_update, lane, inner) =
+  let red = find_reduction env func rvar in
+  let scatters = List.exists (function
+    | Var (_, n) -> List.exists (fun (m, _, _) -> m = n) red.domain
+    | _ -> true) red.update_args in
+  if scatters then
+    failwith ("Can't vectorize the update of " ^ func ^ " over " ^ rvar ^ ", because it's a scatter");
+  let w = IntImm width and s = Var (i32, lane) in
+  let whole = (red.rsize /~ w) *~ w in
+  let env = add_partial env red rvar (main, main_update) lane true
+    (inner, red.rsize /~ w) (red.rmin +~ (Var (i32, inner) *~ w) +~ s) None in
+  let leftover = red.rmin +~ whole +~ s in
+  let env = add_partial env red rvar (tail, tail_update) lane true
+    (inner, IntImm 1) (Bop (Min, leftover, red.rmin +~ red.rsize -~ IntImm 1))
+    (Some (Cmp (LT, leftover, red.rmin +~ red.rsize))) in
+  set_merge env func red lane width (fun vars ->
+    Bop (red.op, Call (red.return_type, main, s :: vars), Call (red.return_type, tail, s :: vars)))
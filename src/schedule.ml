@@ -23,9 +23,22 @@ generality?
  * be handled. *) 
 type dimension = string
 
+(* What to do with the last iteration of a split when the factor
+   doesn't divide the extent. The expr is the extent of the dimension
+   being split. *)
+type tail_strategy =
+  (* Compute past the end of the extent *)
+  | RoundUp
+  (* Shift the last iteration back so it ends at the end of the
+     extent, recomputing some values. If the extent is smaller than
+     the factor, this is the same as RoundUp. *)
+  | ShiftInward of expr
+  (* Do the leftovers with a serial loop after the whole iterations *)
+  | Epilogue of expr
+
 type schedule = 
-  (* dimension, names of dimensions introduced, min of old dimension *)
-  | Split of dimension * dimension * dimension * expr
+  (* dimension, names of dimensions introduced, min of old dimension, what to do with the tail *)
+  | Split of dimension * dimension * dimension * expr * tail_strategy
   (* Serialize across a dimension between the specified bounds *)
   | Serial     of dimension * expr * expr
   | Parallel   of dimension * expr * expr
@@ -37,6 +50,7 @@ type schedule =
  * should I hoist this out to, and should I fuse with other calls to the same callee *)
 type call_schedule =
   | Chunk of dimension (* of caller *)
+  | Sliding of dimension (* of caller - like chunk, but only computes what the last iteration didn't *)
   | Inline (* block over nothing - just do in place *)
   | Root (* There is no calling context *)
   | Reuse of string (* Just do what some other function does, using the same data structure *)
@@ -54,7 +68,7 @@ let rec stride_for_dim dim = function
         | Parallel (d, min, n) when d = dim -> (min,n)
         | Unrolled (d, min, n)
         | Vectorized (d, min, n) when d = dim -> (min, IntImm n)
-        | Split (d, outer, inner, offset) when d = dim ->
+        | Split (d, outer, inner, offset, _) when d = dim ->
             (* search for new dimensions on rest of the sched list -
              they are only allowed after defined by the split *)
             let (min_outer, size_outer) = stride_for_dim outer rest in
@@ -140,13 +154,20 @@ let list_of_schedule (tree:schedule_tree) =
 
 let string_of_call_schedule = function
   | Chunk d -> "Chunk " ^ d 
+  | Sliding d -> "Sliding " ^ d
   | Inline -> "Inline"
   | Root -> "Root"      
   | Reuse s -> "Reuse " ^ s
 
+let string_of_tail_strategy = function
+  | RoundUp -> "RoundUp"
+  | ShiftInward size -> "ShiftInward " ^ (string_of_expr size)
+  | Epilogue size -> "Epilogue " ^ (string_of_expr size)
+
 let string_of_schedule = function
-  | Split (d, d_o, d_i, offset) ->
-      "Split " ^ d ^ " " ^ d_o ^ " " ^ d_i ^ " " ^ (string_of_expr offset)
+  | Split (d, d_o, d_i, offset, tail) ->
+      "Split " ^ d ^ " " ^ d_o ^ " " ^ d_i ^ " " ^ (string_of_expr offset) ^ " " ^
+        (string_of_tail_strategy tail)
   | Serial (d, min, n) ->
       "Serial "     ^ d ^ " " ^ (string_of_expr min) ^ " " ^ (string_of_expr n)
   | Parallel (d, min, n) ->
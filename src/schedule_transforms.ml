@@ -167,7 +167,7 @@ let generate_schedule (func: string) (env: environment) (guru: scheduling_guru)
     (* prune stuff we're outside *)
     let vars_in_scope = match call_sched with
       | Root -> []
-      | Chunk var -> list_drop_while (fun x -> x <> var) vars_in_scope
+      | Chunk var | Sliding var -> list_drop_while (fun x -> x <> var) vars_in_scope
       | Reuse _ (* doesn't matter - never used because it has no children *)
       | Inline -> vars_in_scope
     in
@@ -198,7 +198,7 @@ let generate_schedule (func: string) (env: environment) (guru: scheduling_guru)
       
     let bufs_in_scope = match call_sched with
       | Root -> add_realization "" bufs_in_scope
-      | Chunk var -> add_realization var bufs_in_scope
+      | Chunk var | Sliding var -> add_realization var bufs_in_scope
       | Reuse _
       | Inline -> bufs_in_scope
     in
@@ -458,20 +458,30 @@ let parallel_schedule (func: string) (var: string) (guru: scheduling_guru) =
   in mutate_sched_list_guru func (List.map mutate) serialized guru
 
 
-let split_schedule (func: string) (var: string) (outer: string) (inner: string) (n: expr) (guru: scheduling_guru) =
+(* tail says what to do when n doesn't divide the extent of var:
+   "round_up" (or "") computes past the end, "shift_inward" moves the
+   last iteration back to end at the end of the extent, and "epilogue"
+   does the leftovers in a serial loop afterwards. *)
+let split_schedule (func: string) (var: string) (outer: string) (inner: string) (n: expr) (tail: string) (guru: scheduling_guru) =
   let int_n = match n with
     | IntImm x -> x
     | _ -> failwith "Can only handle const integer splits for now"
   in
-  let serialized = Printf.sprintf "split %s %s %s %s %d" func var outer inner int_n in
+  let tail_strategy size = match tail with
+    | "" | "round_up" -> RoundUp
+    | "shift_inward" -> ShiftInward size
+    | "epilogue" -> Epilogue size
+    | _ -> failwith ("Unknown tail strategy for split: " ^ tail)
+  in
+  let serialized = Printf.sprintf "split %s %s %s %s %d %s" func var outer inner int_n tail in
   let rec mutate = function
     | (Parallel (v, min, size))::rest when v = var ->
-        (Split (v, outer, inner, min))::
+        (Split (v, outer, inner, min, tail_strategy size))::
           (Parallel (inner, IntImm 0, n))::
           (Parallel (outer, IntImm 0, (size +~ n -~ (IntImm 1)) /~ n))::
           rest
     | (Serial (v, min, size))::rest when v = var -> 
-        (Split (v, outer, inner, min))::
+        (Split (v, outer, inner, min, tail_strategy size))::
           (Serial (inner, IntImm 0, n))::
           (Serial (outer, IntImm 0, (size +~ n -~ (IntImm 1)) /~ n))::
           rest
@@ -529,8 +539,19 @@ let chunk_schedule (func: string) (var: string) (guru: scheduling_guru) =
     | _ -> failwith ("Could not schedule " ^ func ^ " as chunked over " ^ var)
   in mutate_legal_call_schedules_guru func (mutate None) serialized guru
 
+(* Like chunk, but keep the values computed in one iteration of var
+   around for the next, and only compute the new ones *)
+let slide_schedule (func: string) (var: string) (guru: scheduling_guru) = 
+  let serialized = Printf.sprintf "slide %s %s" func var in
+  let rec mutate x l = match (x, l) with
+    | (None, (Chunk v)::rest) when base_name v = var -> mutate (Some (Sliding v)) rest
+    | (_, first::rest) -> mutate x rest
+    | (Some x, []) -> [x]
+    | _ -> failwith ("Could not schedule " ^ func ^ " as sliding over " ^ var)
+  in mutate_legal_call_schedules_guru func (mutate None) serialized guru
+
 let random_schedule (func: string) (seed: int) (guru: scheduling_guru) = {
-  serialized = (Printf.sprintf "random %s %d" func seed)::(guru.serialized);
+  serialized = guru.serialized @ [Printf.sprintf "random %s %d" func seed];
   decide = fun f env legal_call_scheds ->
     let random_choice list = List.nth list (Random.int (List.length list)) in
     if (base_name f = func) then begin
@@ -554,7 +575,7 @@ let random_schedule (func: string) (seed: int) (guru: scheduling_guru) = {
           let factor = random_choice [4; 8; 16] in
           let rec mutate = function
             | (Serial (v, min, size))::rest -> (* TODO: this may not be legal for reduction vars *)
-                (Split (v, n2, n1, min))::
+                (Split (v, n2, n1, min, RoundUp))::
                   (Vectorized (n1, IntImm 0, factor))::
                   (Serial (n2, IntImm 0, (size +~ (IntImm (factor-1))) /~ (IntImm factor)))::
                   rest
@@ -567,7 +588,7 @@ let random_schedule (func: string) (seed: int) (guru: scheduling_guru) = {
           let factor = random_choice [2; 3; 4] in
           let rec mutate = function
             | (Serial (v, min, size))::rest -> 
-                (Split (v, n2, n1, min))::
+                (Split (v, n2, n1, min, RoundUp))::
                   (Unrolled (n1, IntImm 0, factor))::
                   (Serial (n2, IntImm 0, (size +~ (IntImm (factor-1))) /~ (IntImm factor)))::
                   rest
@@ -612,12 +633,12 @@ let random_schedule (func: string) (seed: int) (guru: scheduling_guru) = {
                 let rec make_split idx l = match (idx, l) with
                   | (_, []) -> []
                   | (0, (Serial (v, min, size))::rest) -> 
-                      (Split (v, n2, n1, min))::
+                      (Split (v, n2, n1, min, RoundUp))::
                         (Serial (n1, IntImm 0, IntImm factor))::
                         (Serial (n2, IntImm 0, (size +~ (IntImm (factor-1))) /~ (IntImm factor)))::
                         rest
                   | (0, (Parallel (v, min, size))::rest) -> 
-                      (Split (v, n2, n1, min))::
+                      (Split (v, n2, n1, min, RoundUp))::
                         (Parallel (n1, IntImm 0, IntImm factor))::
                         (Parallel (n2, IntImm 0, (size +~ (IntImm (factor-1))) /~ (IntImm factor)))::
                         rest                      
@@ -630,22 +651,301 @@ let random_schedule (func: string) (seed: int) (guru: scheduling_guru) = {
     end else guru.decide f env legal_call_scheds
 }
 
+(* An analytical scheduler for the whole pipeline. Each function is
+   inlined if recomputing it at every call site costs less than
+   storing it once and loading it back at each one, counting the
+   arithmetic in it and in everything inlined into it. Functions worth
+   storing that their consumer reads as a stencil in y are computed per
+   strip of the consumer's rows (or per tile, if a strip's worth won't
+   fit in cache), and everything else that's stored goes at the
+   root. Stored pure functions get their innermost dimension
+   vectorized, and ones computed at the root get their outermost
+   dimension parallelized. sizes is the size of the output we expect
+   to be asked for, which we also use as a guess for the size of
+   everything else, and vector_bytes is the width of the target's
+   vector registers. Any option list already narrowed down to one
+   choice (e.g. by a hand-written chunk or root) is respected. *)
+
+(* The cost of storing or loading a value, in arithmetic ops *)
+let auto_memory_cost = 3
+(* The cost of a call to an extern math function *)
+let auto_extern_cost = 10
+(* How much the intermediates for one strip or tile should take *)
+let auto_cache_bytes = 256 * 1024
+(* Strips recompute at most 1/auto_redundancy of their rows *)
+let auto_redundancy = 4
+
+let auto_schedule (func: string) (sizes: int list) (vector_bytes: int) (guru: scheduling_guru) = 
+  let serialized = Printf.sprintf "auto %s %d %s" func vector_bytes
+    (String.concat "," (List.map string_of_int sizes)) in
+
+  let size_guess dim = try List.nth sizes dim with _ -> 1 in
+
+  let rec pow2_at_least x n = if n >= x then n else pow2_at_least x (n*2) in
+  let rec pow2_at_most x n = if n*2 > x then n else pow2_at_most x (n*2) in
+
+  (* Arithmetic in an expr, not counting the functions it calls *)
+  let rec arithmetic_cost = function
+    | IntImm _ | UIntImm _ | FloatImm _ | Var _ -> 0
+    | Call (_, name, args) ->
+        List.fold_left (fun c e -> c + arithmetic_cost e)
+          (if name.[0] = '.' then auto_extern_cost else 0) args
+    | x -> 1 + fold_children_in_expr arithmetic_cost (+) 0 x
+  in
+
+  (* The calls to other functions in an expr as (name, args) *)
+  let rec calls_in_expr f = function
+    | Call (_, name, args) when name.[0] = '.' || List.mem name (split_name f) ->
+        List.concat (List.map (calls_in_expr f) args)
+    | Call (_, name, args) -> (name, args)::(List.concat (List.map (calls_in_expr f) args))
+    | x -> fold_children_in_expr (calls_in_expr f) (@) [] x
+  in
+
+  (* The exprs making up a definition, and the calls in them. The
+     update step of a reduction is its own function. *)
+  let exprs_of f env = match find_function f env with
+    | (_, _, Pure e) -> [e]
+    | (_, _, Reduce (init, update_args, _, _)) -> init::update_args
+    | (_, _, Extern) -> []
+  in
+  let calls_of f env =
+    let calls = List.concat (List.map (calls_in_expr f) (exprs_of f env)) in
+    List.fold_left (fun l c -> if List.mem c l then l else l @ [c]) [] calls
+  in
+
+  let is_pure f env = match find_function f env with
+    | (_, _, Pure _) -> true
+    | _ -> false
+  in
+
+  let is_reduction_update f env =
+    String.contains f '.' &&
+      match find_function (parent_name f) env with
+        | (_, _, Reduce (_, _, update_func, _)) -> update_func = base_name f
+        | _ -> false
+  in
+
+  let elem_bytes f env =
+    let (_, t, _) = find_function f env in (bit_width t + 7) / 8
+  in
+
+  (* The cost of computing one value of f, including everything
+     inlined into it *)
+  let costs = Hashtbl.create 16 in
+  let rec cost f env =
+    try Hashtbl.find costs f with Not_found -> begin
+      let own = List.fold_left (fun c e -> c + arithmetic_cost e) 0 (exprs_of f env) in
+      let c = List.fold_left (fun c (name, _) ->
+        let g = f ^ "." ^ name in
+        c + (if should_inline g env then cost g env else auto_memory_cost)) own (calls_of f env) in
+      Hashtbl.add costs f c;
+      c
+    end
+
+  and should_inline g env =
+    is_pure g env && not (is_reduction_update g env) &&
+      let sites = List.length (List.filter (fun (name, _) -> name = base_name g)
+                                 (calls_of (parent_name g) env)) in
+      let c = cost g env in
+      sites * c <= c + auto_memory_cost * (sites + 1)
+  in
+
+  (* If every call to g from its parent reads the parent's y plus a
+     constant in g's y, the range of those constants *)
+  let stencil_in_y g env =
+    let p = parent_name g in
+    let (p_args, _, _) = find_function p env in
+    if List.length p_args < 2 then None else begin
+      let y = snd (List.nth p_args 1) in
+      let offset arg =
+        let at v = Constant_fold.constant_fold_expr (subs_expr (Var (i32, y)) (IntImm v) arg) in
+        match (at 0, at 1, at 2) with
+          | (IntImm a, IntImm b, IntImm c) when b = a + 1 && c = a + 2 -> Some a
+          | _ -> None
+      in
+      let offsets = List.map (fun (_, args) ->
+        if List.length args < 2 then None else offset (List.nth args 1))
+        (List.filter (fun (name, _) -> name = base_name g) (calls_of p env)) in
+      if List.mem None offsets then None else begin
+        let offsets = List.map (function Some x -> x | None -> 0) offsets in
+        Some (List.fold_left min max_int offsets, List.fold_left max min_int offsets)
+      end
+    end
+  in
+
+  let callees f env = List.map (fun (name, _) -> f ^ "." ^ name) (calls_of f env) in
+
+  (* The stored functions called from f that could be computed per
+     strip of f, directly or via ones inlined into f, with the number
+     of extra rows each needs *)
+  let rec strip_members f env =
+    List.concat (List.map (fun g ->
+      match stencil_in_y g env with
+        | None -> []
+        | Some (lo, hi) ->
+            let inner = List.map (fun (h, extra) -> (h, extra + hi - lo)) (strip_members g env) in
+            if should_inline g env then inner
+            else if is_pure g env then (g, hi - lo)::inner
+            else []) (callees f env))
+  in
+
+  (* How to split up a function computed at the root: Some (rows per
+     strip, columns per tile if we tile) *)
+  let strip_plan f env =
+    let members = strip_members f env in
+    let (args, _, _) = find_function f env in
+    if members = [] || List.length args < 2 || not (is_pure f env) then None else begin
+      let halo = List.fold_left (fun h (_, extra) -> max h extra) 0 members in
+      let bytes = List.fold_left (fun b (g, _) -> b + elem_bytes g env) 0 members in
+      let rows = pow2_at_least (max 8 (auto_redundancy * halo)) 1 in
+      let width = size_guess 0 and height = size_guess 1 in
+      if height < 2 * rows then None else begin
+        let lanes = max 1 (vector_bytes / (elem_bytes f env)) in
+        let strip_bytes = width * bytes * (rows + halo) in
+        if strip_bytes <= auto_cache_bytes then Some (rows, None) else begin
+          let cols = pow2_at_most (auto_cache_bytes / (bytes * (rows + halo))) 1 in
+          let cols = max cols (4 * lanes) in
+          if cols >= width then Some (rows, None) else Some (rows, Some cols)
+        end
+      end
+    end
+  in
+
+  let arg_name f env n = let (args, _, _) = find_function f env in snd (List.nth args n) in
+
+  (* Where f's strippable callees are computed: the loop over tiles or
+     strips of f, or wherever f itself is computed *)
+  let strip_var f env call_sched =
+    match call_sched with
+      | Chunk v -> Some v
+      | Root -> begin match strip_plan f env with
+          | Some (_, Some _) -> Some (f ^ "." ^ (arg_name f env 0) ^ "_outer")
+          | Some (_, None) -> Some (f ^ "." ^ (arg_name f env 1))
+          | None -> None
+        end
+      | _ -> None
+  in
+
+  (* The call schedule of every function decided so far *)
+  let decided = Hashtbl.create 16 in
+
+  (* The loop to compute a stored function called from p in, looking
+     through the functions inlined into others *)
+  let rec owner_var p env =
+    try
+      match Hashtbl.find decided p with
+        | Inline when stencil_in_y p env <> None -> owner_var (parent_name p) env
+        | Inline -> None
+        | call_sched -> strip_var p env call_sched
+    with Not_found -> None
+  in
+
+  let choose f env options =
+    if List.length options = 1 then List.hd options
+    else if not (String.contains f '.') then Root
+    else if List.mem Inline options && should_inline f env then Inline
+    else begin
+      let chunk = 
+        if is_pure f env && stencil_in_y f env <> None then begin
+          match owner_var (parent_name f) env with
+            | Some v when List.mem (Chunk v) options -> Some (Chunk v)
+            | _ -> None
+        end else None
+      in
+      match chunk with
+        | Some c -> c
+        | None -> if List.mem Root options then Root else List.hd options
+    end
+  in
+
+  (* Vectorize the innermost dimension of a stored function across
+     each tile (or the whole row), and split it into tiles and strips
+     if there's a plan for that. The sizes are only guesses, and the
+     real extent may be smaller than a vector or a strip, so the
+     splits do their leftovers in scalar epilogues. *)
+  let mutate_sched_list f env call_sched sched_list =
+    let lanes = vector_bytes / (elem_bytes f env) in
+    let width = size_guess 0 and height = size_guess 1 in
+    let vectorize x min size =
+      if lanes < 2 || width < lanes then [Serial (x, min, size)] else 
+        [Split (x, x, x ^ "_vec", min, Epilogue size);
+         Vectorized (x ^ "_vec", IntImm 0, lanes);
+         Serial (x, IntImm 0, (size +~ IntImm (lanes - 1)) /~ IntImm lanes)]
+    in
+    let plan = if call_sched = Root then strip_plan f env else None in
+    let sched_list = match (plan, sched_list) with
+      | (Some (rows, cols), (Serial (x, xmin, xsize))::(Serial (y, ymin, ysize))::rest) ->
+          let (x_outer, x_inner) = (x ^ "_outer", x ^ "_inner") in
+          let x_loops = match cols with
+            | Some cols ->
+                [Split (x, x_outer, x_inner, xmin, Epilogue xsize)] @
+                  (if lanes >= 2 then
+                      [Split (x_inner, x_inner, x ^ "_vec", IntImm 0, RoundUp);
+                       Vectorized (x ^ "_vec", IntImm 0, lanes);
+                       Serial (x_inner, IntImm 0, IntImm (cols / lanes))]
+                   else [Serial (x_inner, IntImm 0, IntImm cols)])
+            | None -> vectorize x xmin xsize
+          in
+          let tile_loop = match cols with
+            | Some cols -> [Serial (x_outer, IntImm 0, (xsize +~ IntImm (cols - 1)) /~ IntImm cols)]
+            | None -> []
+          in
+          x_loops @
+            [Split (y, y, y ^ "_strip", ymin, Epilogue ysize);
+             Serial (y ^ "_strip", IntImm 0, IntImm rows)] @
+            tile_loop @
+            [Serial (y, IntImm 0, (ysize +~ IntImm (rows - 1)) /~ IntImm rows)] @
+            rest
+      | (None, (Serial (x, xmin, xsize))::rest) -> (vectorize x xmin xsize) @ rest
+      | _ -> sched_list
+    in
+    (* Parallelize the outermost loop of things computed at the root,
+       as long as there's more than one dimension *)
+    let (args, _, _) = find_function f env in
+    if call_sched = Root && List.length args > 1 && height > 1 then
+      match List.rev sched_list with
+        | (Serial (v, min, size))::rest -> List.rev ((Parallel (v, min, size))::rest)
+        | _ -> sched_list
+    else sched_list
+  in
+
+  {
+    serialized = guru.serialized @ [serialized];
+    decide = fun f env options ->
+      let choice = choose f env options in
+      let (call_sched, sched_list) = guru.decide f env [choice] in
+      Hashtbl.replace decided f call_sched;
+      dbg 2 "Auto-scheduler chose %s for %s\n%!" (string_of_call_schedule call_sched) f;
+      if is_pure f env && not (is_reduction_update f env) && sched_list <> [] then
+        (call_sched, mutate_sched_list f env call_sched sched_list)
+      else
+        (call_sched, sched_list)
+  }
+
 let parse_guru (str: string list) =
   let parse_next guru str = 
-    let first_space = String.index str ' ' in
+    let first_space = try String.index str ' ' with Not_found -> String.length str in
     let guru_type = String.sub str 0 first_space in
     match guru_type with
       | "novice"    -> novice
       | "root"      -> (Scanf.sscanf str "root %s" root_schedule) guru
-      | "split"     -> Scanf.sscanf str "split %s %s %s %s %d" 
-          (fun func var outer inner n ->
-            split_schedule func var outer inner (IntImm n) guru)
+      | "split"     -> Scanf.sscanf str "split %s %s %s %s %d %s" 
+          (fun func var outer inner n tail ->
+            split_schedule func var outer inner (IntImm n) tail guru)
+      | "bound"     -> Scanf.sscanf str "bound %s %s %d %d"
+          (fun func var min size ->
+            bound_schedule func var (IntImm min) (IntImm size) guru)
       | "chunk"     -> (Scanf.sscanf str "chunk %s %s" chunk_schedule) guru
+      | "slide"     -> (Scanf.sscanf str "slide %s %s" slide_schedule) guru
       | "transpose" -> (Scanf.sscanf str "transpose %s %s %s" transpose_schedule) guru
       | "vectorize" -> (Scanf.sscanf str "vectorize %s %s" vectorize_schedule) guru
       | "unroll"    -> (Scanf.sscanf str "unroll %s %s" unroll_schedule) guru
       | "parallel"  -> (Scanf.sscanf str "parallel %s %s" parallel_schedule) guru
       | "random"    -> (Scanf.sscanf str "random %s %d" random_schedule) guru
+      | "auto"      -> Scanf.sscanf str "auto %s %d %s"
+          (fun func vector_bytes sizes ->
+            let sizes = List.map int_of_string (Str.split (Str.regexp ",") sizes) in
+            auto_schedule func sizes vector_bytes guru)
       | _ -> failwith ("Unrecognized guru type: " ^ str)
   in
   List.fold_left parse_next novice str 
@@ -33,3 +33,31 @@ let _ =
     let (a, b, c, d) = hash_expr e in
     Printf.printf "Expr: %s\nHash: %d %d %d %d\n\n%!" (string_of_expr e) a b c d)
   test_set
+
+(* The same pipeline built twice with different names should
+   canonicalize to the same thing *)
+let _ =
+  let entry f v i = 
+    let x = f ^ "." ^ v in
+    (f, [Buffer ("." ^ i); Buffer ".result"], 
+     For (x, IntImm 0, Var (i32, ".result.dim.0"), true,
+          Store (Load (i32, "." ^ i, Var (i32, x)) +~ (IntImm 1), ".result", Var (i32, x)))) in
+  let a = canonicalize_entrypoint (entry "f0" "v0" "i0")
+  and b = canonicalize_entrypoint (entry "f7" "v12" "i3") in
+  let (a1, a2, a3, a4) = hash_entrypoint a 
+  and (b1, b2, b3, b4) = hash_entrypoint b in
+  Printf.printf "Entrypoint hashes: %d %d %d %d\n                   %d %d %d %d\n%!" 
+    a1 a2 a3 a4 b1 b2 b3 b4;
+  assert (a = b)
+
+(* Only names the front-end generates are renamed, including inside
+   the text of asserts, and other names are kept *)
+let _ =
+  let entry f i =
+    ("x1", [Buffer ("." ^ i)],
+     Assert (Var (i32, "x1") >~ (IntImm 0), f ^ ".x(" ^ i ^ "[0]) out of bounds")) in
+  let (name, _, stmt) as a = canonicalize_entrypoint (entry "f3" "i2")
+  and b = canonicalize_entrypoint (entry "f5" "i9") in
+  Printf.printf "Canonical assert: %s\n%!" (string_of_stmt stmt);
+  assert (name = "x1");
+  assert (a = b)
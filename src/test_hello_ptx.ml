@@ -21,7 +21,7 @@ let _ =
   
   let f_call_sched = Root in
   let f_sched = [
-    Split ("x", "blockidx", "threadidx", IntImm 0);
+    Split ("x", "blockidx", "threadidx", IntImm 0, RoundUp);
     Parallel ("threadidx", IntImm 0, IntImm block_size);
     Parallel ("blockidx", IntImm 0, (Var (i32, ".N")) /~ (IntImm block_size));
   ] in
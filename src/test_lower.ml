@@ -16,7 +16,7 @@ let _ =
   (* let f_sched = [Split ("x", "xo", "xi", (Var (i32, "g.xo") *~ (IntImm 4)) -~ (IntImm 1));
                  Vectorized ("xi", IntImm 0, 4); Unrolled ("xo", IntImm 0, 2)] in  *)
 
-  let f_sched = [Split ("x", "fxo", "fxi", ((Var (i32, "gxo")) *~ (IntImm 4)) -~ one);
+  let f_sched = [Split ("x", "fxo", "fxi", ((Var (i32, "gxo")) *~ (IntImm 4)) -~ one, RoundUp);
                  Vectorized ("fxi", IntImm 0, 4);
                  Unrolled ("fxo", IntImm 0, 2)
                 ] in 
@@ -24,7 +24,7 @@ let _ =
   let g = ("g", [(i32, "x")], f32, Pure ((Call (f32, "f", [x +~ one])) +~ (Call (f32, "f", [x -~ one])))) in
   
   let g_call_sched = Root in
-  let g_sched = [Split ("x", "gxo", "gxi", IntImm 0); Vectorized ("gxi", IntImm 0, 4); Parallel ("gxo", IntImm 0, IntImm 25)] in
+  let g_sched = [Split ("x", "gxo", "gxi", IntImm 0, RoundUp); Vectorized ("gxi", IntImm 0, 4); Parallel ("gxo", IntImm 0, IntImm 25)] in
     
   let env = Environment.empty in
   let env = Environment.add "f" f env in
@@ -36,7 +36,7 @@ let _ =
   (* let f_sched = [Split ("x", "xo", "xi", (Var (i32, "g.xo") *~ (IntImm 4)) -~ (IntImm 1));
                  Vectorized ("xi", IntImm 0, 4); Unrolled ("xo", IntImm 0, 2)] in  *)
 
-  let f_sched = [Split ("x", "fxo", "fxi", ((Var (i32, "threadidx")) *~ (IntImm 4)) -~ one);
+  let f_sched = [Split ("x", "fxo", "fxi", ((Var (i32, "threadidx")) *~ (IntImm 4)) -~ one, RoundUp);
                  Serial ("fxi", IntImm 0, IntImm 4);
                  Unrolled ("fxo", IntImm 0, 2)
                 ] in 
@@ -44,7 +44,7 @@ let _ =
   let g = ("g", [(i32, "x")], f32, Pure ((Call (f32, "f", [x +~ one])) +~ (Call (f32, "f", [x -~ one])))) in
   
   let g_call_sched = Root in
-  let g_sched = [Split ("x", "threadidx", "gxi", IntImm 0); Unrolled ("gxi", IntImm 0, 4); Parallel ("threadidx", IntImm 0, IntImm 25)] in
+  let g_sched = [Split ("x", "threadidx", "gxi", IntImm 0, RoundUp); Unrolled ("gxi", IntImm 0, 4); Parallel ("threadidx", IntImm 0, IntImm 25)] in
     
   let env = Environment.empty in
   let env = Environment.add "f" f env in
@@ -6,7 +6,12 @@ open Analysis
 let expand e width = 
   if (is_scalar e) then Broadcast (e, width) else e
 
+(* Float math functions the runtime provides as <name>x4 and <name>x8 *)
+let vector_math_functions =
+  [".sqrt_f32"; ".exp_f32"; ".log_f32"; ".sin_f32"; ".cos_f32"; ".pow_f32"]
+
 (* Substitute var for something that might be a vector in expr and propagate the vectorness upwards *)
+
 let rec vector_subs_expr (env:expr StringMap.t) (expr:expr) =
   let (some_var, some_value) = StringMap.choose env in
   let width = vector_elements (val_type_of_expr some_value) in
@@ -81,6 +86,16 @@ let rec vector_subs_expr (env:expr StringMap.t) (expr:expr) =
             Select (vc, expand va, expand vb)
               
       | Load (t, buf, idx) -> Load (vector_of_val_type t width, buf, vec idx)
+      (* The runtime has vector versions of the float math functions
+       * for these widths, so call them directly. *)
+      | Call (Float 32, f, args) when List.mem f vector_math_functions &&
+          (width = 4 || width = 8) ->
+          let args = List.map vec args in
+          if List.for_all is_scalar args then
+            Call (Float 32, f, args)
+          else
+            Call (FloatVector (32, width), f ^ "x" ^ (string_of_int width),
+                  List.map expand args)
       (* Function names beginning with `.` are globally qualified, so assumed to
        * be extern. *)
       | Call (t, f, args) when f.[0] = '.' ->
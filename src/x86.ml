@@ -20,40 +20,151 @@ let codegen_entry c m cg_entry _ e =
   (* return the wrapper which takes buffer_t*s *)
   cg_wrapper c m e inner
 
+(* Instruction set extensions beyond the SSE2 baseline that codegen
+   may use. Cg_for_target sets these from the host cpu when jitting,
+   and from the target string when compiling to a file. *)
+let target_features = ref []
+
+(* Each extension implies the ones before it *)
+let implied_features = [
+  ("avx512bw", "avx512f");
+  ("avx512f", "avx2");
+  ("avx2", "avx");
+  ("fma", "avx");
+  ("avx", "sse41");
+]
+
+let set_target_features features =
+  let rec close features =
+    let implied = List.concat (List.map (fun f ->
+      List.map snd (List.filter (fun (g, _) -> g = f) implied_features)) features) in
+    let missing = List.filter (fun f -> not (List.mem f features)) implied in
+    if missing = [] then features else close (features @ missing)
+  in
+  target_features := close features
+
+let has_feature f = List.mem f !target_features
+
+(* Can a vector of this many bits live in a single register *)
+let is_native_width bits =
+  bits = 128 ||
+  (bits = 256 && has_feature "avx") ||
+  (bits = 512 && has_feature "avx512f")
+
+(* The 16-bit multiply-high for a vector of this many lanes. The LLVM
+   we build against has no AVX-512 intrinsics, so 512-bit vectors use
+   the generic double-width multiply. *)
+let pmulh_w signed lanes =
+  let op = if signed then "pmulh.w" else "pmulhu.w" in
+  match lanes with
+    | 8 -> Some ("llvm.x86.sse2." ^ op)
+    | 16 when has_feature "avx2" -> Some ("llvm.x86.avx2." ^ op)
+    | _ -> None
+
+(* Multiply-high for division by constants, using pmulh(u)w where we
+   can, and a double-width multiply otherwise *)
+let cg_mulhi (con:context) signed x y b =
+  let t = type_of x in
+  let pmulh = match classify_type t with
+    | TypeKind.Vector when integer_bitwidth (element_type t) = 16 ->
+        pmulh_w signed (vector_size t)
+    | _ -> None in
+  match pmulh with
+    | Some name ->
+        let f = declare_function name (function_type t [|t; t|]) con.m in
+        build_call f [|x; y|] "" b
+    | None -> build_mulhi signed x y b
+
+(* Load a vector from arbitrary indices into a buffer *)
+let cg_gather (con:context) cg_expr (t:val_type) (buf:string) (idx:expr) =
+  let c = con.c and m = con.m and b = con.b in
+  let w = vector_elements t in
+  let elem_t = element_val_type t in
+  let vec_t = type_of_val_type c t in
+  let i32_t = i32_type c in
+  let ptr_t = pointer_type (i8_type c) in
+  let base = con.cg_memref elem_t buf (IntImm 0) in
+  let indices = cg_expr idx in
+  match elem_t with
+    (* AVX2 can gather 32-bit elements natively. There's no AVX-512
+       gather intrinsic in the LLVM we build against, so 16-wide
+       gathers take the generic path below. *)
+    | Int 32 | UInt 32 | Float 32 when has_feature "avx2" && (w = 4 || w = 8) ->
+        let idx_t = vector_type i32_t w in
+        let name = match elem_t with
+          | Float _ -> "llvm.x86.avx2.gather.d.ps"
+          | _ -> "llvm.x86.avx2.gather.d.d"
+        in
+        let name = if w = 8 then name ^ ".256" else name in
+        let gather = declare_function name
+          (function_type vec_t [|vec_t; ptr_t; idx_t; vec_t; i8_type c|]) m in
+        let mask = const_bitcast (const_all_ones idx_t) vec_t in
+        let base = build_pointercast base ptr_t "" b in
+        let scale = const_int (i8_type c) 4 in
+        build_call gather [|undef vec_t; base; indices; mask; scale|] "" b
+
+    (* Otherwise do a scalar load per lane, and combine them with a
+       tree of shuffles. This has a shorter dependence chain than
+       inserting the lanes into the vector one at a time. *)
+    | _ when w land (w - 1) = 0 ->
+        let load_lane i =
+          let lane_idx = build_extractelement indices (const_int i32_t i) "" b in
+          let value = build_load (build_gep base [|lane_idx|] "" b) "" b in
+          build_insertelement (undef vec_t) value (const_int i32_t 0) "" b
+        in
+        (* Interleave pairs of vectors with k valid lanes each into
+           vectors with 2k valid lanes *)
+        let rec merge k = function
+          | x::y::rest ->
+              let mask = List.map
+                (fun i ->
+                  if i < k then const_int i32_t i
+                  else if i < 2*k then const_int i32_t (w + i - k)
+                  else undef i32_t)
+                (0 -- w) in
+              (build_shufflevector x y (const_vector (Array.of_list mask)) "" b)::(merge k rest)
+          | l -> l
+        in
+        let rec combine k = function
+          | [v] -> v
+          | l -> combine (2*k) (merge k l)
+        in
+        combine 1 (List.map load_lane (0 -- w))
+
+    | _ -> con.cg_expr (Load (t, buf, idx))
+
 let rec cg_expr (con:context) (expr:expr) =
   let c = con.c and m = con.m and b = con.b in
   let cg_expr = cg_expr con in
 
   let ptr_t = pointer_type (i8_type c) in
-  let i16x8_t = vector_type (i16_type c) 8 in
-  let i8x16_t = vector_type (i8_type c) 16 in
   let i32_t = i32_type c in
 
   (* Peephole optimizations for x86 *)
   match expr with 
-    (* x86 doesn't do 16 bit vector division, but for constants you can do multiplication instead. *)
-    | Bop (Div, x, Broadcast (Cast (UInt 16, IntImm y), 8)) ->
-        let pmulhw = declare_function "llvm.x86.sse2.pmulh.w"
-          (function_type (i16x8_t) [|i16x8_t; i16x8_t|]) m in
-        let z = (65536/y + 1) in
-        let lhs = cg_expr x in
-        let rhs = cg_expr (Broadcast (Cast (UInt 16, IntImm z), 8)) in        
-        build_call pmulhw [|lhs; rhs|] "" b
+    (* x86 doesn't do vector division, so divide by constants with
+       multiplies and shifts *)
+    | Bop ((Div | Mod) as op, x, y) when const_divisor (val_type_of_expr x) y <> None ->
+        let t = val_type_of_expr x in
+        let d = match const_divisor t y with Some d -> d | None -> assert false in
+        let signed = match element_val_type t with Int _ -> true | _ -> false in
+        build_div_mod_by_const (cg_mulhi con) signed (op = Mod) (cg_expr x) d b
           
-    (* unaligned dense 128-bit loads use movups *)
-    | Load (t, buf, Ramp(base, IntImm 1, n)) when (bit_width t = 128) ->
+    (* unaligned dense loads of a full register use movups (or vmovups) *)
+    | Load (t, buf, Ramp(base, IntImm 1, n)) when is_native_width (bit_width t) ->
         begin match (Analysis.reduce_expr_modulo base n) with 
           | Some _ -> con.cg_expr expr
           | _ ->              
-              let unaligned_load_128 = declare_function "unaligned_load_128"
-                (function_type (i8x16_t) [|ptr_t|]) m in
+              let bits = bit_width t in
+              let unaligned_load = declare_function ("unaligned_load_" ^ (string_of_int bits))
+                (function_type (vector_type (i8_type c) (bits/8)) [|ptr_t|]) m in
               let addr = build_pointercast (con.cg_memref t buf base) ptr_t "" b in
-              let value = build_call unaligned_load_128 [|addr|] "" b in
+              let value = build_call unaligned_load [|addr|] "" b in
               build_bitcast value (type_of_val_type c t) "" b        
         end
 
     (* Strided loads with stride 2 should load two vectors and then shuffle *)
-    | Load (t, buf, Ramp(base, IntImm 2, n)) when (bit_width t = 128) ->
+    | Load (t, buf, Ramp(base, IntImm 2, n)) when is_native_width (bit_width t) ->
         let v1 = cg_expr (Load (t, buf, Ramp(base, IntImm 1, n))) in
         let v2 = cg_expr (Load (t, buf, Ramp(base +~ IntImm n, IntImm 1, n))) in
         let mask = List.map (fun x -> const_int i32_t (x*2)) (0 -- n) in
@@ -76,6 +187,11 @@ let rec cg_expr (con:context) (expr:expr) =
         build_shufflevector vec vec (const_vector (Array.of_list mask)) "" b
     *)
 
+    (* Loads from anything other than a dense ramp are gathers *)
+    | Load (t, buf, idx) when is_vector idx &&
+        (match idx with Ramp (_, IntImm 1, _) -> false | _ -> true) ->
+        cg_gather con cg_expr t buf idx
+
     (* We don't have any special tricks up our sleeve for this case, just use the default cg_expr *)
     | _ -> con.cg_expr expr 
         
@@ -84,21 +200,22 @@ let rec cg_stmt (con:context) (stmt:stmt) =
   let cg_expr = cg_expr con in
   (* let cg_stmt = cg_stmt con in *)
   let ptr_t = pointer_type (i8_type c) in
-  let i8x16_t = vector_type (i8_type c) 16 in
 
   (* Peephole optimizations for x86 *)
   match stmt with
-    (* unaligned 128-bit dense stores use movups *)
-    | Store (e, buf, Ramp(base, IntImm 1, n)) when (bit_width (val_type_of_expr e)) = 128 ->
+    (* unaligned dense stores of a full register use movups (or vmovups) *)
+    | Store (e, buf, Ramp(base, IntImm 1, n)) when is_native_width (bit_width (val_type_of_expr e)) ->
         begin match (Analysis.reduce_expr_modulo base n) with
           | Some 0 -> con.cg_stmt stmt
           | _ ->
               let t = val_type_of_expr e in
-              let unaligned_store_128 = declare_function "unaligned_store_128"
-                (function_type (void_type c) [|i8x16_t; ptr_t|]) m in
+              let bits = bit_width t in
+              let i8xn_t = vector_type (i8_type c) (bits/8) in
+              let unaligned_store = declare_function ("unaligned_store_" ^ (string_of_int bits))
+                (function_type (void_type c) [|i8xn_t; ptr_t|]) m in
               let addr = build_pointercast (con.cg_memref t buf base) ptr_t "" b in
-              let value = build_bitcast (cg_expr e) i8x16_t "" b in
-              build_call unaligned_store_128 [|value; addr|] "" b        
+              let value = build_bitcast (cg_expr e) i8xn_t "" b in
+              build_call unaligned_store [|value; addr|] "" b        
         end
     (* Fall back to the default cg_stmt *)
     | _ -> con.cg_stmt stmt
@@ -107,7 +224,7 @@ let rec cg_stmt (con:context) (stmt:stmt) =
    this to build a cleanup closure *)
 let free (con:context) (name:string) (address:llvalue) =
   let c = con.c and m = con.m and b = con.b in
-  let free = declare_function "fast_free" (function_type (void_type c) [|pointer_type (i8_type c)|]) m in
+  let free = declare_function "halide_scratch_free" (function_type (void_type c) [|pointer_type (i8_type c)|]) m in
   ignore (build_call free [|address|] "" b)
 
 (* Allocate some memory. Returns an llval representing the address,
@@ -119,19 +236,24 @@ let malloc (con:context) (name:string) (elems:expr) (elem_size:expr) =
   match size with
     (* Constant-sized allocations go on the stack *)
     | IntImm bytes ->
-        let chunks = ((bytes + 15)/16) in (* 16-byte aligned stack *)
+        (* Align to the widest vector register we might use *)
+        let vec_bytes = if has_feature "avx512f" then 64 else if has_feature "avx" then 32 else 16 in
+        let chunks = ((bytes + vec_bytes - 1)/vec_bytes) in
         (* Get the position at the top of the function *)
         let pos = instr_begin (entry_block (block_parent (insertion_block b))) in
         (* Make a builder at the start of the entry block *)
         let b = builder_at c pos in
         (* Inject an alloca *)
-        let ptr = build_array_alloca (vector_type (i32_type c) 4) (const_int (i32_type c) chunks) "" b in
+        let ptr = build_array_alloca (vector_type (i32_type c) (vec_bytes/4)) (const_int (i32_type c) chunks) "" b in
         let ptr = build_pointercast ptr (pointer_type (i8_type c)) "" b in
         (ptr, fun _ -> ())
     | _ -> 
-        let malloc = declare_function "fast_malloc" (function_type (pointer_type (i8_type c)) [|i32_type c|]) m in  
+        (* Scratch buffers come from a per-thread stack that's reused
+           across realizations (see halide_scratch_alloc) *)
+        let malloc = declare_function "halide_scratch_alloc" (function_type (pointer_type (i8_type c)) [|i64_type c|]) m in  
         let size = Constant_fold.constant_fold_expr (Cast (Int 32, elems *~ elem_size)) in
-        let addr = build_call malloc [|con.cg_expr size|] name b in
+        let size = build_zext (con.cg_expr size) (i64_type c) "" b in
+        let addr = build_call malloc [|size|] name b in
         (addr, fun con -> free con name addr)
 
 let env = Environment.empty
@@ -33,7 +33,7 @@ let _ =
   let f_call_sched = (Inline) in
   let f_sched = [] in
   (*
-  let f_sched = [Split ("x", "xo", "xi", ((Var (i32, "g.xo")) *~ (IntImm 4)) -~ one);
+  let f_sched = [Split ("x", "xo", "xi", ((Var (i32, "g.xo")) *~ (IntImm 4)) -~ one, RoundUp);
                  Vectorized ("xi", IntImm 0, 4);
                  Unrolled ("xo", IntImm 0, 2)
                 ] in 
@@ -0,0 +1,93 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <algorithm>
+
+using namespace Halide;
+
+// Let the auto-scheduler schedule a blur followed by a lookup table,
+// and check it gets the same answer as the default schedule, for a
+// size it was scheduled for and for ones it wasn't.
+
+double now() {
+    timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+Func pipeline(Image<uint16_t> input) {
+    int W = input.width(), H = input.height();
+    Var x, y, i;
+    Func clamped, blur_x, blur_y, lut, out;
+    clamped(x, y) = input(clamp(x, 0, W-1), clamp(y, 0, H-1));
+    blur_x(x, y) = (clamped(x-1, y) + clamped(x, y) + clamped(x+1, y)) / 3;
+    blur_y(x, y) = (blur_x(x, y-1) + blur_x(x, y) + blur_x(x, y+1)) / 3;
+    lut(i) = cast<uint16_t>((i * i) / 255);
+    out(x, y) = lut(clamp(cast<int>(blur_y(x, y)) / 16, 0, 255));
+    return out;
+}
+
+uint16_t reference(Image<uint16_t> input, int x, int y) {
+    int W = input.width(), H = input.height();
+    int sum_y = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        int sum_x = 0;
+        for (int dx = -1; dx <= 1; dx++) {
+            sum_x += input(std::min(std::max(x + dx, 0), W-1), std::min(std::max(y + dy, 0), H-1));
+        }
+        sum_y += (uint16_t)(sum_x / 3);
+    }
+    int b = std::min((int)(uint16_t)(sum_y / 3) / 16, 255);
+    return (uint16_t)((b * b) / 255);
+}
+
+bool test(int W, int H, int schedule_W, int schedule_H) {
+    Image<uint16_t> input(W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            input(x, y) = (uint16_t)((x * 37 + y * 101 + x * y) & 0xfff);
+        }
+    }
+
+    Func plain = pipeline(input);
+    Func automatic = pipeline(input);
+    automatic.autoSchedule(schedule_W, schedule_H);
+
+    Image<uint16_t> plain_out = plain.realize(W, H);
+    Image<uint16_t> auto_out = automatic.realize(W, H);
+
+    double t1 = now();
+    plain.realize(plain_out);
+    double t2 = now();
+    automatic.realize(auto_out);
+    double t3 = now();
+    printf("%dx%d: default schedule %f ms, auto-scheduled %f ms\n",
+           W, H, (t2 - t1) * 1000, (t3 - t2) * 1000);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            uint16_t correct = reference(input, x, y);
+            if (plain_out(x, y) != correct || auto_out(x, y) != correct) {
+                printf("out(%d, %d) = %d (default) %d (auto) instead of %d\n",
+                       x, y, plain_out(x, y), auto_out(x, y), correct);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (!test(1536, 1024, 1536, 1024) ||
+        !test(4000, 300, 4000, 300) ||
+        !test(123, 77, 100, 100) ||
+        !test(1000, 999, 1024, 1024) ||
+        // Narrower than a vector and shorter than a strip
+        !test(4, 3, 1536, 1024) ||
+        !test(3, 200, 1536, 1024)) {
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
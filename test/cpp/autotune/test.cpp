@@ -0,0 +1,73 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <math.h>
+
+using namespace Halide;
+
+// Tune a small blur for a couple of generations, save the schedule it
+// finds, and check that both the tuned function and a fresh copy of
+// the pipeline scheduled from the saved file still compute the right
+// thing.
+
+void define(Func &blur_x, Func &blur_y, UniformImage input, Var x, Var y) {
+    blur_x(x, y) = input(x, y) + input(x+1, y) + input(x+2, y);
+    blur_y(x, y) = blur_x(x, y) + blur_x(x, y+1) + blur_x(x, y+2);
+}
+
+bool check(Image<int> out, Image<int> in) {
+    for (int y = 0; y < out.height(); y++) {
+        for (int x = 0; x < out.width(); x++) {
+            int correct = 0;
+            for (int dy = 0; dy < 3; dy++) {
+                for (int dx = 0; dx < 3; dx++) {
+                    correct += in(x + dx, y + dy);
+                }
+            }
+            if (out(x, y) != correct) {
+                printf("out(%d, %d) = %d instead of %d\n", x, y, out(x, y), correct);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const int W = 256, H = 256;
+
+    Image<int> in(W + 2, H + 2);
+    for (int y = 0; y < H + 2; y++) {
+        for (int x = 0; x < W + 2; x++) {
+            in(x, y) = rand() & 0xff;
+        }
+    }
+
+    UniformImage input(Int(32), 2);
+    input = in;
+
+    Var x, y;
+    Func blur_x, blur_y;
+    define(blur_x, blur_y, input, x, y);
+
+    std::vector<int> sizes;
+    sizes.push_back(W);
+    sizes.push_back(H);
+    double t = blur_y.autotune(sizes, 2, "autotune_blur.guru");
+    printf("Best schedule took %f us\n", t);
+    if (!(t > 0) || isinf(t)) {
+        printf("Autotuning didn't find a schedule that works\n");
+        return -1;
+    }
+
+    if (!check(blur_y.realize(W, H), in)) return -1;
+
+    // A fresh pipeline with the same names, scheduled from the file
+    Func blur_x2(blur_x.name().c_str()), blur_y2(blur_y.name().c_str());
+    define(blur_x2, blur_y2, input, x, y);
+    blur_y2.loadSchedule("autotune_blur.guru");
+
+    if (!check(blur_y2.realize(W, H), in)) return -1;
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <Halide.h>
+
+using namespace Halide;
+
+bool error_occurred = false;
+void halide_error(char *msg) {
+    printf("%s\n", msg);
+    error_occurred = true;
+}
+
+// Crops with non-zero mins, and interleaved planes viewed with a
+// stride, as inputs baked into a pipeline, as uniform images, and as
+// outputs. None of them are copied. Strided and misaligned buffers
+// need functions compiled to allow any layout, and are rejected by
+// the others.
+int main(int argc, char **argv) {
+    const int W = 64, H = 16;
+
+    Image<int> big(W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            big(x, y) = x + 100 * y;
+        }
+    }
+
+    // A crop, indexed in the coordinates of the image it came from
+    DynImage crop = DynImage(big).crop({16, 4}, {32, 8});
+    if (crop.min(0) != 16 || crop.min(1) != 4) {
+        printf("Crop has mins %d %d instead of 16 4\n", crop.min(0), crop.min(1));
+        return -1;
+    }
+
+    Var x, y;
+    Func baked;
+    baked(x, y) = crop(x + 16, y + 4) + 1;
+
+    UniformImage in(Int(32), 2);
+    Func bound;
+    bound(x, y) = in(x + in.min(0), y + in.min(1)) * 2;
+    bound.vectorize(x, 4);
+    in = crop;
+
+    Image<int> baked_result = baked.realize(32, 8);
+    Image<int> bound_result = bound.realize(32, 8);
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 32; x++) {
+            int correct = big(x + 16, y + 4);
+            if (baked_result(x, y) != correct + 1) {
+                printf("baked(%d, %d) = %d instead of %d\n", x, y, baked_result(x, y), correct + 1);
+                return -1;
+            }
+            if (bound_result(x, y) != correct * 2) {
+                printf("bound(%d, %d) = %d instead of %d\n", x, y, bound_result(x, y), correct * 2);
+                return -1;
+            }
+        }
+    }
+
+    // Interleaved rgb, with one plane read through a UniformImage and
+    // written into another interleaved image, both with a stride of
+    // three in the first dimension
+    Image<float> rgb(3 * W, H), out(3 * W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < 3 * W; x++) {
+            rgb(x, y) = (float)(x * 3 + y);
+        }
+    }
+    DynImage red = DynImage(rgb).view(0, {W, H}, {3, 3 * W});
+    DynImage out_red = DynImage(out).view(0, {W, H}, {3, 3 * W});
+
+    UniformImage plane(Float(32), 2);
+    Func scaled;
+    scaled(x, y) = plane(x, y) * 0.5f;
+    scaled.vectorize(x, 4);
+    scaled.allowAnyLayout();
+
+    plane = red;
+    scaled.realize(out_red);
+
+    // The same function still works on dense buffers
+    plane = DynImage(rgb).crop({0, 0}, {W, H});
+    Image<float> dense = scaled.realize(W, H);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            if (out(3 * x, y) != rgb(3 * x, y) * 0.5f) {
+                printf("out(%d, %d) = %f instead of %f\n", 3 * x, y, out(3 * x, y), rgb(3 * x, y) * 0.5f);
+                return -1;
+            }
+            if (out(3 * x + 1, y) != 0 || out(3 * x + 2, y) != 0) {
+                printf("Wrote to the wrong plane at (%d, %d)\n", x, y);
+                return -1;
+            }
+            if (dense(x, y) != rgb(x, y) * 0.5f) {
+                printf("dense(%d, %d) = %f instead of %f\n", x, y, dense(x, y), rgb(x, y) * 0.5f);
+                return -1;
+            }
+        }
+    }
+
+    // Outputs that are crops of a larger image, one starting on a
+    // vector boundary and one not, computed over their own coordinates
+    Image<int> canvas(W, H);
+    Func coords;
+    coords(x, y) = x * 1000 + y;
+    coords.vectorize(x, 4);
+    coords.allowAnyLayout();
+    coords.realize(DynImage(canvas).crop({16, 4}, {32, 8}));
+    coords.realize(DynImage(canvas).crop({1, 13}, {28, 2}));
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            bool in_first = x >= 16 && x < 48 && y >= 4 && y < 12;
+            bool in_second = x >= 1 && x < 29 && y >= 13 && y < 15;
+            int correct = (in_first || in_second) ? x * 1000 + y : 0;
+            if (canvas(x, y) != correct) {
+                printf("canvas(%d, %d) = %d instead of %d\n", x, y, canvas(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    // Without allowAnyLayout, a strided output is an error
+    Func strict;
+    strict(x, y) = x + y;
+    strict.vectorize(x, 4);
+    strict.setErrorHandler(&halide_error);
+    strict.realize(out_red);
+    if (!error_occurred) {
+        printf("Realizing into a strided output without allowAnyLayout should be an error\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
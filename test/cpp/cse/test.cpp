@@ -0,0 +1,62 @@
+#include "Halide.h"
+#include <math.h>
+
+using namespace Halide;
+
+// Each stage is inlined into the next, so the final stage ends up
+// computing the same loads and arithmetic many times over, in
+// different orders and under different names for the arguments. Common
+// subexpression elimination should compute each of them once without
+// changing the answer.
+bool test(int W, int H, int width) {
+    Image<float> input(W + 2, H + 2);
+    for (int y = 0; y < H + 2; y++) {
+        for (int x = 0; x < W + 2; x++) {
+            input(x, y) = (float)((x * 17 + y * 31) % 101) / 7.0f;
+        }
+    }
+
+    Var x, y;
+    Func sq, sum, diff, out;
+    sq(x, y) = input(x, y) * input(x, y);
+    sum(x, y) = sq(x, y) + sq(x+1, y) + sq(x, y+1);
+    diff(x, y) = sq(x+1, y) + sq(x, y) - sum(x, y);
+    out(x, y) = select(sum(x, y) > diff(x, y), sum(x, y) * diff(x, y), sum(x, y)) +
+                sum(x+1, y) + diff(x, y+1);
+
+    if (width > 1) out.vectorize(x, width);
+
+    Image<float> result = out.realize(W, H);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            float s00 = input(x, y) * input(x, y);
+            float s10 = input(x+1, y) * input(x+1, y);
+            float s01 = input(x, y+1) * input(x, y+1);
+            float s20 = input(x+2, y) * input(x+2, y);
+            float s11 = input(x+1, y+1) * input(x+1, y+1);
+            float s02 = input(x, y+2) * input(x, y+2);
+            float sum00 = s00 + s10 + s01;
+            float sum10 = s10 + s20 + s11;
+            float sum01 = s01 + s11 + s02;
+            float diff00 = s10 + s00 - sum00;
+            float diff01 = s11 + s01 - sum01;
+            float correct = (sum00 > diff00 ? sum00 * diff00 : sum00) + sum10 + diff01;
+            if (fabs(result(x, y) - correct) > 1e-3f * fabs(correct) + 1e-3f) {
+                printf("result(%d, %d) = %f instead of %f (vector width %d)\n",
+                       x, y, result(x, y), correct, width);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (!test(32, 16, 1) || !test(32, 16, 4) || !test(64, 8, 8)) {
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
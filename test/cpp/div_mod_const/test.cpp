@@ -0,0 +1,151 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace Halide;
+
+// Division and modulo by constants are done with multiplies and
+// shifts. Check them against the straightforward answer for every
+// numerator of the 8 and 16-bit types, and lots of 32-bit ones, for
+// scalars and vectors.
+
+// Division rounds towards zero, and modulo has the sign of the divisor
+int64_t correct_div(int64_t a, int64_t d) {
+    return a / d;
+}
+
+int64_t correct_mod(int64_t a, int64_t d) {
+    int64_t r = a % d;
+    if (r != 0 && ((r < 0) != (d < 0))) r += d;
+    return r;
+}
+
+template<typename T>
+Expr constant(int64_t d) {
+    if (sizeof(T) == 4 && (T)(-1) > 0) return Expr((unsigned)d);
+    return cast<T>(Expr((int)d));
+}
+
+template<typename T>
+bool test(const std::vector<int64_t> &divisors, const std::vector<T> &numerators, int width) {
+    const int chunk = 32;
+    int n = (int)numerators.size();
+    Image<T> input(n);
+    for (int i = 0; i < n; i++) input(i) = numerators[i];
+
+    for (size_t start = 0; start < divisors.size(); start += chunk) {
+        size_t end = start + chunk;
+        if (end > divisors.size()) end = divisors.size();
+
+        // Row y of the output uses divisor start + y
+        Var x, y;
+        Func div, mod;
+        Expr div_value = input(x) / constant<T>(divisors[start]);
+        Expr mod_value = input(x) % constant<T>(divisors[start]);
+        for (size_t i = start + 1; i < end; i++) {
+            div_value = select(y == (int)(i - start), input(x) / constant<T>(divisors[i]), div_value);
+            mod_value = select(y == (int)(i - start), input(x) % constant<T>(divisors[i]), mod_value);
+        }
+        div(x, y) = div_value;
+        mod(x, y) = mod_value;
+        if (width > 1) {
+            div.vectorize(x, width);
+            mod.vectorize(x, width);
+        }
+
+        Image<T> div_result = div.realize(n, (int)(end - start));
+        Image<T> mod_result = mod.realize(n, (int)(end - start));
+
+        for (size_t i = start; i < end; i++) {
+            int64_t d = divisors[i];
+            for (int j = 0; j < n; j++) {
+                int64_t a = numerators[j];
+                T q = (T)correct_div(a, d), r = (T)correct_mod(a, d);
+                if (div_result(j, i - start) != q) {
+                    printf("%lld / %lld = %lld instead of %lld (vector width %d)\n",
+                           (long long)a, (long long)d, (long long)div_result(j, i - start),
+                           (long long)q, width);
+                    return false;
+                }
+                if (mod_result(j, i - start) != r) {
+                    printf("%lld %% %lld = %lld instead of %lld (vector width %d)\n",
+                           (long long)a, (long long)d, (long long)mod_result(j, i - start),
+                           (long long)r, width);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+template<typename T>
+bool test_type(int64_t min, int64_t max, bool all_numerators, bool all_divisors) {
+    std::vector<int64_t> divisors;
+    if (all_divisors) {
+        for (int64_t d = min; d <= max; d++) {
+            if (d < -1 || d > 1) divisors.push_back(d);
+        }
+    } else {
+        int64_t interesting[] = {2, 3, 5, 6, 7, 8, 9, 10, 11, 12, 13, 16, 17, 25, 31, 60, 64, 100,
+                                 125, 127, 128, 255, 641, 1000, 4096, 9999, 32767, 32768, 65535,
+                                 65536, 6700417, 1000000007, 2147483647, 2147483648LL, 4294967295LL};
+        for (size_t i = 0; i < sizeof(interesting)/sizeof(interesting[0]); i++) {
+            int64_t d = interesting[i];
+            if (d <= max) divisors.push_back(d);
+            if (-d >= min) divisors.push_back(-d);
+        }
+        for (int i = 0; i < 32; i++) {
+            int64_t d = min + (int64_t)(((uint64_t)rand() << 16 ^ rand()) % (uint64_t)(max - min));
+            if (d < -1 || d > 1) divisors.push_back(d);
+        }
+    }
+
+    std::vector<T> numerators;
+    if (all_numerators) {
+        for (int64_t a = min; a <= max; a++) numerators.push_back((T)a);
+    } else {
+        int64_t edges[] = {min, min + 1, -1, 0, 1, max - 1, max};
+        for (int i = 0; i < 7; i++) {
+            if (edges[i] >= min) numerators.push_back((T)edges[i]);
+        }
+        // Multiples of the divisors and their neighbours, where the
+        // rounding is most likely to be off
+        for (size_t i = 0; i < divisors.size(); i++) {
+            int64_t d = divisors[i] < 0 ? -divisors[i] : divisors[i];
+            int64_t k = max / d;
+            int64_t candidates[] = {k*d, k*d - 1, d, d - 1, d + 1, -k*d, -k*d + 1, -d, -d + 1};
+            for (int j = 0; j < 9; j++) {
+                if (candidates[j] >= min && candidates[j] <= max) numerators.push_back((T)candidates[j]);
+            }
+        }
+        while (numerators.size() % 64) {
+            int64_t a = min + (int64_t)(((uint64_t)rand() << 16 ^ rand()) % (uint64_t)(max - min));
+            numerators.push_back((T)a);
+        }
+    }
+
+    int widths[] = {1, 16 / (int)sizeof(T), 32 / (int)sizeof(T)};
+    for (int i = 0; i < 3; i++) {
+        if (!test<T>(divisors, numerators, widths[i])) return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    srand(0);
+
+    if (test_type<uint8_t>(0, 255, true, true) &&
+        test_type<int8_t>(-128, 127, true, true) &&
+        test_type<uint16_t>(0, 65535, true, false) &&
+        test_type<int16_t>(-32768, 32767, true, false) &&
+        test_type<uint32_t>(0, 4294967295LL, false, false) &&
+        test_type<int32_t>(-2147483648LL, 2147483647, false, false)) {
+        printf("Success!\n");
+        return 0;
+    }
+
+    printf("Failure!\n");
+    return -1;
+}
@@ -0,0 +1,77 @@
+#include "Halide.h"
+#include <sys/time.h>
+
+using namespace Halide;
+
+#define W 10240
+#define H 64
+
+// Compare a vectorized lookup table against a scalar one. Set
+// HL_X86_FEATURES=avx2 to use native gathers on machines that have
+// them.
+double time_realize(Func f) {
+    // Compile and warm up
+    f.realize(W, H);
+
+    timeval t1, t2;
+    gettimeofday(&t1, NULL);
+    for (int i = 0; i < 10; i++) {
+        f.realize(W, H);
+    }
+    gettimeofday(&t2, NULL);
+    return (t2.tv_sec - t1.tv_sec)*1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Func lut_i, lut_f, scalar_i, scalar_f, gather_i, gather_f;
+
+    lut_i(x) = (x*x) % 997;
+    lut_f(x) = cast<float>(x) * 0.5f;
+    lut_i.root();
+    lut_f.root();
+
+    Expr idx = (x*37 + y*101) % 1024;
+
+    scalar_i(x, y) = lut_i(idx);
+    gather_i(x, y) = lut_i(idx);
+    gather_i.vectorize(x, 8);
+
+    scalar_f(x, y) = lut_f(idx);
+    gather_f(x, y) = lut_f(idx);
+    gather_f.vectorize(x, 8);
+
+    Image<int> si = scalar_i.realize(W, H);
+    Image<int> gi = gather_i.realize(W, H);
+    Image<float> sf = scalar_f.realize(W, H);
+    Image<float> gf = gather_f.realize(W, H);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            if (si(x, y) != gi(x, y)) {
+                printf("gather_i(%d, %d) = %d instead of %d\n", x, y, gi(x, y), si(x, y));
+                return -1;
+            }
+            if (sf(x, y) != gf(x, y)) {
+                printf("gather_f(%d, %d) = %f instead of %f\n", x, y, gf(x, y), sf(x, y));
+                return -1;
+            }
+        }
+    }
+
+    double scalar_i_time = time_realize(scalar_i);
+    double gather_i_time = time_realize(gather_i);
+    double scalar_f_time = time_realize(scalar_f);
+    double gather_f_time = time_realize(gather_f);
+
+    printf("int32 lookups: scalar %f ms, vector %f ms\n", scalar_i_time, gather_i_time);
+    printf("float lookups: scalar %f ms, vector %f ms\n", scalar_f_time, gather_f_time);
+
+    if (gather_i_time > scalar_i_time || gather_f_time > scalar_f_time) {
+        fprintf(stderr, "WARNING: Vectorized lookups should not be slower\n");
+        return 0;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
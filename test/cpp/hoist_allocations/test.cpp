@@ -0,0 +1,88 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+// A function computed per row of a serial loop, over a region that
+// grows with the row. Its buffer should be allocated once, big enough
+// for the last row, rather than once per row. In a parallel loop each
+// row needs its own buffer. A function compiled to allow any layout
+// has two versions of its body, but only the one that runs allocates.
+
+const int W = 100, H = 50;
+
+// The scratch memory asked for by one realization of f
+size_t bytes_requested(Func f, Image<int> &out) {
+    size_t before, after;
+    f.scratchStats(&before, NULL);
+    f.realize(out);
+    f.scratchStats(&after, NULL);
+    return after - before;
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Func g, f;
+    g(x, y) = x * 3 + y;
+    // Row y reads W + y values of g
+    f(x, y) = g(x, y) + g(x + y, y);
+    g.chunk(y);
+
+    Func g_par, f_par;
+    g_par(x, y) = x * 3 + y;
+    f_par(x, y) = g_par(x, y) + g_par(x + y, y);
+    g_par.chunk(y);
+    f_par.parallel(y);
+
+    Func g_any, f_any;
+    g_any(x, y) = x * 3 + y;
+    f_any(x, y) = g_any(x, y) + g_any(x + y, y);
+    g_any.chunk(y);
+    f_any.allowAnyLayout();
+
+    Image<int> out(W, H), out_par(W, H), out_any(W, H);
+    size_t serial = bytes_requested(f, out);
+    size_t parallel = bytes_requested(f_par, out_par);
+    size_t any = bytes_requested(f_any, out_any);
+
+    for (int yy = 0; yy < H; yy++) {
+        for (int xx = 0; xx < W; xx++) {
+            int correct = xx * 3 + yy + (xx + yy) * 3 + yy;
+            if (out(xx, yy) != correct) {
+                printf("out(%d, %d) = %d instead of %d\n", xx, yy, out(xx, yy), correct);
+                return -1;
+            }
+            if (out_any(xx, yy) != correct) {
+                printf("out_any(%d, %d) = %d instead of %d\n", xx, yy, out_any(xx, yy), correct);
+                return -1;
+            }
+            if (out_par(xx, yy) != correct) {
+                printf("out_par(%d, %d) = %d instead of %d\n", xx, yy, out_par(xx, yy), correct);
+                return -1;
+            }
+        }
+    }
+
+    // One buffer for the largest row, against one per row
+    size_t largest = (W + H - 1) * sizeof(int);
+    size_t per_row = 0;
+    for (int yy = 0; yy < H; yy++) per_row += (W + yy) * sizeof(int);
+    if (serial < largest || serial >= 2 * largest) {
+        printf("The serial loop asked for %d bytes of scratch instead of one buffer of %d\n",
+               (int)serial, (int)largest);
+        return -1;
+    }
+    if (any != serial) {
+        printf("Allowing any layout asked for %d bytes of scratch instead of %d\n",
+               (int)any, (int)serial);
+        return -1;
+    }
+    if (parallel < per_row) {
+        printf("The parallel loop asked for %d bytes of scratch, but its rows need %d\n",
+               (int)parallel, (int)per_row);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "Halide.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace Halide;
+
+// Lots of this only depends on uniforms and image sizes, or on the
+// outer loop variable: the clamp bounds, the scale factor, the color
+// matrix row interpolated from two input matrices, and the row
+// weight. All of it can be computed outside the inner loops, and the
+// results should be the same with the outer loop run in parallel.
+bool test(int W, int H, int width, bool parallel) {
+    Image<float> input(W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            input(x, y) = (float)((x * 13 + y * 7) % 23);
+        }
+    }
+    Image<float> m0(3, 3), m1(3, 3);
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 3; x++) {
+            m0(x, y) = (float)(x + 3*y) / 9.0f;
+            m1(x, y) = (float)(9 - x - 3*y) / 9.0f;
+        }
+    }
+
+    UniformImage in(Float(32), 2);
+    Uniform<int> levels;
+    Uniform<float> alpha;
+
+    Var x, y, c;
+    Func clamped, matrix, weight, out;
+    clamped(x, y) = in(clamp(x, 0, in.width()-1), clamp(y, 0, in.height()-1));
+    matrix(x, y) = m0(x, y) * (1.0f - alpha) + m1(x, y) * alpha;
+    weight(y) = cast<float>(y % 5) / cast<float>(levels - 1);
+    out(x, y, c) = (clamped(x+1, y) * matrix(0, c) +
+                    clamped(x, y) * matrix(1, c) +
+                    clamped(x-1, y) * matrix(2, c)) *
+        (cast<float>(levels - 1) * 256.0f) * weight(y);
+
+    if (width > 1) out.vectorize(x, width);
+    if (parallel) out.parallel(y);
+
+    in = input;
+    levels = 9;
+    alpha = 0.25f;
+    Image<float> result = out.realize(W, H, 3);
+
+    for (int c = 0; c < 3; c++) {
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                float mat[3];
+                for (int i = 0; i < 3; i++) {
+                    mat[i] = m0(i, c) * 0.75f + m1(i, c) * 0.25f;
+                }
+                float correct = 0;
+                for (int i = 0; i < 3; i++) {
+                    int cx = std::min(std::max(x + 1 - i, 0), W-1);
+                    correct += input(cx, y) * mat[i];
+                }
+                correct *= 8 * 256.0f * (float)(y % 5) / 8.0f;
+                if (fabs(result(x, y, c) - correct) > 1e-3f * fabs(correct) + 1e-3f) {
+                    printf("result(%d, %d, %d) = %f instead of %f (vector width %d%s)\n",
+                           x, y, c, result(x, y, c), correct, width, parallel ? ", parallel" : "");
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (!test(32, 16, 1, false) || !test(32, 16, 4, false) ||
+        !test(32, 16, 1, true) || !test(64, 8, 8, true)) {
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace Halide;
+
+// Run this program again as a child process that compiles a pipeline
+// with HL_JIT_CACHE_DIR set. The first run should write an entry to
+// the cache, the second should use it without writing it again, and a
+// corrupt entry should be ignored and replaced.
+
+int child() {
+    Var x, y;
+    Func f;
+    f(x, y) = x * 7 + y * 3;
+    f.vectorize(x, 4);
+    Image<int> out = f.realize(32, 16);
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 32; x++) {
+            if (out(x, y) != x * 7 + y * 3) {
+                printf("out(%d, %d) = %d instead of %d\n", x, y, out(x, y), x * 7 + y * 3);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// The one cache entry in dir, or an empty string if there isn't one
+std::string find_entry(const std::string &dir) {
+    std::string entry;
+    int count = 0;
+    DIR *d = opendir(dir.c_str());
+    while (dirent *e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() > 3 && name.substr(name.size() - 3) == ".bc") {
+            entry = dir + "/" + name;
+            count++;
+        }
+    }
+    closedir(d);
+    return count == 1 ? entry : std::string();
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "child")) return child();
+
+    char dir[] = "/tmp/halide_jit_cache_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("Could not make a cache directory\n");
+        return -1;
+    }
+    setenv("HL_JIT_CACHE_DIR", dir, 1);
+    std::string run_child = std::string(argv[0]) + " child";
+
+    // A miss, which should write the entry
+    if (system(run_child.c_str())) {
+        printf("First run failed\n");
+        return -1;
+    }
+    std::string entry = find_entry(dir);
+    if (entry.empty()) {
+        printf("The first run didn't write exactly one cache entry\n");
+        return -1;
+    }
+    struct stat before, after;
+    stat(entry.c_str(), &before);
+
+    // A hit, which leaves the entry alone. A miss would rename a new
+    // file into place.
+    if (system(run_child.c_str())) {
+        printf("Second run failed\n");
+        return -1;
+    }
+    stat(entry.c_str(), &after);
+    if (after.st_ino != before.st_ino) {
+        printf("The second run didn't use the cache entry\n");
+        return -1;
+    }
+
+    // A corrupt entry gets compiled around and replaced
+    FILE *f = fopen(entry.c_str(), "wb");
+    fprintf(f, "not bitcode");
+    fclose(f);
+    if (system(run_child.c_str())) {
+        printf("Run with a corrupt cache entry failed\n");
+        return -1;
+    }
+    stat(entry.c_str(), &after);
+    if (after.st_size == (off_t)strlen("not bitcode")) {
+        printf("The corrupt cache entry wasn't replaced\n");
+        return -1;
+    }
+
+    unlink(entry.c_str());
+    rmdir(dir);
+
+    printf("Success!\n");
+    return 0;
+}
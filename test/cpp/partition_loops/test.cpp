@@ -0,0 +1,92 @@
+#include "Halide.h"
+#include <algorithm>
+
+using namespace Halide;
+
+// A blur with a clamped boundary condition. The loops get split so
+// that the clamp is only evaluated near the edges, which we can't see
+// from here, but the answer should be the same for every size of
+// input, including ones too small to have any interior.
+bool test(int W, int H, bool vectorize) {
+    Image<int> input(W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            input(x, y) = (x * 17 + y * 31) % 101;
+        }
+    }
+
+    Var x, y;
+    Func clamped, blur_x, blur_y;
+    clamped(x, y) = input(clamp(x, 0, W-1), clamp(y, 0, H-1));
+    blur_x(x, y) = clamped(x-2, y) + clamped(x, y) + clamped(x+2, y);
+    blur_y(x, y) = blur_x(x, y-1) + blur_x(x, y) + blur_x(x, y+1);
+
+    if (vectorize) {
+        blur_x.chunk(y).vectorize(x, 4);
+        blur_y.vectorize(x, 4);
+    }
+
+    Image<int> out = blur_y.realize(W, H);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int correct = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -2; dx <= 2; dx += 2) {
+                    int cx = std::min(std::max(x + dx, 0), W-1);
+                    int cy = std::min(std::max(y + dy, 0), H-1);
+                    correct += input(cx, cy);
+                }
+            }
+            if (out(x, y) != correct) {
+                printf("out(%d, %d) = %d instead of %d (size %dx%d)\n",
+                       x, y, out(x, y), correct, W, H);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Reading only to the right, so the clamp never fires at the left
+// edge and the loop before the steady state has nothing to do
+bool test_empty_prologue(int W, int H) {
+    Image<int> input(W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            input(x, y) = x * 7 + y;
+        }
+    }
+
+    Var x, y;
+    Func ahead;
+    ahead(x, y) = input(clamp(x + 2, 0, W-1), y) * 2;
+    ahead.vectorize(x, 4);
+
+    Image<int> out = ahead.realize(W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int correct = input(std::min(x + 2, W-1), y) * 2;
+            if (out(x, y) != correct) {
+                printf("ahead(%d, %d) = %d instead of %d (size %dx%d)\n",
+                       x, y, out(x, y), correct, W, H);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int sizes[] = {4, 8, 12, 64, 100};
+    for (int i = 0; i < 5; i++) {
+        if (!test(sizes[i], sizes[(i + 2) % 5], false) ||
+            !test(sizes[i], sizes[(i + 2) % 5], true)) {
+            return -1;
+        }
+        if (!test_empty_prologue(sizes[i], sizes[(i + 2) % 5])) return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,44 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Halide;
+
+// Compile a pipeline with profiling turned on, and check it still
+// computes the right thing and can report where the time went. This
+// has to be set before anything touches the compiler.
+
+int main(int argc, char **argv) {
+    setenv("HL_PROFILE", "1", 1);
+
+    Var x, y;
+    Func f, g, h;
+    f(x, y) = x * y;
+    g(x, y) = f(x, y) + f(x+1, y);
+    h(x, y) = g(x, y) + g(x, y+1);
+
+    f.chunk(y);
+    g.root().parallel(y);
+    h.parallel(y);
+
+    Image<int> out = h.realize(100, 100);
+    for (int i = 0; i < 10; i++) h.realize(out);
+
+    for (int y = 0; y < 100; y++) {
+        for (int x = 0; x < 100; x++) {
+            int correct = x*y + (x+1)*y + x*(y+1) + (x+1)*(y+1);
+            if (out(x, y) != correct) {
+                printf("out(%d, %d) = %d instead of %d\n", x, y, out(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    h.printProfile();
+    h.resetProfile();
+    h.realize(out);
+    h.printProfile();
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+using namespace Halide;
+
+// Change the schedule of one stage of a pipeline at a time and
+// recompile. Stages that didn't change, and whole pipelines we've
+// seen before, come from the compiler's caches, so check that we still
+// get the right answer each time, and that going back to an old
+// schedule is quick.
+
+double currentTime() {
+    timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
+}
+
+bool check(Func h, const char *schedule) {
+    double before = currentTime();
+    h.compileJIT();
+    double after = currentTime();
+    printf("Compiling with %s took %f ms\n", schedule, after - before);
+
+    Image<int> out = h.realize(64, 64);
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            int correct = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    correct += (x + dx) * 3 + (y + dy) * 5;
+                }
+            }
+            if (out(x, y) != correct) {
+                printf("out(%d, %d) = %d instead of %d with %s\n", x, y, out(x, y), correct, schedule);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Func f, g, h;
+    f(x, y) = x * 3 + y * 5;
+    g(x, y) = f(x, y) + f(x+1, y);
+    h(x, y) = g(x, y) + g(x, y+1);
+
+    f.root();
+    g.root();
+    if (!check(h, "everything root")) return -1;
+
+    g.vectorize(x, 4);
+    if (!check(h, "g vectorized")) return -1;
+
+    g.reset().chunk(y).vectorize(x, 4);
+    if (!check(h, "g chunked")) return -1;
+
+    f.reset();
+    if (!check(h, "f inlined")) return -1;
+
+    // Back to where we started
+    f.root();
+    g.reset().root();
+    if (!check(h, "everything root again")) return -1;
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <Halide.h>
+#include <algorithm>
+
+using namespace Halide;
+
+// Reductions parallelized over their reduction domain, with a private
+// copy of the result per slice of it. The number of slices doesn't
+// divide any of the domains, so some slices run off the end.
+int main(int argc, char **argv) {
+    int W = 128, H = 100;
+
+    int reference_hist[256];
+    for (int i = 0; i < 256; i++) {
+        reference_hist[i] = 0;
+    }
+
+    Image<float> in(W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            in(x, y) = float(rand() & 0x000000ff);
+            reference_hist[uint8_t(in(x, y))] += 1;
+        }
+    }
+
+    // A scatter
+    Func hist("hist");
+    RDom r(in);
+    hist(clamp(cast<int>(in(r.x, r.y)), 0, 255))++;
+    hist.rfactor(r.y, 8);
+
+    Image<int32_t> h = hist.realize(256);
+    for (int i = 0; i < 256; i++) {
+        if (h(i) != reference_hist[i]) {
+            printf("Error: bucket %d is %d instead of %d\n", i, h(i), reference_hist[i]);
+            return -1;
+        }
+    }
+
+    // A gather, with the reduction domain the inner dimension of the
+    // input
+    Var x, y;
+    RDom rx(0, W);
+    Func row_sum("row_sum");
+    row_sum(y) += in(rx, y);
+    row_sum.rfactor(rx.x, 7);
+
+    // And a maximum over the outer dimension
+    RDom ry(0, H);
+    Func col_max("col_max");
+    col_max(x) = -1.0f;
+    col_max(x) = max(col_max(x), in(x, ry));
+    col_max.rfactor(ry.x, 3);
+
+    Image<float> sums = row_sum.realize(H);
+    Image<float> maxes = col_max.realize(W);
+
+    for (int y = 0; y < H; y++) {
+        float correct = 0;
+        for (int x = 0; x < W; x++) correct += in(x, y);
+        if (sums(y) != correct) {
+            printf("Error: sum of row %d is %f instead of %f\n", y, sums(y), correct);
+            return -1;
+        }
+    }
+
+    for (int x = 0; x < W; x++) {
+        float correct = -1.0f;
+        for (int y = 0; y < H; y++) correct = std::max(correct, in(x, y));
+        if (maxes(x) != correct) {
+            printf("Error: max of column %d is %f instead of %f\n", x, maxes(x), correct);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
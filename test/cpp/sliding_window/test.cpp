@@ -0,0 +1,81 @@
+#include "Halide.h"
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Var xo, xi, yo, yi;
+
+    Func f, g, h;
+
+    printf("Defining function...\n");
+
+    f(x, y) = x*3 + y*5;
+    g(x, y) = f(x, y-1) + f(x, y) + f(x, y+1);
+
+    if (use_gpu()) {
+        // Sliding windows need a serial loop to slide along
+        g.cudaTile(x, y, 8, 8);
+        f.chunk(Var("blockidx"));
+        f.parallel(x).parallel(y).rename(x, Var("threadidx")).rename(y, Var("threadidy"));
+    } else {
+        f.slide(y);
+    }
+
+    printf("Realizing function...\n");
+
+    Image<int> im = g.realize(32, 32);
+
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) {
+            int correct = 9*x + 15*y;
+            if (im(x, y) != correct) {
+                printf("im[%d, %d] = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    // Now slide within tiles, so the window starts over for each tile
+    if (!use_gpu()) {
+        h(x, y) = f(x, y-2) + f(x, y+2);
+        h.tile(x, y, xo, yo, xi, yi, 8, 8);
+        f.reset().slide(yi);
+
+        Image<int> im2 = h.realize(32, 32);
+
+        for (int y = 0; y < 32; y++) {
+            for (int x = 0; x < 32; x++) {
+                int correct = 6*x + 10*y;
+                if (im2(x, y) != correct) {
+                    printf("im2[%d, %d] = %d instead of %d\n", x, y, im2(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // A window that only moves on every other iteration, so half the
+    // iterations have nothing new to compute
+    if (!use_gpu()) {
+        Func half, up;
+        half(x, y) = x*3 + y*5;
+        up(x, y) = half(x, y/2) + half(x, y/2 + 1);
+        half.slide(y);
+
+        Image<int> im3 = up.realize(32, 32);
+
+        for (int y = 0; y < 32; y++) {
+            for (int x = 0; x < 32; x++) {
+                int correct = 6*x + 5*(y/2) + 5*(y/2 + 1);
+                if (im3(x, y) != correct) {
+                    printf("im3[%d, %d] = %d instead of %d\n", x, y, im3(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
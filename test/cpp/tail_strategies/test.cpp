@@ -0,0 +1,103 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+// Split and vectorize by factors that don't divide the size of the
+// output. Rounding up would write past the end of it, so these only
+// work because the last iteration is shifted inward or done in a
+// scalar epilogue.
+
+bool check(Image<int> out, int W, int H, const char *name) {
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int correct = x * 3 + y * 5 + (x + 1) * (y + 2);
+            if (out(x, y) != correct) {
+                printf("%s: out(%d, %d) = %d instead of %d (size %dx%d)\n",
+                       name, x, y, out(x, y), correct, W, H);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool test(int W, int H) {
+    Var x, y, xi, yi;
+
+    Func f1, f2, f3, f4, f5, f6, g;
+
+    f1(x, y) = x * 3 + y * 5 + (x + 1) * (y + 2);
+    f2(x, y) = x * 3 + y * 5 + (x + 1) * (y + 2);
+    f3(x, y) = x * 3 + y * 5 + (x + 1) * (y + 2);
+    f4(x, y) = x * 3 + y * 5 + (x + 1) * (y + 2);
+
+    // An intermediate stage with an epilogue, consumed by a vectorized output
+    g(x, y) = (x + 1) * (y + 2);
+    f5(x, y) = x * 3 + y * 5 + g(x, y);
+
+    // A reduction whose update isn't safe to do twice
+    RDom r(0, 2);
+    f6(x, y) = x * 3 + y * 5;
+    f6(x, y) = f6(x, y) + (x + 1) * (y + 2) * r;
+
+    f1.vectorize(x, 8, ScalarEpilogue);
+    f2.tile(x, y, xi, yi, 8, 4, ScalarEpilogue);
+    f2.vectorize(xi, 4, ScalarEpilogue);
+    f3.unroll(x, 3, ScalarEpilogue);
+    g.root().vectorize(x, 4, ScalarEpilogue);
+    f5.vectorize(x, 4, ScalarEpilogue);
+
+    // Shifting inward needs the extent to be at least the factor
+    if (W >= 8) {
+        f4.vectorize(x, 8, ShiftInward);
+    }
+
+    // Asking for it on an update gets an epilogue instead, at any size
+    f6.update().vectorize(x, 4, ShiftInward);
+
+    return (check(f1.realize(W, H), W, H, "vectorize with epilogue") &&
+            check(f2.realize(W, H), W, H, "tile with epilogue") &&
+            check(f3.realize(W, H), W, H, "unroll with epilogue") &&
+            check(f4.realize(W, H), W, H, "vectorize shifted inward") &&
+            check(f5.realize(W, H), W, H, "intermediate with epilogue") &&
+            check(f6.realize(W, H), W, H, "update shifted inward"));
+}
+
+// The same compiled code at sizes with no whole vectors, with no
+// leftovers, and with both. The loops over the whole vectors and over
+// the leftovers must run zero times when there are none.
+bool test_reuse() {
+    Var x, y, xi, yi;
+    Func f1, f2;
+    f1(x, y) = x * 3 + y * 5 + (x + 1) * (y + 2);
+    f2(x, y) = x * 3 + y * 5 + (x + 1) * (y + 2);
+    f1.vectorize(x, 8, ScalarEpilogue);
+    f2.tile(x, y, xi, yi, 8, 4, ScalarEpilogue);
+
+    int widths[] = {5, 16, 21, 8, 1};
+    int heights[] = {3, 4, 2, 8, 1};
+    for (int i = 0; i < 5; i++) {
+        int W = widths[i], H = heights[i];
+        Image<int> out1(W, H), out2(W, H);
+        f1.realize(out1);
+        f2.realize(out2);
+        if (!check(out1, W, H, "reused vectorize with epilogue") ||
+            !check(out2, W, H, "reused tile with epilogue")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int widths[] = {1, 3, 8, 13, 37, 1918};
+    int heights[] = {1, 5, 7, 4, 9, 3};
+    for (int i = 0; i < 6; i++) {
+        if (!test(widths[i], heights[i])) return -1;
+    }
+    if (!test_reuse()) return -1;
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <set>
+
+using namespace Halide;
+
+// Resize the thread pool between realizations of a parallel pipeline,
+// and look at the pool's stats from inside the parallel loop. Resizing
+// from inside the loop waits until the loop is done. Then
+// fork with the pool running, the way autotune does, and check the
+// child gets a working pool of its own.
+
+const int W = 64, H = 64;
+
+Func *pipeline = NULL;
+int num_threads[H], busy_threads[H], queued_iterations[H];
+pthread_t worker[H];
+// If not zero, row 0 resizes the pool to this
+int resize_to = 0;
+
+// Called for every pixel. Samples the pool at the start of each row.
+extern "C" int probe(int x, int y) {
+    if (x == 0) {
+        pipeline->threadPoolStats(num_threads + y, busy_threads + y, queued_iterations + y);
+        worker[y] = pthread_self();
+        if (y == 0 && resize_to) pipeline->setNumThreads(resize_to);
+    }
+    return x + y;
+}
+HalideExtern_2(int, probe, int, int);
+
+// Realize f, and check every row saw a pool of n threads
+bool realize_with(Func f, int n) {
+    Image<int> out = f.realize(W, H);
+    for (int yy = 0; yy < H; yy++) {
+        if (out(W - 1, yy) != (W - 1 + yy) * 2) {
+            printf("out(%d, %d) = %d instead of %d\n", W - 1, yy, out(W - 1, yy), (W - 1 + yy) * 2);
+            return false;
+        }
+        if (num_threads[yy] != n) {
+            printf("Expected %d threads, but the pool reported %d threads during row %d\n", n, num_threads[yy], yy);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Func f;
+    f(x, y) = probe(x, y) * 2;
+    f.parallel(y);
+    pipeline = &f;
+
+    int sizes[] = {1, 4, 2, 3};
+    for (int i = 0; i < 4; i++) {
+        int n = sizes[i];
+        f.setNumThreads(n);
+
+        // The pool doesn't start until a parallel loop runs, and
+        // resizing it stops it
+        int total, busy, queued;
+        f.threadPoolStats(&total, &busy, &queued);
+        if (total != 0) {
+            printf("Pool still has %d threads after resizing to %d\n", total, n);
+            return -1;
+        }
+
+        Image<int> out = f.realize(W, H);
+        for (int yy = 0; yy < H; yy++) {
+            for (int xx = 0; xx < W; xx++) {
+                if (out(xx, yy) != (xx + yy) * 2) {
+                    printf("out(%d, %d) = %d instead of %d\n", xx, yy, out(xx, yy), (xx + yy) * 2);
+                    return -1;
+                }
+            }
+        }
+
+        std::set<pthread_t> threads;
+        for (int yy = 0; yy < H; yy++) {
+            if (num_threads[yy] != n) {
+                printf("With %d threads, the pool reported %d threads during row %d\n", n, num_threads[yy], yy);
+                return -1;
+            }
+            // The calling thread isn't counted as busy
+            if (busy_threads[yy] < 0 || busy_threads[yy] > n - 1) {
+                printf("With %d threads, the pool reported %d busy threads during row %d\n", n, busy_threads[yy], yy);
+                return -1;
+            }
+            // Row yy has been claimed, so at most the rows after it are queued
+            if (queued_iterations[yy] < 0 || queued_iterations[yy] > H - 1) {
+                printf("With %d threads, the pool reported %d queued iterations during row %d\n", n, queued_iterations[yy], yy);
+                return -1;
+            }
+            threads.insert(worker[yy]);
+        }
+        if ((int)threads.size() > n) {
+            printf("With %d threads, rows were computed by %d threads\n", n, (int)threads.size());
+            return -1;
+        }
+
+        f.threadPoolStats(&total, &busy, &queued);
+        if (total != n || queued != 0) {
+            printf("After realizing with %d threads, the pool has %d threads and %d queued iterations\n", n, total, queued);
+            return -1;
+        }
+    }
+
+    // Resizing from inside the parallel loop leaves the loop running on
+    // the pool it started with. The pool is resized when it's done.
+    f.setNumThreads(2);
+    resize_to = 4;
+    if (!realize_with(f, 2)) return -1;
+    resize_to = 0;
+    int total, busy, queued;
+    f.threadPoolStats(&total, &busy, &queued);
+    if (total != 0) {
+        printf("Pool still has %d threads after a resize from inside a parallel loop\n", total);
+        return -1;
+    }
+    if (!realize_with(f, 4)) return -1;
+    f.setNumThreads(3);
+
+    // The child inherits the parent's pool bookkeeping but none of its
+    // threads. If it used them, it would wait forever for rows nobody
+    // is computing.
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        alarm(30);
+        Image<int> out = f.realize(W, H);
+        for (int yy = 0; yy < H; yy++) {
+            for (int xx = 0; xx < W; xx++) {
+                if (out(xx, yy) != (xx + yy) * 2) _exit(1);
+            }
+        }
+        f.threadPoolStats(&total, &busy, &queued);
+        _exit(total == 3 ? 0 : 2);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid) {
+        printf("Couldn't fork\n");
+        return -1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Realizing in a forked child failed (status %d)\n", status);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
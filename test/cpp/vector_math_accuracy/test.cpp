@@ -0,0 +1,132 @@
+#include <Halide.h>
+#include <math.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+// Check the vector versions of the float math functions against libm,
+// at each of the widths the runtime provides them for, and at one it
+// doesn't (which falls back to calling the scalar versions).
+
+// The error of a against the correct value b, relative to b, except
+// near zero, where we use the absolute error instead. sin and cos
+// lose relative accuracy near their zeros for large arguments.
+float error(float a, float b) {
+    if (isnan(b)) return isnan(a) ? 0 : INFINITY;
+    if (isinf(b)) return a == b ? 0 : INFINITY;
+    float diff = fabsf(a - b);
+    return fabsf(b) > 1e-3f ? diff / fabsf(b) : diff;
+}
+
+bool check(const char *name, Image<float> input, Image<float> input2, Image<float> out,
+           float (*correct)(float, float), float tolerance) {
+    for (int x = 0; x < out.width(); x++) {
+        float c = correct(input(x), input2(x));
+        if (error(out(x), c) > tolerance) {
+            printf("%s(%f, %f) = %f instead of %f\n", name, input(x), input2(x), out(x), c);
+            return false;
+        }
+    }
+    return true;
+}
+
+float sqrt_ref(float x, float) {return sqrtf(x);}
+float exp_ref(float x, float) {return expf(x);}
+float log_ref(float x, float) {return logf(x);}
+float sin_ref(float x, float) {return sinf(x);}
+float cos_ref(float x, float) {return cosf(x);}
+// powf itself is off by up to an ulp, so measure pow against double
+// precision. The vector version is within about 6.2e-6.
+float pow_ref(float x, float y) {return (float)pow((double)x, (double)y);}
+
+// The special cases of pow have exact answers, down to the sign of
+// zero, so check those bit for bit (except that any NaN will do).
+bool check_exact(const char *name, Image<float> input, Image<float> input2, Image<float> out,
+                 float (*correct)(float, float)) {
+    for (int x = 0; x < out.width(); x++) {
+        float c = correct(input(x), input2(x));
+        bool ok = isnan(c) ? isnan(out(x)) : (out(x) == c && signbit(out(x)) == signbit(c));
+        if (!ok) {
+            printf("%s(%f, %f) = %f instead of %f\n", name, input(x), input2(x), out(x), c);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const int N = 1 << 16;
+
+    // Arguments over a wide range for each function, plus the special cases
+    Image<float> wide(N), positive(N), exponent(N);
+    // pow is kept well away from overflow, where exp(y * log(x)) and
+    // libm could round to opposite sides of infinity
+    Image<float> pow_base(N), pow_exp(N);
+    for (int i = 0; i < N; i++) {
+        float t = (float)i / N;
+        wide(i) = t * 400.0f - 200.0f;
+        positive(i) = powf(10.0f, t * 60.0f - 30.0f);
+        exponent(i) = t * 16.0f - 8.0f;
+        pow_base(i) = powf(10.0f, 4.0f - t * 8.0f);
+        pow_exp(i) = floorf(exponent(i));
+    }
+    float special[] = {0.0f, -0.0f, 1.0f, -1.0f, INFINITY, -INFINITY, NAN, 1e-40f, 1e30f, -1e30f};
+    for (int i = 0; i < 10; i++) {
+        wide(i) = positive(i) = special[i];
+    }
+    // Every pairing of the bases and exponents pow treats specially,
+    // padded to a multiple of the vector width
+    const int P = 96;
+    Image<float> special_base(P), special_exp(P);
+    float bases[] = {0.0f, -0.0f, 1.0f, -1.0f, INFINITY, -INFINITY, NAN};
+    float exps[] = {0.0f, -0.0f, NAN, INFINITY, -INFINITY, 1.0f, -1.0f,
+                    2.0f, -2.0f, 3.0f, -3.0f, 0.5f, -0.5f};
+    for (int i = 0; i < P; i++) {
+        special_base(i) = i < 7 * 13 ? bases[i / 13] : 1.0f;
+        special_exp(i) = i < 7 * 13 ? exps[i % 13] : 1.0f;
+    }
+    // exp overflows outside about [-104, 89]
+    Image<float> exp_args(N);
+    for (int i = 0; i < N; i++) exp_args(i) = wide(i) * 0.55f;
+
+    int widths[] = {4, 8, 16};
+    for (int w = 0; w < 3; w++) {
+        Var x;
+        int width = widths[w];
+
+        Func f_sqrt, f_exp, f_log, f_sin, f_cos, f_pow, f_pow_neg, f_pow_special;
+        f_sqrt(x) = sqrt(positive(x));
+        f_exp(x) = exp(exp_args(x));
+        f_log(x) = log(positive(x));
+        f_sin(x) = sin(wide(x));
+        f_cos(x) = cos(wide(x));
+        f_pow(x) = pow(pow_base(x), exponent(x));
+        // Negative bases with integer exponents
+        f_pow_neg(x) = pow(wide(x), pow_exp(x));
+        f_pow_special(x) = pow(special_base(x), special_exp(x));
+
+        f_sqrt.vectorize(x, width);
+        f_exp.vectorize(x, width);
+        f_log.vectorize(x, width);
+        f_sin.vectorize(x, width);
+        f_cos.vectorize(x, width);
+        f_pow.vectorize(x, width);
+        f_pow_neg.vectorize(x, width);
+        f_pow_special.vectorize(x, width);
+
+        printf("Testing vector width %d\n", width);
+        if (!check("sqrt", positive, positive, f_sqrt.realize(N), sqrt_ref, 1e-6f) ||
+            !check("exp", exp_args, exp_args, f_exp.realize(N), exp_ref, 1e-6f) ||
+            !check("log", positive, positive, f_log.realize(N), log_ref, 1e-6f) ||
+            !check("sin", wide, wide, f_sin.realize(N), sin_ref, 1e-6f) ||
+            !check("cos", wide, wide, f_cos.realize(N), cos_ref, 1e-6f) ||
+            !check("pow", pow_base, exponent, f_pow.realize(N), pow_ref, 1e-5f) ||
+            !check("pow", wide, pow_exp, f_pow_neg.realize(N), pow_ref, 1e-5f) ||
+            !check_exact("pow", special_base, special_exp, f_pow_special.realize(P), pow_ref)) {
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
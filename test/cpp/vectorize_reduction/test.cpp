@@ -0,0 +1,67 @@
+#include <Halide.h>
+#include <algorithm>
+
+using namespace Halide;
+
+// Reductions vectorized over their reduction domain, with a vector of
+// partial results combined at the end. None of the domains are a
+// multiple of the vector width, so there are leftovers to take care of.
+int main(int argc, char **argv) {
+    const int W = 64, H = 32, K = 11;
+
+    Image<int> in(W + K, H + K);
+    for (int y = 0; y < H + K; y++) {
+        for (int x = 0; x < W + K; x++) {
+            in(x, y) = (x * 7 + y * 13) % 37 - 18;
+        }
+    }
+    Image<int> kernel(K);
+    for (int i = 0; i < K; i++) kernel(i) = i - 3;
+
+    Var x, y;
+    RDom r(0, K);
+
+    // A convolution using the inline reduction helpers
+    Func conv("conv"), lowest("lowest");
+    conv(x, y) = sum(in(x + r, y) * kernel(r), 4);
+    lowest(x, y) = minimum(in(x + r, y), 8);
+
+    // And one over a two dimensional domain, vectorized by hand over
+    // the inner dimension
+    RDom box(0, K, 0, 3);
+    Func box_sum("box_sum");
+    box_sum(x, y) += in(x + box.x, y + box.y);
+    box_sum.vectorize(box.x, 4);
+
+    Image<int> conv_result = conv.realize(W, H);
+    Image<int> lowest_result = lowest.realize(W, H);
+    Image<int> box_result = box_sum.realize(W, H);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int correct_conv = 0, correct_lowest = in(x, y), correct_box = 0;
+            for (int i = 0; i < K; i++) {
+                correct_conv += in(x + i, y) * kernel(i);
+                correct_lowest = std::min(correct_lowest, in(x + i, y));
+                for (int j = 0; j < 3; j++) {
+                    correct_box += in(x + i, y + j);
+                }
+            }
+            if (conv_result(x, y) != correct_conv) {
+                printf("conv(%d, %d) = %d instead of %d\n", x, y, conv_result(x, y), correct_conv);
+                return -1;
+            }
+            if (lowest_result(x, y) != correct_lowest) {
+                printf("lowest(%d, %d) = %d instead of %d\n", x, y, lowest_result(x, y), correct_lowest);
+                return -1;
+            }
+            if (box_result(x, y) != correct_box) {
+                printf("box_sum(%d, %d) = %d instead of %d\n", x, y, box_result(x, y), correct_box);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <Halide.h>
+#include <stdlib.h>
+
+using namespace Halide;
+
+int frees = 0;
+
+void release(float *ptr) {
+    frees++;
+    free(ptr);
+}
+
+// Inputs and outputs that live in memory the caller owns, as if they
+// had come from a DMA or shared memory buffer. The input rows are
+// padded, so it isn't dense. Nothing gets copied in or out.
+int main(int argc, char **argv) {
+    const int W = 64, H = 16, pitch = W + 16;
+
+    float *in_mem, *out_mem;
+    if (posix_memalign((void **)&in_mem, 64, pitch * H * sizeof(float)) ||
+        posix_memalign((void **)&out_mem, 64, W * H * sizeof(float))) {
+        printf("Allocation failed\n");
+        return -1;
+    }
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < pitch; x++) {
+            in_mem[y * pitch + x] = (float)(x < W ? x + y * 3 : -1000);
+        }
+    }
+
+    {
+        Image<float> in(in_mem, {W, H}, {1, pitch}, 64, release);
+        Image<float> out(out_mem, {W, H}, std::vector<int>(), 64, release);
+        if (in.data() != (unsigned char *)in_mem || in.alignment() != 64) {
+            printf("Wrapping the input copied it\n");
+            return -1;
+        }
+
+        UniformImage input(Float(32), 2);
+        Var x, y;
+        Func f;
+        f(x, y) = input(x, y) * 2.0f + in(W - 1 - x, y);
+        f.vectorize(x, 8);
+        // The shifted buffers below aren't 64-byte aligned
+        f.allowAnyLayout();
+
+        input = in;
+        f.realize(out);
+
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                float correct = (x + y * 3) * 2.0f + (W - 1 - x + y * 3);
+                if (out_mem[y * W + x] != correct) {
+                    printf("out(%d, %d) = %f instead of %f\n", x, y, out_mem[y * W + x], correct);
+                    return -1;
+                }
+            }
+        }
+
+        // Memory declared less aligned than it is mustn't be treated
+        // as aligned
+        DynImage loose(Float(32), (unsigned char *)in_mem, {W, H}, {1, pitch}, 16);
+        if (loose.alignment() != 16) {
+            printf("Alignment of wrapped image is %d instead of 16\n", loose.alignment());
+            return -1;
+        }
+
+        // Inputs and outputs that start part way into a vector, read
+        // and written by the same compiled code as above
+        DynImage shifted_in(Float(32), (unsigned char *)(in_mem + 1), {W - 8, H}, {1, pitch});
+        DynImage shifted_out(Float(32), (unsigned char *)(out_mem + 3), {W - 8, H}, {1, W});
+        if (shifted_in.alignment() != 4 || shifted_out.alignment() != 4) {
+            printf("Alignments of shifted images are %d and %d instead of 4\n",
+                   shifted_in.alignment(), shifted_out.alignment());
+            return -1;
+        }
+        input = shifted_in;
+        f.realize(shifted_out);
+
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W - 8; x++) {
+                float correct = (x + 1 + y * 3) * 2.0f + (W - 1 - x + y * 3);
+                if (out_mem[y * W + x + 3] != correct) {
+                    printf("shifted out(%d, %d) = %f instead of %f\n", x, y, out_mem[y * W + x + 3], correct);
+                    return -1;
+                }
+            }
+        }
+
+        if (frees != 0) {
+            printf("Wrapped memory freed while still in use\n");
+            return -1;
+        }
+    }
+
+    if (frees != 2) {
+        printf("Wrapped memory freed %d times instead of 2\n", frees);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}